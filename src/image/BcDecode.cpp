@@ -0,0 +1,816 @@
+#include <string.h>
+
+#include "bcdec.h"
+#include "BcDecode.hpp"
+
+#if defined __SSE4_1__
+#  include <x86intrin.h>
+#endif
+
+static void DecodeBc1Part( uint64_t d, uint32_t* dst, uint32_t w )
+{
+    uint8_t* in = (uint8_t*)&d;
+    uint16_t c0, c1;
+    uint32_t idx;
+    memcpy( &c0, in, 2 );
+    memcpy( &c1, in+2, 2 );
+    memcpy( &idx, in+4, 4 );
+
+    uint8_t r0 = ( ( c0 & 0xF800 ) >> 8 ) | ( ( c0 & 0xF800 ) >> 13 );
+    uint8_t g0 = ( ( c0 & 0x07E0 ) >> 3 ) | ( ( c0 & 0x07E0 ) >> 9 );
+    uint8_t b0 = ( ( c0 & 0x001F ) << 3 ) | ( ( c0 & 0x001F ) >> 2 );
+
+    uint8_t r1 = ( ( c1 & 0xF800 ) >> 8 ) | ( ( c1 & 0xF800 ) >> 13 );
+    uint8_t g1 = ( ( c1 & 0x07E0 ) >> 3 ) | ( ( c1 & 0x07E0 ) >> 9 );
+    uint8_t b1 = ( ( c1 & 0x001F ) << 3 ) | ( ( c1 & 0x001F ) >> 2 );
+
+    uint32_t dict[4];
+
+    dict[0] = 0xFF000000 | ( b0 << 16 ) | ( g0 << 8 ) | r0;
+    dict[1] = 0xFF000000 | ( b1 << 16 ) | ( g1 << 8 ) | r1;
+
+    uint32_t r, g, b;
+    if( c0 > c1 )
+    {
+        r = (2*r0+r1)/3;
+        g = (2*g0+g1)/3;
+        b = (2*b0+b1)/3;
+        dict[2] = 0xFF000000 | ( b << 16 ) | ( g << 8 ) | r;
+        r = (2*r1+r0)/3;
+        g = (2*g1+g0)/3;
+        b = (2*b1+b0)/3;
+        dict[3] = 0xFF000000 | ( b << 16 ) | ( g << 8 ) | r;
+    }
+    else
+    {
+        r = (int(r0)+r1)/2;
+        g = (int(g0)+g1)/2;
+        b = (int(b0)+b1)/2;
+        dict[2] = 0xFF000000 | ( b << 16 ) | ( g << 8 ) | r;
+        dict[3] = 0xFF000000;
+    }
+
+    memcpy( dst+0, dict + (idx & 0x3), 4 );
+    idx >>= 2;
+    memcpy( dst+1, dict + (idx & 0x3), 4 );
+    idx >>= 2;
+    memcpy( dst+2, dict + (idx & 0x3), 4 );
+    idx >>= 2;
+    memcpy( dst+3, dict + (idx & 0x3), 4 );
+    idx >>= 2;
+    dst += w;
+
+    memcpy( dst+0, dict + (idx & 0x3), 4 );
+    idx >>= 2;
+    memcpy( dst+1, dict + (idx & 0x3), 4 );
+    idx >>= 2;
+    memcpy( dst+2, dict + (idx & 0x3), 4 );
+    idx >>= 2;
+    memcpy( dst+3, dict + (idx & 0x3), 4 );
+    idx >>= 2;
+    dst += w;
+
+    memcpy( dst+0, dict + (idx & 0x3), 4 );
+    idx >>= 2;
+    memcpy( dst+1, dict + (idx & 0x3), 4 );
+    idx >>= 2;
+    memcpy( dst+2, dict + (idx & 0x3), 4 );
+    idx >>= 2;
+    memcpy( dst+3, dict + (idx & 0x3), 4 );
+    idx >>= 2;
+    dst += w;
+
+    memcpy( dst+0, dict + (idx & 0x3), 4 );
+    idx >>= 2;
+    memcpy( dst+1, dict + (idx & 0x3), 4 );
+    idx >>= 2;
+    memcpy( dst+2, dict + (idx & 0x3), 4 );
+    idx >>= 2;
+    memcpy( dst+3, dict + (idx & 0x3), 4 );
+}
+
+static void DecodeBc3Part( uint64_t a, uint64_t d, uint32_t* dst, uint32_t w )
+{
+    uint8_t* ain = (uint8_t*)&a;
+    uint8_t a0, a1;
+    uint64_t aidx = 0;
+    memcpy( &a0, ain, 1 );
+    memcpy( &a1, ain+1, 1 );
+    memcpy( &aidx, ain+2, 6 );
+
+    uint8_t* in = (uint8_t*)&d;
+    uint16_t c0, c1;
+    uint32_t idx;
+    memcpy( &c0, in, 2 );
+    memcpy( &c1, in+2, 2 );
+    memcpy( &idx, in+4, 4 );
+
+    uint32_t adict[8];
+    adict[0] = a0 << 24;
+    adict[1] = a1 << 24;
+    if( a0 > a1 )
+    {
+        adict[2] = ( (6*a0+1*a1)/7 ) << 24;
+        adict[3] = ( (5*a0+2*a1)/7 ) << 24;
+        adict[4] = ( (4*a0+3*a1)/7 ) << 24;
+        adict[5] = ( (3*a0+4*a1)/7 ) << 24;
+        adict[6] = ( (2*a0+5*a1)/7 ) << 24;
+        adict[7] = ( (1*a0+6*a1)/7 ) << 24;
+    }
+    else
+    {
+        adict[2] = ( (4*a0+1*a1)/5 ) << 24;
+        adict[3] = ( (3*a0+2*a1)/5 ) << 24;
+        adict[4] = ( (2*a0+3*a1)/5 ) << 24;
+        adict[5] = ( (1*a0+4*a1)/5 ) << 24;
+        adict[6] = 0;
+        adict[7] = 0xFF000000;
+    }
+
+    uint8_t r0 = ( ( c0 & 0xF800 ) >> 8 ) | ( ( c0 & 0xF800 ) >> 13 );
+    uint8_t g0 = ( ( c0 & 0x07E0 ) >> 3 ) | ( ( c0 & 0x07E0 ) >> 9 );
+    uint8_t b0 = ( ( c0 & 0x001F ) << 3 ) | ( ( c0 & 0x001F ) >> 2 );
+
+    uint8_t r1 = ( ( c1 & 0xF800 ) >> 8 ) | ( ( c1 & 0xF800 ) >> 13 );
+    uint8_t g1 = ( ( c1 & 0x07E0 ) >> 3 ) | ( ( c1 & 0x07E0 ) >> 9 );
+    uint8_t b1 = ( ( c1 & 0x001F ) << 3 ) | ( ( c1 & 0x001F ) >> 2 );
+
+    uint32_t dict[4];
+
+    dict[0] = ( b0 << 16 ) | ( g0 << 8 ) | r0;
+    dict[1] = ( b1 << 16 ) | ( g1 << 8 ) | r1;
+
+    uint32_t r, g, b;
+    if( c0 > c1 )
+    {
+        r = (2*r0+r1)/3;
+        g = (2*g0+g1)/3;
+        b = (2*b0+b1)/3;
+        dict[2] = ( b << 16 ) | ( g << 8 ) | r;
+        r = (2*r1+r0)/3;
+        g = (2*g1+g0)/3;
+        b = (2*b1+b0)/3;
+        dict[3] = ( b << 16 ) | ( g << 8 ) | r;
+    }
+    else
+    {
+        r = (int(r0)+r1)/2;
+        g = (int(g0)+g1)/2;
+        b = (int(b0)+b1)/2;
+        dict[2] = ( b << 16 ) | ( g << 8 ) | r;
+        dict[3] = 0;
+    }
+
+    dst[0] = dict[idx & 0x3] | adict[aidx & 0x7];
+    idx >>= 2;
+    aidx >>= 3;
+    dst[1] = dict[idx & 0x3] | adict[aidx & 0x7];
+    idx >>= 2;
+    aidx >>= 3;
+    dst[2] = dict[idx & 0x3] | adict[aidx & 0x7];
+    idx >>= 2;
+    aidx >>= 3;
+    dst[3] = dict[idx & 0x3] | adict[aidx & 0x7];
+    idx >>= 2;
+    aidx >>= 3;
+    dst += w;
+
+    dst[0] = dict[idx & 0x3] | adict[aidx & 0x7];
+    idx >>= 2;
+    aidx >>= 3;
+    dst[1] = dict[idx & 0x3] | adict[aidx & 0x7];
+    idx >>= 2;
+    aidx >>= 3;
+    dst[2] = dict[idx & 0x3] | adict[aidx & 0x7];
+    idx >>= 2;
+    aidx >>= 3;
+    dst[3] = dict[idx & 0x3] | adict[aidx & 0x7];
+    idx >>= 2;
+    aidx >>= 3;
+    dst += w;
+
+    dst[0] = dict[idx & 0x3] | adict[aidx & 0x7];
+    idx >>= 2;
+    aidx >>= 3;
+    dst[1] = dict[idx & 0x3] | adict[aidx & 0x7];
+    idx >>= 2;
+    aidx >>= 3;
+    dst[2] = dict[idx & 0x3] | adict[aidx & 0x7];
+    idx >>= 2;
+    aidx >>= 3;
+    dst[3] = dict[idx & 0x3] | adict[aidx & 0x7];
+    idx >>= 2;
+    aidx >>= 3;
+    dst += w;
+
+    dst[0] = dict[idx & 0x3] | adict[aidx & 0x7];
+    idx >>= 2;
+    aidx >>= 3;
+    dst[1] = dict[idx & 0x3] | adict[aidx & 0x7];
+    idx >>= 2;
+    aidx >>= 3;
+    dst[2] = dict[idx & 0x3] | adict[aidx & 0x7];
+    idx >>= 2;
+    aidx >>= 3;
+    dst[3] = dict[idx & 0x3] | adict[aidx & 0x7];
+}
+
+static void DecodeBc4Part( uint64_t a, uint32_t* dst, uint32_t w )
+{
+    uint8_t* ain = (uint8_t*)&a;
+    uint8_t a0, a1;
+    uint64_t aidx = 0;
+    memcpy( &a0, ain, 1 );
+    memcpy( &a1, ain+1, 1 );
+    memcpy( &aidx, ain+2, 6 );
+
+    uint32_t adict[8];
+    adict[0] = a0;
+    adict[1] = a1;
+    if(a0 > a1)
+    {
+        adict[2] = ( (6*a0+1*a1)/7 );
+        adict[3] = ( (5*a0+2*a1)/7 );
+        adict[4] = ( (4*a0+3*a1)/7 );
+        adict[5] = ( (3*a0+4*a1)/7 );
+        adict[6] = ( (2*a0+5*a1)/7 );
+        adict[7] = ( (1*a0+6*a1)/7 );
+    }
+    else
+    {
+        adict[2] = ( (4*a0+1*a1)/5 );
+        adict[3] = ( (3*a0+2*a1)/5 );
+        adict[4] = ( (2*a0+3*a1)/5 );
+        adict[5] = ( (1*a0+4*a1)/5 );
+        adict[6] = 0;
+        adict[7] = 0xFF;
+    }
+
+    dst[0] = adict[aidx & 0x7] | 0xFF000000;
+    aidx >>= 3;
+    dst[1] = adict[aidx & 0x7] | 0xFF000000;
+    aidx >>= 3;
+    dst[2] = adict[aidx & 0x7] | 0xFF000000;
+    aidx >>= 3;
+    dst[3] = adict[aidx & 0x7] | 0xFF000000;
+    aidx >>= 3;
+    dst += w;
+
+    dst[0] = adict[aidx & 0x7] | 0xFF000000;
+    aidx >>= 3;
+    dst[1] = adict[aidx & 0x7] | 0xFF000000;
+    aidx >>= 3;
+    dst[2] = adict[aidx & 0x7] | 0xFF000000;
+    aidx >>= 3;
+    dst[3] = adict[aidx & 0x7] | 0xFF000000;
+    aidx >>= 3;
+    dst += w;
+
+    dst[0] = adict[aidx & 0x7] | 0xFF000000;
+    aidx >>= 3;
+    dst[1] = adict[aidx & 0x7] | 0xFF000000;
+    aidx >>= 3;
+    dst[2] = adict[aidx & 0x7] | 0xFF000000;
+    aidx >>= 3;
+    dst[3] = adict[aidx & 0x7] | 0xFF000000;
+    aidx >>= 3;
+    dst += w;
+
+    dst[0] = adict[aidx & 0x7] | 0xFF000000;
+    aidx >>= 3;
+    dst[1] = adict[aidx & 0x7] | 0xFF000000;
+    aidx >>= 3;
+    dst[2] = adict[aidx & 0x7] | 0xFF000000;
+    aidx >>= 3;
+    dst[3] = adict[aidx & 0x7] | 0xFF000000;
+}
+
+static void DecodeBc5Part( uint64_t r, uint64_t g, uint32_t* dst, uint32_t w )
+{
+    uint8_t* rin = (uint8_t*)&r;
+    uint8_t r0, r1;
+    uint64_t ridx = 0;
+    memcpy( &r0, rin, 1 );
+    memcpy( &r1, rin+1, 1 );
+    memcpy( &ridx, rin+2, 6 );
+
+    uint8_t* gin = (uint8_t*)&g;
+    uint8_t g0, g1;
+    uint64_t gidx = 0;
+    memcpy( &g0, gin, 1 );
+    memcpy( &g1, gin+1, 1 );
+    memcpy( &gidx, gin+2, 6 );
+
+    uint32_t rdict[8];
+    rdict[0] = r0;
+    rdict[1] = r1;
+    if(r0 > r1)
+    {
+        rdict[2] = ( (6*r0+1*r1)/7 );
+        rdict[3] = ( (5*r0+2*r1)/7 );
+        rdict[4] = ( (4*r0+3*r1)/7 );
+        rdict[5] = ( (3*r0+4*r1)/7 );
+        rdict[6] = ( (2*r0+5*r1)/7 );
+        rdict[7] = ( (1*r0+6*r1)/7 );
+    }
+    else
+    {
+        rdict[2] = ( (4*r0+1*r1)/5 );
+        rdict[3] = ( (3*r0+2*r1)/5 );
+        rdict[4] = ( (2*r0+3*r1)/5 );
+        rdict[5] = ( (1*r0+4*r1)/5 );
+        rdict[6] = 0;
+        rdict[7] = 0xFF;
+    }
+
+    uint32_t gdict[8];
+    gdict[0] = g0 << 8;
+    gdict[1] = g1 << 8;
+    if(g0 > g1)
+    {
+        gdict[2] = ( (6*g0+1*g1)/7 ) << 8;
+        gdict[3] = ( (5*g0+2*g1)/7 ) << 8;
+        gdict[4] = ( (4*g0+3*g1)/7 ) << 8;
+        gdict[5] = ( (3*g0+4*g1)/7 ) << 8;
+        gdict[6] = ( (2*g0+5*g1)/7 ) << 8;
+        gdict[7] = ( (1*g0+6*g1)/7 ) << 8;
+    }
+    else
+    {
+        gdict[2] = ( (4*g0+1*g1)/5 ) << 8;
+        gdict[3] = ( (3*g0+2*g1)/5 ) << 8;
+        gdict[4] = ( (2*g0+3*g1)/5 ) << 8;
+        gdict[5] = ( (1*g0+4*g1)/5 ) << 8;
+        gdict[6] = 0;
+        gdict[7] = 0xFF00;
+    }
+
+    dst[0] = rdict[ridx & 0x7] | gdict[gidx & 0x7] | 0xFF000000;
+    ridx >>= 3;
+    gidx >>= 3;
+    dst[1] = rdict[ridx & 0x7] | gdict[gidx & 0x7] | 0xFF000000;
+    ridx >>= 3;
+    gidx >>= 3;
+    dst[2] = rdict[ridx & 0x7] | gdict[gidx & 0x7] | 0xFF000000;
+    ridx >>= 3;
+    gidx >>= 3;
+    dst[3] = rdict[ridx & 0x7] | gdict[gidx & 0x7] | 0xFF000000;
+    ridx >>= 3;
+    gidx >>= 3;
+    dst += w;
+
+    dst[0] = rdict[ridx & 0x7] | gdict[gidx & 0x7] | 0xFF000000;
+    ridx >>= 3;
+    gidx >>= 3;
+    dst[1] = rdict[ridx & 0x7] | gdict[gidx & 0x7] | 0xFF000000;
+    ridx >>= 3;
+    gidx >>= 3;
+    dst[2] = rdict[ridx & 0x7] | gdict[gidx & 0x7] | 0xFF000000;
+    ridx >>= 3;
+    gidx >>= 3;
+    dst[3] = rdict[ridx & 0x7] | gdict[gidx & 0x7] | 0xFF000000;
+    ridx >>= 3;
+    gidx >>= 3;
+    dst += w;
+
+    dst[0] = rdict[ridx & 0x7] | gdict[gidx & 0x7] | 0xFF000000;
+    ridx >>= 3;
+    gidx >>= 3;
+    dst[1] = rdict[ridx & 0x7] | gdict[gidx & 0x7] | 0xFF000000;
+    ridx >>= 3;
+    gidx >>= 3;
+    dst[2] = rdict[ridx & 0x7] | gdict[gidx & 0x7] | 0xFF000000;
+    ridx >>= 3;
+    gidx >>= 3;
+    dst[3] = rdict[ridx & 0x7] | gdict[gidx & 0x7] | 0xFF000000;
+    ridx >>= 3;
+    gidx >>= 3;
+    dst += w;
+
+    dst[0] = rdict[ridx & 0x7] | gdict[gidx & 0x7] | 0xFF000000;
+    ridx >>= 3;
+    gidx >>= 3;
+    dst[1] = rdict[ridx & 0x7] | gdict[gidx & 0x7] | 0xFF000000;
+    ridx >>= 3;
+    gidx >>= 3;
+    dst[2] = rdict[ridx & 0x7] | gdict[gidx & 0x7] | 0xFF000000;
+    ridx >>= 3;
+    gidx >>= 3;
+    dst[3] = rdict[ridx & 0x7] | gdict[gidx & 0x7] | 0xFF000000;
+    ridx >>= 3;
+    gidx >>= 3;
+}
+
+#if defined __SSE4_1__
+struct Bc1Masks
+{
+    alignas( 16 ) uint8_t mask[256][16];
+};
+
+// For each byte of 2-bit indices, a shuffle selecting the four 32-bit palette entries of one block row
+static constexpr Bc1Masks GenerateBc1Masks()
+{
+    Bc1Masks ret = {};
+    for( int b=0; b<256; b++ )
+    {
+        for( int i=0; i<4; i++ )
+        {
+            const auto idx = ( b >> ( i * 2 ) ) & 0x3;
+            for( int k=0; k<4; k++ ) ret.mask[b][i*4+k] = idx * 4 + k;
+        }
+    }
+    return ret;
+}
+
+static constexpr Bc1Masks s_bc1Masks = GenerateBc1Masks();
+
+static inline void Bc1Expand565( __m128i c, __m128i& rb, __m128i& g )
+{
+    const auto r = _mm_or_si128( _mm_and_si128( _mm_srli_epi32( c, 8 ), _mm_set1_epi32( 0xF8 ) ), _mm_srli_epi32( c, 13 ) );
+    const auto b = _mm_or_si128( _mm_and_si128( _mm_slli_epi32( c, 3 ), _mm_set1_epi32( 0xF8 ) ), _mm_and_si128( _mm_srli_epi32( c, 2 ), _mm_set1_epi32( 0x07 ) ) );
+    rb = _mm_or_si128( r, _mm_slli_epi32( b, 16 ) );
+    g = _mm_or_si128( _mm_and_si128( _mm_srli_epi32( c, 3 ), _mm_set1_epi32( 0xFC ) ), _mm_and_si128( _mm_srli_epi32( c, 9 ), _mm_set1_epi32( 0x03 ) ) );
+}
+
+// Palettes of four BC1 blocks from the low dwords of the blocks, returned transposed so that p[i] holds block i.
+// Red and blue share a dword as two 16-bit lanes, so the divisions are done as 16-bit reciprocal multiplies.
+static inline void Bc1Palette128( __m128i lo, __m128i p[4], uint32_t alpha, uint32_t transparent )
+{
+    const auto c0 = _mm_and_si128( lo, _mm_set1_epi32( 0xFFFF ) );
+    const auto c1 = _mm_srli_epi32( lo, 16 );
+    const auto opaque = _mm_cmpgt_epi32( c0, c1 );
+
+    __m128i rb0, g0, rb1, g1;
+    Bc1Expand565( c0, rb0, g0 );
+    Bc1Expand565( c1, rb1, g1 );
+
+    const auto div3 = _mm_set1_epi16( 21846 );
+    const auto rb2o = _mm_mulhi_epu16( _mm_add_epi16( _mm_add_epi16( rb0, rb0 ), rb1 ), div3 );
+    const auto g2o = _mm_mulhi_epu16( _mm_add_epi16( _mm_add_epi16( g0, g0 ), g1 ), div3 );
+    const auto rb3o = _mm_mulhi_epu16( _mm_add_epi16( _mm_add_epi16( rb1, rb1 ), rb0 ), div3 );
+    const auto g3o = _mm_mulhi_epu16( _mm_add_epi16( _mm_add_epi16( g1, g1 ), g0 ), div3 );
+    const auto rb2t = _mm_srli_epi16( _mm_add_epi16( rb0, rb1 ), 1 );
+    const auto g2t = _mm_srli_epi16( _mm_add_epi16( g0, g1 ), 1 );
+
+    const auto a = _mm_set1_epi32( alpha );
+    const auto d0 = _mm_or_si128( _mm_or_si128( rb0, _mm_slli_epi32( g0, 8 ) ), a );
+    const auto d1 = _mm_or_si128( _mm_or_si128( rb1, _mm_slli_epi32( g1, 8 ) ), a );
+    const auto d2 = _mm_or_si128( _mm_blendv_epi8( _mm_or_si128( rb2t, _mm_slli_epi32( g2t, 8 ) ), _mm_or_si128( rb2o, _mm_slli_epi32( g2o, 8 ) ), opaque ), a );
+    const auto d3 = _mm_blendv_epi8( _mm_set1_epi32( transparent ), _mm_or_si128( _mm_or_si128( rb3o, _mm_slli_epi32( g3o, 8 ) ), a ), opaque );
+
+    const auto t0 = _mm_unpacklo_epi32( d0, d1 );
+    const auto t1 = _mm_unpacklo_epi32( d2, d3 );
+    const auto t2 = _mm_unpackhi_epi32( d0, d1 );
+    const auto t3 = _mm_unpackhi_epi32( d2, d3 );
+    p[0] = _mm_unpacklo_epi64( t0, t1 );
+    p[1] = _mm_unpackhi_epi64( t0, t1 );
+    p[2] = _mm_unpacklo_epi64( t2, t3 );
+    p[3] = _mm_unpackhi_epi64( t2, t3 );
+}
+
+static inline void Bc1Store( __m128i palette, uint32_t idx, uint32_t* dst, uint32_t w )
+{
+    _mm_storeu_si128( (__m128i*)dst, _mm_shuffle_epi8( palette, _mm_load_si128( (const __m128i*)s_bc1Masks.mask[idx & 0xFF] ) ) );
+    dst += w;
+    _mm_storeu_si128( (__m128i*)dst, _mm_shuffle_epi8( palette, _mm_load_si128( (const __m128i*)s_bc1Masks.mask[( idx >> 8 ) & 0xFF] ) ) );
+    dst += w;
+    _mm_storeu_si128( (__m128i*)dst, _mm_shuffle_epi8( palette, _mm_load_si128( (const __m128i*)s_bc1Masks.mask[( idx >> 16 ) & 0xFF] ) ) );
+    dst += w;
+    _mm_storeu_si128( (__m128i*)dst, _mm_shuffle_epi8( palette, _mm_load_si128( (const __m128i*)s_bc1Masks.mask[idx >> 24] ) ) );
+}
+
+static inline void DecodeBc1x4( const uint64_t* src, uint32_t* dst, uint32_t w )
+{
+    const auto b01 = _mm_loadu_si128( (const __m128i*)src );
+    const auto b23 = _mm_loadu_si128( (const __m128i*)( src + 2 ) );
+    const auto lo = _mm_castps_si128( _mm_shuffle_ps( _mm_castsi128_ps( b01 ), _mm_castsi128_ps( b23 ), _MM_SHUFFLE( 2, 0, 2, 0 ) ) );
+    const auto hi = _mm_castps_si128( _mm_shuffle_ps( _mm_castsi128_ps( b01 ), _mm_castsi128_ps( b23 ), _MM_SHUFFLE( 3, 1, 3, 1 ) ) );
+
+    __m128i p[4];
+    Bc1Palette128( lo, p, 0xFF000000, 0xFF000000 );
+
+    alignas( 16 ) uint32_t idx[4];
+    _mm_store_si128( (__m128i*)idx, hi );
+    for( int i=0; i<4; i++ ) Bc1Store( p[i], idx[i], dst + i*4, w );
+}
+
+// Palette of one BC4 block in the low 8 bytes. Both interpolation modes are evaluated
+// as weighted sums in 16-bit lanes and divided with reciprocal multiplies.
+static inline __m128i Bc4Palette( uint64_t block )
+{
+    const auto a0 = _mm_set1_epi16( block & 0xFF );
+    const auto a1 = _mm_set1_epi16( ( block >> 8 ) & 0xFF );
+
+    const auto s7 = _mm_add_epi16( _mm_mullo_epi16( a0, _mm_setr_epi16( 7, 0, 6, 5, 4, 3, 2, 1 ) ), _mm_mullo_epi16( a1, _mm_setr_epi16( 0, 7, 1, 2, 3, 4, 5, 6 ) ) );
+    const auto s5 = _mm_add_epi16( _mm_mullo_epi16( a0, _mm_setr_epi16( 5, 0, 4, 3, 2, 1, 0, 0 ) ), _mm_mullo_epi16( a1, _mm_setr_epi16( 0, 5, 1, 2, 3, 4, 0, 0 ) ) );
+    const auto p7 = _mm_mulhi_epu16( s7, _mm_set1_epi16( 9363 ) );
+    const auto p5 = _mm_or_si128( _mm_mulhi_epu16( s5, _mm_set1_epi16( 13108 ) ), _mm_setr_epi16( 0, 0, 0, 0, 0, 0, 0, 0xFF ) );
+
+    const auto p = _mm_blendv_epi8( p5, p7, _mm_cmpgt_epi16( a0, a1 ) );
+    return _mm_packus_epi16( p, p );
+}
+
+// Expands the 3-bit indices in bytes 2-7 of a BC4 block into one byte per texel. Each texel gets the
+// two bytes holding its bits in a 16-bit lane, which is shifted left so that the index lands at bit 8.
+static inline __m128i Bc4Indices( uint64_t block )
+{
+    const auto v = _mm_cvtsi64_si128( block );
+    const auto lo = _mm_shuffle_epi8( v, _mm_setr_epi8( 2, 3, 2, 3, 2, 3, 3, 4, 3, 4, 3, 4, 4, 5, 4, 5 ) );
+    const auto hi = _mm_shuffle_epi8( v, _mm_setr_epi8( 5, 6, 5, 6, 5, 6, 6, 7, 6, 7, 6, 7, 7, -1, 7, -1 ) );
+    const auto mul = _mm_setr_epi16( 256, 32, 4, 128, 16, 2, 64, 8 );
+    const auto mask = _mm_set1_epi16( 0x7 );
+    const auto l = _mm_and_si128( _mm_srli_epi16( _mm_mullo_epi16( lo, mul ), 8 ), mask );
+    const auto h = _mm_and_si128( _mm_srli_epi16( _mm_mullo_epi16( hi, mul ), 8 ), mask );
+    return _mm_packus_epi16( l, h );
+}
+
+// Moves the four texel bytes of a block row into the given channel of four 32-bit pixels. The
+// unused lanes keep their high bit set after the row offset is added, so pshufb zeroes them.
+template<int Channel>
+static inline __m128i Bc4Row( __m128i v, int row )
+{
+    const auto mask = _mm_setr_epi8(
+        Channel == 0 ? 0 : -128, Channel == 1 ? 0 : -128, Channel == 2 ? 0 : -128, Channel == 3 ? 0 : -128,
+        Channel == 0 ? 1 : -128, Channel == 1 ? 1 : -128, Channel == 2 ? 1 : -128, Channel == 3 ? 1 : -128,
+        Channel == 0 ? 2 : -128, Channel == 1 ? 2 : -128, Channel == 2 ? 2 : -128, Channel == 3 ? 2 : -128,
+        Channel == 0 ? 3 : -128, Channel == 1 ? 3 : -128, Channel == 2 ? 3 : -128, Channel == 3 ? 3 : -128 );
+    return _mm_shuffle_epi8( v, _mm_add_epi8( mask, _mm_set1_epi8( row * 4 ) ) );
+}
+
+static inline void DecodeBc3x4( const uint64_t* src, uint32_t* dst, uint32_t w )
+{
+    const auto b0 = _mm_loadu_si128( (const __m128i*)src );
+    const auto b1 = _mm_loadu_si128( (const __m128i*)( src + 2 ) );
+    const auto b2 = _mm_loadu_si128( (const __m128i*)( src + 4 ) );
+    const auto b3 = _mm_loadu_si128( (const __m128i*)( src + 6 ) );
+    const auto t0 = _mm_unpackhi_epi32( b0, b1 );
+    const auto t1 = _mm_unpackhi_epi32( b2, b3 );
+    const auto lo = _mm_unpacklo_epi64( t0, t1 );
+    const auto hi = _mm_unpackhi_epi64( t0, t1 );
+
+    __m128i p[4];
+    Bc1Palette128( lo, p, 0, 0 );
+
+    alignas( 16 ) uint32_t idx[4];
+    _mm_store_si128( (__m128i*)idx, hi );
+    for( int i=0; i<4; i++ )
+    {
+        const auto a = src[i*2];
+        const auto av = _mm_shuffle_epi8( Bc4Palette( a ), Bc4Indices( a ) );
+        auto ix = idx[i];
+        auto d = dst + i*4;
+        for( int j=0; j<4; j++ )
+        {
+            const auto c = _mm_shuffle_epi8( p[i], _mm_load_si128( (const __m128i*)s_bc1Masks.mask[ix & 0xFF] ) );
+            _mm_storeu_si128( (__m128i*)d, _mm_or_si128( c, Bc4Row<3>( av, j ) ) );
+            ix >>= 8;
+            d += w;
+        }
+    }
+}
+
+static inline void DecodeBc4Block( uint64_t r, uint32_t* dst, uint32_t w )
+{
+    const auto rv = _mm_shuffle_epi8( Bc4Palette( r ), Bc4Indices( r ) );
+    const auto a = _mm_set1_epi32( 0xFF000000 );
+    for( int j=0; j<4; j++ )
+    {
+        _mm_storeu_si128( (__m128i*)dst, _mm_or_si128( Bc4Row<0>( rv, j ), a ) );
+        dst += w;
+    }
+}
+
+static inline void DecodeBc5Block( uint64_t r, uint64_t g, uint32_t* dst, uint32_t w )
+{
+    const auto rv = _mm_shuffle_epi8( Bc4Palette( r ), Bc4Indices( r ) );
+    const auto gv = _mm_shuffle_epi8( Bc4Palette( g ), Bc4Indices( g ) );
+    const auto a = _mm_set1_epi32( 0xFF000000 );
+    for( int j=0; j<4; j++ )
+    {
+        _mm_storeu_si128( (__m128i*)dst, _mm_or_si128( _mm_or_si128( Bc4Row<0>( rv, j ), Bc4Row<1>( gv, j ) ), a ) );
+        dst += w;
+    }
+}
+#endif
+
+#if defined __AVX2__
+static inline void Bc1Expand565( __m256i c, __m256i& rb, __m256i& g )
+{
+    const auto r = _mm256_or_si256( _mm256_and_si256( _mm256_srli_epi32( c, 8 ), _mm256_set1_epi32( 0xF8 ) ), _mm256_srli_epi32( c, 13 ) );
+    const auto b = _mm256_or_si256( _mm256_and_si256( _mm256_slli_epi32( c, 3 ), _mm256_set1_epi32( 0xF8 ) ), _mm256_and_si256( _mm256_srli_epi32( c, 2 ), _mm256_set1_epi32( 0x07 ) ) );
+    rb = _mm256_or_si256( r, _mm256_slli_epi32( b, 16 ) );
+    g = _mm256_or_si256( _mm256_and_si256( _mm256_srli_epi32( c, 3 ), _mm256_set1_epi32( 0xFC ) ), _mm256_and_si256( _mm256_srli_epi32( c, 9 ), _mm256_set1_epi32( 0x03 ) ) );
+}
+
+// Eight blocks at a time; p[i] holds block i in the low lane and block i+4 in the high lane
+static inline void Bc1Palette256( __m256i lo, __m256i p[4] )
+{
+    const auto c0 = _mm256_and_si256( lo, _mm256_set1_epi32( 0xFFFF ) );
+    const auto c1 = _mm256_srli_epi32( lo, 16 );
+    const auto opaque = _mm256_cmpgt_epi32( c0, c1 );
+
+    __m256i rb0, g0, rb1, g1;
+    Bc1Expand565( c0, rb0, g0 );
+    Bc1Expand565( c1, rb1, g1 );
+
+    const auto div3 = _mm256_set1_epi16( 21846 );
+    const auto rb2o = _mm256_mulhi_epu16( _mm256_add_epi16( _mm256_add_epi16( rb0, rb0 ), rb1 ), div3 );
+    const auto g2o = _mm256_mulhi_epu16( _mm256_add_epi16( _mm256_add_epi16( g0, g0 ), g1 ), div3 );
+    const auto rb3o = _mm256_mulhi_epu16( _mm256_add_epi16( _mm256_add_epi16( rb1, rb1 ), rb0 ), div3 );
+    const auto g3o = _mm256_mulhi_epu16( _mm256_add_epi16( _mm256_add_epi16( g1, g1 ), g0 ), div3 );
+    const auto rb2t = _mm256_srli_epi16( _mm256_add_epi16( rb0, rb1 ), 1 );
+    const auto g2t = _mm256_srli_epi16( _mm256_add_epi16( g0, g1 ), 1 );
+
+    const auto a = _mm256_set1_epi32( 0xFF000000 );
+    const auto d0 = _mm256_or_si256( _mm256_or_si256( rb0, _mm256_slli_epi32( g0, 8 ) ), a );
+    const auto d1 = _mm256_or_si256( _mm256_or_si256( rb1, _mm256_slli_epi32( g1, 8 ) ), a );
+    const auto d2 = _mm256_or_si256( _mm256_blendv_epi8( _mm256_or_si256( rb2t, _mm256_slli_epi32( g2t, 8 ) ), _mm256_or_si256( rb2o, _mm256_slli_epi32( g2o, 8 ) ), opaque ), a );
+    const auto d3 = _mm256_or_si256( _mm256_and_si256( _mm256_or_si256( rb3o, _mm256_slli_epi32( g3o, 8 ) ), opaque ), a );
+
+    const auto t0 = _mm256_unpacklo_epi32( d0, d1 );
+    const auto t1 = _mm256_unpacklo_epi32( d2, d3 );
+    const auto t2 = _mm256_unpackhi_epi32( d0, d1 );
+    const auto t3 = _mm256_unpackhi_epi32( d2, d3 );
+    p[0] = _mm256_unpacklo_epi64( t0, t1 );
+    p[1] = _mm256_unpackhi_epi64( t0, t1 );
+    p[2] = _mm256_unpacklo_epi64( t2, t3 );
+    p[3] = _mm256_unpackhi_epi64( t2, t3 );
+}
+
+static inline void DecodeBc1x8( const uint64_t* src, uint32_t* dst, uint32_t w )
+{
+    const auto b0 = _mm256_loadu_si256( (const __m256i*)src );
+    const auto b1 = _mm256_loadu_si256( (const __m256i*)( src + 4 ) );
+    const auto lo = _mm256_permute4x64_epi64( _mm256_castps_si256( _mm256_shuffle_ps( _mm256_castsi256_ps( b0 ), _mm256_castsi256_ps( b1 ), _MM_SHUFFLE( 2, 0, 2, 0 ) ) ), _MM_SHUFFLE( 3, 1, 2, 0 ) );
+    const auto hi = _mm256_permute4x64_epi64( _mm256_castps_si256( _mm256_shuffle_ps( _mm256_castsi256_ps( b0 ), _mm256_castsi256_ps( b1 ), _MM_SHUFFLE( 3, 1, 3, 1 ) ) ), _MM_SHUFFLE( 3, 1, 2, 0 ) );
+
+    __m256i p[4];
+    Bc1Palette256( lo, p );
+
+    alignas( 32 ) uint32_t idx[8];
+    _mm256_store_si256( (__m256i*)idx, hi );
+    for( int i=0; i<4; i++ )
+    {
+        Bc1Store( _mm256_castsi256_si128( p[i] ), idx[i], dst + i*4, w );
+        Bc1Store( _mm256_extracti128_si256( p[i], 1 ), idx[i+4], dst + i*4 + 16, w );
+    }
+}
+#endif
+
+void DecodeBc1( uint32_t* dst, const uint64_t* src, uint32_t width, uint32_t height )
+{
+    for( int y=0; y<height/4; y++ )
+    {
+        int x = 0;
+#if defined __AVX2__
+        for( ; x+8<=width/4; x+=8 )
+        {
+            DecodeBc1x8( src, dst, width );
+            src += 8;
+            dst += 32;
+        }
+#endif
+#if defined __SSE4_1__
+        for( ; x+4<=width/4; x+=4 )
+        {
+            DecodeBc1x4( src, dst, width );
+            src += 4;
+            dst += 16;
+        }
+#endif
+        for( ; x<width/4; x++ )
+        {
+            uint64_t d = *src++;
+            DecodeBc1Part( d, dst, width );
+            dst += 4;
+        }
+        dst += width * 3;
+    }
+}
+
+void DecodeBc3( uint32_t* dst, const uint64_t* src, uint32_t width, uint32_t height )
+{
+    for( int y=0; y<height/4; y++ )
+    {
+        int x = 0;
+#if defined __SSE4_1__
+        for( ; x+4<=width/4; x+=4 )
+        {
+            DecodeBc3x4( src, dst, width );
+            src += 8;
+            dst += 16;
+        }
+#endif
+        for( ; x<width/4; x++ )
+        {
+            uint64_t a = *src++;
+            uint64_t d = *src++;
+            DecodeBc3Part( a, d, dst, width );
+            dst += 4;
+        }
+        dst += width * 3;
+    }
+}
+
+void DecodeBc4( uint32_t* dst, const uint64_t* src, uint32_t width, uint32_t height )
+{
+    for( int y=0; y<height/4; y++ )
+    {
+        for( int x=0; x<width/4; x++ )
+        {
+            uint64_t r = *src++;
+#if defined __SSE4_1__
+            DecodeBc4Block( r, dst, width );
+#else
+            DecodeBc4Part( r, dst, width );
+#endif
+            dst += 4;
+        }
+        dst += width * 3;
+    }
+}
+
+void DecodeBc5( uint32_t* dst, const uint64_t* src, uint32_t width, uint32_t height )
+{
+    for( int y=0; y<height/4; y++ )
+    {
+        for( int x=0; x<width/4; x++ )
+        {
+            uint64_t r = *src++;
+            uint64_t g = *src++;
+#if defined __SSE4_1__
+            DecodeBc5Block( r, g, dst, width );
+#else
+            DecodeBc5Part( r, g, dst, width );
+#endif
+            dst += 4;
+        }
+        dst += width * 3;
+    }
+}
+
+void DecodeBc2( uint32_t* dst, const uint64_t* src, uint32_t width, uint32_t height )
+{
+    for( int y=0; y<height/4; y++ )
+    {
+        for( int x=0; x<width/4; x++ )
+        {
+            bcdec_bc2( src, dst, width * 4 );
+            src += 2;
+            dst += 4;
+        }
+        dst += width * 3;
+    }
+}
+
+void DecodeBc7( uint32_t* dst, const uint64_t* src, uint32_t width, uint32_t height )
+{
+    for( int y=0; y<height/4; y++ )
+    {
+        for( int x=0; x<width/4; x++ )
+        {
+            bcdec_bc7( src, dst, width * 4 );
+            src += 2;
+            dst += 4;
+        }
+        dst += width * 3;
+    }
+}
+
+template<bool Signed>
+static void DecodeBc6hImpl( uint64_t* dst, const uint64_t* src, uint32_t width, uint32_t height )
+{
+    uint16_t block[16*3];
+    for( int y=0; y<height/4; y++ )
+    {
+        for( int x=0; x<width/4; x++ )
+        {
+            bcdec_bc6h_half( src, block, 4*3, Signed );
+            src += 2;
+            auto in = block;
+            for( int i=0; i<4; i++ )
+            {
+                auto out = (uint16_t*)( dst + i * width );
+                for( int j=0; j<4; j++ )
+                {
+                    *out++ = *in++;
+                    *out++ = *in++;
+                    *out++ = *in++;
+                    *out++ = 0x3C00;
+                }
+            }
+            dst += 4;
+        }
+        dst += width * 3;
+    }
+}
+
+void DecodeBc6h( uint64_t* dst, const uint64_t* src, uint32_t width, uint32_t height )
+{
+    DecodeBc6hImpl<false>( dst, src, width, height );
+}
+
+void DecodeBc6hSigned( uint64_t* dst, const uint64_t* src, uint32_t width, uint32_t height )
+{
+    DecodeBc6hImpl<true>( dst, src, width, height );
+}
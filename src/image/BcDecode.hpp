@@ -0,0 +1,15 @@
+#pragma once
+
+#include <stdint.h>
+
+// Decoders of rows of 4x4 BCn blocks, to be driven by DecodeBlocks().
+void DecodeBc1( uint32_t* dst, const uint64_t* src, uint32_t width, uint32_t height );
+void DecodeBc2( uint32_t* dst, const uint64_t* src, uint32_t width, uint32_t height );
+void DecodeBc3( uint32_t* dst, const uint64_t* src, uint32_t width, uint32_t height );
+void DecodeBc4( uint32_t* dst, const uint64_t* src, uint32_t width, uint32_t height );
+void DecodeBc5( uint32_t* dst, const uint64_t* src, uint32_t width, uint32_t height );
+void DecodeBc7( uint32_t* dst, const uint64_t* src, uint32_t width, uint32_t height );
+
+// BC6H output is RGBA half float, one pixel per uint64_t.
+void DecodeBc6h( uint64_t* dst, const uint64_t* src, uint32_t width, uint32_t height );
+void DecodeBc6hSigned( uint64_t* dst, const uint64_t* src, uint32_t width, uint32_t height );
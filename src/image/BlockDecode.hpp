@@ -0,0 +1,60 @@
+#pragma once
+
+#include <algorithm>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+
+#include "util/TaskDispatch.hpp"
+
+template<typename T = uint32_t>
+using BlockDecodeFn = void(*)( T* dst, const uint64_t* src, uint32_t width, uint32_t height );
+
+// Rows of 4x4 blocks are independent, so they are split across the workers in
+// jobs of about 64K texels. blockSize is the size of one block in 64-bit words,
+// and T is the type of a single decoded pixel.
+template<typename T>
+static inline void DecodeBlocks( BlockDecodeFn<T> decode, T* dst, const uint64_t* src, uint32_t width, uint32_t height, uint32_t blockSize, TaskDispatch* td )
+{
+    const auto rows = height / 4;
+    const auto rowsPerJob = std::max<uint32_t>( 1, 16 * 1024 / std::max<uint32_t>( 1, width ) );
+    if( !td || rows <= rowsPerJob )
+    {
+        decode( dst, src, width, height );
+        return;
+    }
+
+    for( uint32_t y=0; y<rows; y+=rowsPerJob )
+    {
+        const auto cnt = std::min( rowsPerJob, rows - y );
+        td->Queue( [decode, dst, src, width, cnt] {
+            decode( dst, src, width, cnt * 4 );
+        } );
+        dst += size_t( width ) * 4 * cnt;
+        src += size_t( width / 4 ) * blockSize * cnt;
+    }
+    td->Sync();
+}
+
+// Edge blocks of images with sizes that are not a multiple of 4 extend past the
+// image, so these are decoded into a padded buffer and cropped.
+template<typename T>
+static inline void DecodeLevel( BlockDecodeFn<T> decode, T* dst, const char* src, uint32_t width, uint32_t height, uint32_t blockSize, TaskDispatch* td )
+{
+    const auto bw = ( width + 3 ) & ~3;
+    const auto bh = ( height + 3 ) & ~3;
+    if( bw == width && bh == height )
+    {
+        DecodeBlocks( decode, dst, (const uint64_t*)src, width, height, blockSize, td );
+    }
+    else
+    {
+        std::vector<T> tmp( size_t( bw ) * bh );
+        DecodeBlocks( decode, tmp.data(), (const uint64_t*)src, bw, bh, blockSize, td );
+        for( uint32_t y=0; y<height; y++ )
+        {
+            memcpy( dst + size_t( y ) * width, tmp.data() + size_t( y ) * bw, width * sizeof( T ) );
+        }
+    }
+}
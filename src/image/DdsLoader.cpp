@@ -1,555 +1,419 @@
+#include <algorithm>
 #include <string.h>
 
-#include "bcdec.h"
+#include "BcDecode.hpp"
+#include "BlockDecode.hpp"
 #include "DdsLoader.hpp"
 #include "util/Bitmap.hpp"
+#include "util/BitmapHdr.hpp"
 #include "util/FileBuffer.hpp"
 #include "util/FileWrapper.hpp"
+#include "util/Logs.hpp"
 #include "util/Panic.hpp"
 
-static void DecodeBc1Part( uint64_t d, uint32_t* dst, uint32_t w )
+DdsLoader::DdsLoader( const std::shared_ptr<FileWrapper>& file, ToneMap::Operator tonemap, TaskDispatch* td )
+    : DdsLoader( std::make_shared<FileBuffer>( file ), tonemap, td )
 {
-    uint8_t* in = (uint8_t*)&d;
-    uint16_t c0, c1;
-    uint32_t idx;
-    memcpy( &c0, in, 2 );
-    memcpy( &c1, in+2, 2 );
-    memcpy( &idx, in+4, 4 );
-
-    uint8_t r0 = ( ( c0 & 0xF800 ) >> 8 ) | ( ( c0 & 0xF800 ) >> 13 );
-    uint8_t g0 = ( ( c0 & 0x07E0 ) >> 3 ) | ( ( c0 & 0x07E0 ) >> 9 );
-    uint8_t b0 = ( ( c0 & 0x001F ) << 3 ) | ( ( c0 & 0x001F ) >> 2 );
-
-    uint8_t r1 = ( ( c1 & 0xF800 ) >> 8 ) | ( ( c1 & 0xF800 ) >> 13 );
-    uint8_t g1 = ( ( c1 & 0x07E0 ) >> 3 ) | ( ( c1 & 0x07E0 ) >> 9 );
-    uint8_t b1 = ( ( c1 & 0x001F ) << 3 ) | ( ( c1 & 0x001F ) >> 2 );
-
-    uint32_t dict[4];
-
-    dict[0] = 0xFF000000 | ( b0 << 16 ) | ( g0 << 8 ) | r0;
-    dict[1] = 0xFF000000 | ( b1 << 16 ) | ( g1 << 8 ) | r1;
+}
 
-    uint32_t r, g, b;
-    if( c0 > c1 )
-    {
-        r = (2*r0+r1)/3;
-        g = (2*g0+g1)/3;
-        b = (2*b0+b1)/3;
-        dict[2] = 0xFF000000 | ( b << 16 ) | ( g << 8 ) | r;
-        r = (2*r1+r0)/3;
-        g = (2*g1+g0)/3;
-        b = (2*b1+b0)/3;
-        dict[3] = 0xFF000000 | ( b << 16 ) | ( g << 8 ) | r;
-    }
-    else
-    {
-        r = (int(r0)+r1)/2;
-        g = (int(g0)+g1)/2;
-        b = (int(b0)+b1)/2;
-        dict[2] = 0xFF000000 | ( b << 16 ) | ( g << 8 ) | r;
-        dict[3] = 0xFF000000;
-    }
+DdsLoader::DdsLoader( std::shared_ptr<DataBuffer> buf, ToneMap::Operator tonemap, TaskDispatch* td )
+    : m_tonemap( tonemap )
+    , m_buf( std::move( buf ) )
+    , m_td( td )
+{
+    m_valid = m_buf->size() >= 4 && memcmp( m_buf->data(), "DDS ", 4 ) == 0;
+    if( !m_valid ) return;
 
-    memcpy( dst+0, dict + (idx & 0x3), 4 );
-    idx >>= 2;
-    memcpy( dst+1, dict + (idx & 0x3), 4 );
-    idx >>= 2;
-    memcpy( dst+2, dict + (idx & 0x3), 4 );
-    idx >>= 2;
-    memcpy( dst+3, dict + (idx & 0x3), 4 );
-    idx >>= 2;
-    dst += w;
-
-    memcpy( dst+0, dict + (idx & 0x3), 4 );
-    idx >>= 2;
-    memcpy( dst+1, dict + (idx & 0x3), 4 );
-    idx >>= 2;
-    memcpy( dst+2, dict + (idx & 0x3), 4 );
-    idx >>= 2;
-    memcpy( dst+3, dict + (idx & 0x3), 4 );
-    idx >>= 2;
-    dst += w;
-
-    memcpy( dst+0, dict + (idx & 0x3), 4 );
-    idx >>= 2;
-    memcpy( dst+1, dict + (idx & 0x3), 4 );
-    idx >>= 2;
-    memcpy( dst+2, dict + (idx & 0x3), 4 );
-    idx >>= 2;
-    memcpy( dst+3, dict + (idx & 0x3), 4 );
-    idx >>= 2;
-    dst += w;
-
-    memcpy( dst+0, dict + (idx & 0x3), 4 );
-    idx >>= 2;
-    memcpy( dst+1, dict + (idx & 0x3), 4 );
-    idx >>= 2;
-    memcpy( dst+2, dict + (idx & 0x3), 4 );
-    idx >>= 2;
-    memcpy( dst+3, dict + (idx & 0x3), 4 );
+    m_valid = ParseHeader();
 }
 
-static void DecodeBc3Part( uint64_t a, uint64_t d, uint32_t* dst, uint32_t w )
-{
-    uint8_t* ain = (uint8_t*)&a;
-    uint8_t a0, a1;
-    uint64_t aidx = 0;
-    memcpy( &a0, ain, 1 );
-    memcpy( &a1, ain+1, 1 );
-    memcpy( &aidx, ain+2, 6 );
-
-    uint8_t* in = (uint8_t*)&d;
-    uint16_t c0, c1;
-    uint32_t idx;
-    memcpy( &c0, in, 2 );
-    memcpy( &c1, in+2, 2 );
-    memcpy( &idx, in+4, 4 );
-
-    uint32_t adict[8];
-    adict[0] = a0 << 24;
-    adict[1] = a1 << 24;
-    if( a0 > a1 )
-    {
-        adict[2] = ( (6*a0+1*a1)/7 ) << 24;
-        adict[3] = ( (5*a0+2*a1)/7 ) << 24;
-        adict[4] = ( (4*a0+3*a1)/7 ) << 24;
-        adict[5] = ( (3*a0+4*a1)/7 ) << 24;
-        adict[6] = ( (2*a0+5*a1)/7 ) << 24;
-        adict[7] = ( (1*a0+6*a1)/7 ) << 24;
-    }
-    else
-    {
-        adict[2] = ( (4*a0+1*a1)/5 ) << 24;
-        adict[3] = ( (3*a0+2*a1)/5 ) << 24;
-        adict[4] = ( (2*a0+3*a1)/5 ) << 24;
-        adict[5] = ( (1*a0+4*a1)/5 ) << 24;
-        adict[6] = 0;
-        adict[7] = 0xFF000000;
-    }
+DdsLoader::~DdsLoader() = default;
 
-    uint8_t r0 = ( ( c0 & 0xF800 ) >> 8 ) | ( ( c0 & 0xF800 ) >> 13 );
-    uint8_t g0 = ( ( c0 & 0x07E0 ) >> 3 ) | ( ( c0 & 0x07E0 ) >> 9 );
-    uint8_t b0 = ( ( c0 & 0x001F ) << 3 ) | ( ( c0 & 0x001F ) >> 2 );
+bool DdsLoader::ParseHeader()
+{
+    if( m_buf->size() < 128 ) return false;
 
-    uint8_t r1 = ( ( c1 & 0xF800 ) >> 8 ) | ( ( c1 & 0xF800 ) >> 13 );
-    uint8_t g1 = ( ( c1 & 0x07E0 ) >> 3 ) | ( ( c1 & 0x07E0 ) >> 9 );
-    uint8_t b1 = ( ( c1 & 0x001F ) << 3 ) | ( ( c1 & 0x001F ) >> 2 );
+    uint32_t hdr[32];
+    memcpy( hdr, m_buf->data(), 128 );
+    if( hdr[1] != 124 ) return false;
 
-    uint32_t dict[4];
+    m_height = hdr[3];
+    m_width = hdr[4];
+    m_depth = ( hdr[2] & 0x800000 ) ? std::max( 1u, hdr[6] ) : 1;    // DDSD_DEPTH
+    m_offset = 128;
+    if( m_width == 0 || m_height == 0 ) return false;
 
-    dict[0] = ( b0 << 16 ) | ( g0 << 8 ) | r0;
-    dict[1] = ( b1 << 16 ) | ( g1 << 8 ) | r1;
+    const auto pfFlags = hdr[20];
+    const auto fourCC = hdr[21];
 
-    uint32_t r, g, b;
-    if( c0 > c1 )
+    if( pfFlags & 0x4 )     // DDPF_FOURCC
     {
-        r = (2*r0+r1)/3;
-        g = (2*g0+g1)/3;
-        b = (2*b0+b1)/3;
-        dict[2] = ( b << 16 ) | ( g << 8 ) | r;
-        r = (2*r1+r0)/3;
-        g = (2*g1+g0)/3;
-        b = (2*b1+b0)/3;
-        dict[3] = ( b << 16 ) | ( g << 8 ) | r;
-    }
-    else
-    {
-        r = (int(r0)+r1)/2;
-        g = (int(g0)+g1)/2;
-        b = (int(b0)+b1)/2;
-        dict[2] = ( b << 16 ) | ( g << 8 ) | r;
-        dict[3] = 0;
+        switch( fourCC )
+        {
+        case 0x31545844:    // DXT1
+            m_format = Format::Bc1;
+            break;
+        case 0x32545844:    // DXT2
+        case 0x33545844:    // DXT3
+            m_format = Format::Bc2;
+            break;
+        case 0x34545844:    // DXT4
+        case 0x35545844:    // DXT5
+            m_format = Format::Bc3;
+            break;
+        case 0x31495441:    // ATI1
+        case 0x55344342:    // BC4U
+            m_format = Format::Bc4;
+            break;
+        case 0x32495441:    // ATI2
+        case 0x55354342:    // BC5U
+            m_format = Format::Bc5;
+            break;
+        case 113:           // D3DFMT_A16B16G16R16F
+            m_format = Format::Half;
+            break;
+        case 116:           // D3DFMT_A32B32G32R32F
+            m_format = Format::Float;
+            break;
+        case 0x30315844:    // DX10
+        {
+            if( m_buf->size() < 148 ) return false;
+            uint32_t dx10[5];
+            memcpy( dx10, m_buf->data() + 128, 20 );
+            m_offset = 148;
+
+            // Texture arrays and cube maps store all mip levels of each slice
+            // one after another, so the first slice is read as a 2D texture.
+            if( dx10[1] != 4 ) m_depth = 1;     // D3D10_RESOURCE_DIMENSION_TEXTURE3D
+
+            switch( dx10[0] )
+            {
+            case 2:                 // R32G32B32A32_FLOAT
+                m_format = Format::Float;
+                break;
+            case 10:                // R16G16B16A16_FLOAT
+                m_format = Format::Half;
+                break;
+            case 24:                // R10G10B10A2_UNORM
+                if( !SetMasks( 32, 0x3FF, 0xFFC00, 0x3FF00000, 0xC0000000 ) ) return false;
+                break;
+            case 27:                // R8G8B8A8
+            case 28:
+            case 29:
+                if( !SetMasks( 32, 0xFF, 0xFF00, 0xFF0000, 0xFF000000 ) ) return false;
+                break;
+            case 49:                // R8G8_UNORM
+                if( !SetMasks( 16, 0xFF, 0xFF00, 0, 0 ) ) return false;
+                break;
+            case 61:                // R8_UNORM
+                if( !SetMasks( 8, 0xFF, 0, 0, 0 ) ) return false;
+                break;
+            case 65:                // A8_UNORM
+                if( !SetMasks( 8, 0, 0, 0, 0xFF ) ) return false;
+                break;
+            case 85:                // B5G6R5_UNORM
+                if( !SetMasks( 16, 0xF800, 0x7E0, 0x1F, 0 ) ) return false;
+                break;
+            case 86:                // B5G5R5A1_UNORM
+                if( !SetMasks( 16, 0x7C00, 0x3E0, 0x1F, 0x8000 ) ) return false;
+                break;
+            case 87:                // B8G8R8A8
+            case 90:
+            case 91:
+                if( !SetMasks( 32, 0xFF0000, 0xFF00, 0xFF, 0xFF000000 ) ) return false;
+                break;
+            case 88:                // B8G8R8X8
+            case 92:
+            case 93:
+                if( !SetMasks( 32, 0xFF0000, 0xFF00, 0xFF, 0 ) ) return false;
+                break;
+            case 115:               // B4G4R4A4_UNORM
+                if( !SetMasks( 16, 0xF00, 0xF0, 0xF, 0xF000 ) ) return false;
+                break;
+            case 70:                // BC1
+            case 71:
+            case 72:
+                m_format = Format::Bc1;
+                break;
+            case 73:                // BC2
+            case 74:
+            case 75:
+                m_format = Format::Bc2;
+                break;
+            case 76:                // BC3
+            case 77:
+            case 78:
+                m_format = Format::Bc3;
+                break;
+            case 79:                // BC4
+            case 80:
+                m_format = Format::Bc4;
+                break;
+            case 82:                // BC5
+            case 83:
+                m_format = Format::Bc5;
+                break;
+            case 94:                // BC6H
+            case 95:
+                m_format = Format::Bc6h;
+                break;
+            case 96:                // BC6H_SF16
+                m_format = Format::Bc6hSigned;
+                break;
+            case 97:                // BC7
+            case 98:
+            case 99:
+                m_format = Format::Bc7;
+                break;
+            default:
+                return false;
+            }
+            break;
+        }
+        default:
+            return false;
+        }
     }
-
-    dst[0] = dict[idx & 0x3] | adict[aidx & 0x7];
-    idx >>= 2;
-    aidx >>= 3;
-    dst[1] = dict[idx & 0x3] | adict[aidx & 0x7];
-    idx >>= 2;
-    aidx >>= 3;
-    dst[2] = dict[idx & 0x3] | adict[aidx & 0x7];
-    idx >>= 2;
-    aidx >>= 3;
-    dst[3] = dict[idx & 0x3] | adict[aidx & 0x7];
-    idx >>= 2;
-    aidx >>= 3;
-    dst += w;
-
-    dst[0] = dict[idx & 0x3] | adict[aidx & 0x7];
-    idx >>= 2;
-    aidx >>= 3;
-    dst[1] = dict[idx & 0x3] | adict[aidx & 0x7];
-    idx >>= 2;
-    aidx >>= 3;
-    dst[2] = dict[idx & 0x3] | adict[aidx & 0x7];
-    idx >>= 2;
-    aidx >>= 3;
-    dst[3] = dict[idx & 0x3] | adict[aidx & 0x7];
-    idx >>= 2;
-    aidx >>= 3;
-    dst += w;
-
-    dst[0] = dict[idx & 0x3] | adict[aidx & 0x7];
-    idx >>= 2;
-    aidx >>= 3;
-    dst[1] = dict[idx & 0x3] | adict[aidx & 0x7];
-    idx >>= 2;
-    aidx >>= 3;
-    dst[2] = dict[idx & 0x3] | adict[aidx & 0x7];
-    idx >>= 2;
-    aidx >>= 3;
-    dst[3] = dict[idx & 0x3] | adict[aidx & 0x7];
-    idx >>= 2;
-    aidx >>= 3;
-    dst += w;
-
-    dst[0] = dict[idx & 0x3] | adict[aidx & 0x7];
-    idx >>= 2;
-    aidx >>= 3;
-    dst[1] = dict[idx & 0x3] | adict[aidx & 0x7];
-    idx >>= 2;
-    aidx >>= 3;
-    dst[2] = dict[idx & 0x3] | adict[aidx & 0x7];
-    idx >>= 2;
-    aidx >>= 3;
-    dst[3] = dict[idx & 0x3] | adict[aidx & 0x7];
-}
-
-static void DecodeBc4Part( uint64_t a, uint32_t* dst, uint32_t w )
-{
-    uint8_t* ain = (uint8_t*)&a;
-    uint8_t a0, a1;
-    uint64_t aidx = 0;
-    memcpy( &a0, ain, 1 );
-    memcpy( &a1, ain+1, 1 );
-    memcpy( &aidx, ain+2, 6 );
-
-    uint32_t adict[8];
-    adict[0] = a0;
-    adict[1] = a1;
-    if(a0 > a1)
+    else if( pfFlags & 0x20000 )    // DDPF_LUMINANCE
     {
-        adict[2] = ( (6*a0+1*a1)/7 );
-        adict[3] = ( (5*a0+2*a1)/7 );
-        adict[4] = ( (4*a0+3*a1)/7 );
-        adict[5] = ( (3*a0+4*a1)/7 );
-        adict[6] = ( (2*a0+5*a1)/7 );
-        adict[7] = ( (1*a0+6*a1)/7 );
+        if( !SetMasks( hdr[22], hdr[23], 0, 0, ( pfFlags & 0x1 ) ? hdr[26] : 0 ) ) return false;
+        m_luminance = true;
     }
-    else
+    else if( pfFlags & 0x40 )       // DDPF_RGB
     {
-        adict[2] = ( (4*a0+1*a1)/5 );
-        adict[3] = ( (3*a0+2*a1)/5 );
-        adict[4] = ( (2*a0+3*a1)/5 );
-        adict[5] = ( (1*a0+4*a1)/5 );
-        adict[6] = 0;
-        adict[7] = 0xFF;
+        if( !SetMasks( hdr[22], hdr[23], hdr[24], hdr[25], ( pfFlags & 0x1 ) ? hdr[26] : 0 ) ) return false;
     }
-
-    dst[0] = adict[aidx & 0x7] | 0xFF000000;
-    aidx >>= 3;
-    dst[1] = adict[aidx & 0x7] | 0xFF000000;
-    aidx >>= 3;
-    dst[2] = adict[aidx & 0x7] | 0xFF000000;
-    aidx >>= 3;
-    dst[3] = adict[aidx & 0x7] | 0xFF000000;
-    aidx >>= 3;
-    dst += w;
-
-    dst[0] = adict[aidx & 0x7] | 0xFF000000;
-    aidx >>= 3;
-    dst[1] = adict[aidx & 0x7] | 0xFF000000;
-    aidx >>= 3;
-    dst[2] = adict[aidx & 0x7] | 0xFF000000;
-    aidx >>= 3;
-    dst[3] = adict[aidx & 0x7] | 0xFF000000;
-    aidx >>= 3;
-    dst += w;
-
-    dst[0] = adict[aidx & 0x7] | 0xFF000000;
-    aidx >>= 3;
-    dst[1] = adict[aidx & 0x7] | 0xFF000000;
-    aidx >>= 3;
-    dst[2] = adict[aidx & 0x7] | 0xFF000000;
-    aidx >>= 3;
-    dst[3] = adict[aidx & 0x7] | 0xFF000000;
-    aidx >>= 3;
-    dst += w;
-
-    dst[0] = adict[aidx & 0x7] | 0xFF000000;
-    aidx >>= 3;
-    dst[1] = adict[aidx & 0x7] | 0xFF000000;
-    aidx >>= 3;
-    dst[2] = adict[aidx & 0x7] | 0xFF000000;
-    aidx >>= 3;
-    dst[3] = adict[aidx & 0x7] | 0xFF000000;
-}
-
-static void DecodeBc5Part( uint64_t r, uint64_t g, uint32_t* dst, uint32_t w )
-{
-    uint8_t* rin = (uint8_t*)&r;
-    uint8_t r0, r1;
-    uint64_t ridx = 0;
-    memcpy( &r0, rin, 1 );
-    memcpy( &r1, rin+1, 1 );
-    memcpy( &ridx, rin+2, 6 );
-
-    uint8_t* gin = (uint8_t*)&g;
-    uint8_t g0, g1;
-    uint64_t gidx = 0;
-    memcpy( &g0, gin, 1 );
-    memcpy( &g1, gin+1, 1 );
-    memcpy( &gidx, gin+2, 6 );
-
-    uint32_t rdict[8];
-    rdict[0] = r0;
-    rdict[1] = r1;
-    if(r0 > r1)
+    else if( pfFlags & 0x2 )        // DDPF_ALPHA
     {
-        rdict[2] = ( (6*r0+1*r1)/7 );
-        rdict[3] = ( (5*r0+2*r1)/7 );
-        rdict[4] = ( (4*r0+3*r1)/7 );
-        rdict[5] = ( (3*r0+4*r1)/7 );
-        rdict[6] = ( (2*r0+5*r1)/7 );
-        rdict[7] = ( (1*r0+6*r1)/7 );
+        if( !SetMasks( hdr[22], 0, 0, 0, hdr[26] ) ) return false;
     }
     else
     {
-        rdict[2] = ( (4*r0+1*r1)/5 );
-        rdict[3] = ( (3*r0+2*r1)/5 );
-        rdict[4] = ( (2*r0+3*r1)/5 );
-        rdict[5] = ( (1*r0+4*r1)/5 );
-        rdict[6] = 0;
-        rdict[7] = 0xFF;
+        return false;
     }
 
-    uint32_t gdict[8];
-    gdict[0] = g0 << 8;
-    gdict[1] = g1 << 8;
-    if(g0 > g1)
-    {
-        gdict[2] = ( (6*g0+1*g1)/7 ) << 8;
-        gdict[3] = ( (5*g0+2*g1)/7 ) << 8;
-        gdict[4] = ( (4*g0+3*g1)/7 ) << 8;
-        gdict[5] = ( (3*g0+4*g1)/7 ) << 8;
-        gdict[6] = ( (2*g0+5*g1)/7 ) << 8;
-        gdict[7] = ( (1*g0+6*g1)/7 ) << 8;
-    }
-    else
+    // Only count the mip levels that are actually present in the file
+    const auto maxLevels = std::clamp( ( hdr[2] & 0x20000 ) ? hdr[7] : 1u, 1u, 32u );   // DDSD_MIPMAPCOUNT
+    auto offset = m_offset;
+    uint32_t w = m_width;
+    uint32_t h = m_height;
+    uint32_t d = m_depth;
+    m_levels = 0;
+    while( m_levels < maxLevels )
     {
-        gdict[2] = ( (4*g0+1*g1)/5 ) << 8;
-        gdict[3] = ( (3*g0+2*g1)/5 ) << 8;
-        gdict[4] = ( (2*g0+3*g1)/5 ) << 8;
-        gdict[5] = ( (1*g0+4*g1)/5 ) << 8;
-        gdict[6] = 0;
-        gdict[7] = 0xFF00;
+        offset += LevelSize( w, h, d );
+        if( offset > m_buf->size() ) break;
+        m_levels++;
+        if( w == 1 && h == 1 && d == 1 ) break;
+        w = std::max( 1u, w / 2 );
+        h = std::max( 1u, h / 2 );
+        d = std::max( 1u, d / 2 );
     }
-
-    dst[0] = rdict[ridx & 0x7] | gdict[gidx & 0x7] | 0xFF000000;
-    ridx >>= 3;
-    gidx >>= 3;
-    dst[1] = rdict[ridx & 0x7] | gdict[gidx & 0x7] | 0xFF000000;
-    ridx >>= 3;
-    gidx >>= 3;
-    dst[2] = rdict[ridx & 0x7] | gdict[gidx & 0x7] | 0xFF000000;
-    ridx >>= 3;
-    gidx >>= 3;
-    dst[3] = rdict[ridx & 0x7] | gdict[gidx & 0x7] | 0xFF000000;
-    ridx >>= 3;
-    gidx >>= 3;
-    dst += w;
-
-    dst[0] = rdict[ridx & 0x7] | gdict[gidx & 0x7] | 0xFF000000;
-    ridx >>= 3;
-    gidx >>= 3;
-    dst[1] = rdict[ridx & 0x7] | gdict[gidx & 0x7] | 0xFF000000;
-    ridx >>= 3;
-    gidx >>= 3;
-    dst[2] = rdict[ridx & 0x7] | gdict[gidx & 0x7] | 0xFF000000;
-    ridx >>= 3;
-    gidx >>= 3;
-    dst[3] = rdict[ridx & 0x7] | gdict[gidx & 0x7] | 0xFF000000;
-    ridx >>= 3;
-    gidx >>= 3;
-    dst += w;
-
-    dst[0] = rdict[ridx & 0x7] | gdict[gidx & 0x7] | 0xFF000000;
-    ridx >>= 3;
-    gidx >>= 3;
-    dst[1] = rdict[ridx & 0x7] | gdict[gidx & 0x7] | 0xFF000000;
-    ridx >>= 3;
-    gidx >>= 3;
-    dst[2] = rdict[ridx & 0x7] | gdict[gidx & 0x7] | 0xFF000000;
-    ridx >>= 3;
-    gidx >>= 3;
-    dst[3] = rdict[ridx & 0x7] | gdict[gidx & 0x7] | 0xFF000000;
-    ridx >>= 3;
-    gidx >>= 3;
-    dst += w;
-
-    dst[0] = rdict[ridx & 0x7] | gdict[gidx & 0x7] | 0xFF000000;
-    ridx >>= 3;
-    gidx >>= 3;
-    dst[1] = rdict[ridx & 0x7] | gdict[gidx & 0x7] | 0xFF000000;
-    ridx >>= 3;
-    gidx >>= 3;
-    dst[2] = rdict[ridx & 0x7] | gdict[gidx & 0x7] | 0xFF000000;
-    ridx >>= 3;
-    gidx >>= 3;
-    dst[3] = rdict[ridx & 0x7] | gdict[gidx & 0x7] | 0xFF000000;
-    ridx >>= 3;
-    gidx >>= 3;
+    return m_levels > 0;
 }
 
-static void DecodeBc1( uint32_t* dst, const uint64_t* src, uint32_t width, uint32_t height )
+bool DdsLoader::SetMasks( uint32_t bpp, uint32_t r, uint32_t g, uint32_t b, uint32_t a )
 {
-    for( int y=0; y<height/4; y++ )
+    if( bpp != 8 && bpp != 16 && bpp != 24 && bpp != 32 ) return false;
+
+    m_format = Format::Rgba;
+    m_bpp = bpp;
+    m_luminance = false;
+    m_mask[0] = r;
+    m_mask[1] = g;
+    m_mask[2] = b;
+    m_mask[3] = a;
+    for( int i=0; i<4; i++ )
     {
-        for( int x=0; x<width/4; x++ )
+        if( m_mask[i] == 0 )
         {
-            uint64_t d = *src++;
-            DecodeBc1Part( d, dst, width );
-            dst += 4;
+            m_shift[i] = 0;
+            m_max[i] = 0;
         }
-        dst += width * 3;
-    }
-}
-
-static void DecodeBc3( uint32_t* dst, const uint64_t* src, uint32_t width, uint32_t height )
-{
-    for( int y=0; y<height/4; y++ )
-    {
-        for( int x=0; x<width/4; x++ )
+        else
         {
-            uint64_t a = *src++;
-            uint64_t d = *src++;
-            DecodeBc3Part( a, d, dst, width );
-            dst += 4;
+            m_shift[i] = __builtin_ctz( m_mask[i] );
+            m_max[i] = m_mask[i] >> m_shift[i];
         }
-        dst += width * 3;
     }
+    return true;
 }
 
-static void DecodeBc4( uint32_t* dst, const uint64_t* src, uint32_t width, uint32_t height )
+size_t DdsLoader::LevelSize( uint32_t width, uint32_t height, uint32_t depth ) const
 {
-    for( int y=0; y<height/4; y++ )
+    const auto blocks = size_t( ( width + 3 ) / 4 ) * ( ( height + 3 ) / 4 ) * depth;
+    switch( m_format )
     {
-        for( int x=0; x<width/4; x++ )
-        {
-            uint64_t r = *src++;
-            DecodeBc4Part( r, dst, width );
-            dst += 4;
-        }
-        dst += width * 3;
+    case Format::Bc1:
+    case Format::Bc4:
+        return blocks * 8;
+    case Format::Bc2:
+    case Format::Bc3:
+    case Format::Bc5:
+    case Format::Bc6h:
+    case Format::Bc6hSigned:
+    case Format::Bc7:
+        return blocks * 16;
+    case Format::Rgba:
+        return size_t( width ) * height * depth * ( m_bpp / 8 );
+    case Format::Half:
+        return size_t( width ) * height * depth * 8;
+    case Format::Float:
+        return size_t( width ) * height * depth * 16;
+    default:
+        CheckPanic( false, "Unsupported DDS format" );
+        return 0;
     }
 }
 
-static void DecodeBc5( uint32_t* dst, const uint64_t* src, uint32_t width, uint32_t height )
+const char* DdsLoader::SelectLevel( uint32_t& width, uint32_t& height ) const
 {
-    for( int y=0; y<height/4; y++ )
+    const auto reduction = GetReduction( m_width, m_height, 1u << ( m_levels - 1 ) );
+
+    auto offset = m_offset;
+    uint32_t depth = m_depth;
+    width = m_width;
+    height = m_height;
+    for( uint32_t r=1; r<reduction; r*=2 )
     {
-        for( int x=0; x<width/4; x++ )
-        {
-            uint64_t r = *src++;
-            uint64_t g = *src++;
-            DecodeBc5Part( r, g, dst, width );
-            dst += 4;
-        }
-        dst += width * 3;
+        offset += LevelSize( width, height, depth );
+        width = std::max( 1u, width / 2 );
+        height = std::max( 1u, height / 2 );
+        depth = std::max( 1u, depth / 2 );
     }
+    if( reduction > 1 ) mclog( LogLevel::Info, "DDS: using mip level %ux%u", width, height );
+
+    // Only the selected level is read, so readahead of the whole file is wasted
+    m_buf->Advise( DataBuffer::Access::Random );
+    m_buf->Prefetch( offset, LevelSize( width, height, depth ) );
+    return m_buf->data() + offset;
 }
 
-static void DecodeBc7( uint32_t* dst, const uint64_t* src, uint32_t width, uint32_t height )
+void DdsLoader::DecodeRgba( uint32_t* dst, const uint8_t* src, uint32_t width, uint32_t height ) const
 {
-    for( int y=0; y<height/4; y++ )
+    const auto bytes = m_bpp / 8;
+    for( uint32_t y=0; y<height; y++ )
     {
-        for( int x=0; x<width/4; x++ )
+        for( uint32_t x=0; x<width; x++ )
         {
-            bcdec_bc7( src, dst, width * 4 );
-            src += 2;
-            dst += 4;
+            uint32_t px = 0;
+            memcpy( &px, src, bytes );
+            src += bytes;
+
+            uint32_t c[4];
+            for( int i=0; i<4; i++ )
+            {
+                c[i] = m_max[i] == 0 ? 0 : ( ( ( px & m_mask[i] ) >> m_shift[i] ) * 255 + m_max[i] / 2 ) / m_max[i];
+            }
+            if( m_luminance ) c[1] = c[2] = c[0];
+            if( m_max[3] == 0 ) c[3] = 255;
+
+            *dst++ = c[0] | ( c[1] << 8 ) | ( c[2] << 16 ) | ( c[3] << 24 );
         }
-        dst += width * 3;
     }
 }
 
-DdsLoader::DdsLoader( std::shared_ptr<FileWrapper> file )
-    : m_file( std::move( file ) )
+bool DdsLoader::IsValid() const
 {
-    fseek( *m_file, 0, SEEK_SET );
-    uint32_t magic;
-    m_valid = fread( &magic, 1, 4, *m_file ) == 4 && magic == 0x20534444;
-    if( !m_valid ) return;
-
-    fseek( *m_file, 21*4, SEEK_SET );
-    fread( &m_format, 1, 4, *m_file );
-    switch( m_format )
-    {
-    case 0x31545844:    // BC1
-    case 0x35545844:    // BC3
-    case 0x31495441:    // BC4
-    case 0x55344342:    // BC4
-    case 0x32495441:    // BC5
-    case 0x55354342:    // BC5
-        m_valid = true;
-        m_offset = 128;
-        break;
-    case 0x30315844:    // DX10
-        fseek( *m_file, 32*4, SEEK_SET );
-        fread( &m_format, 1, 4, *m_file );
-        m_valid =
-            m_format == 80 ||   // BC4
-            m_format == 83 ||   // BC5
-            m_format == 98;     // BC7
-        m_offset = 148;
-        break;
-    default:
-        m_valid = false;
-        break;
-    }
+    return m_valid;
 }
 
-bool DdsLoader::IsValid() const
+bool DdsLoader::IsHdr()
 {
-    return m_valid;
+    return m_format == Format::Bc6h || m_format == Format::Bc6hSigned || m_format == Format::Half || m_format == Format::Float;
 }
 
 std::unique_ptr<Bitmap> DdsLoader::Load()
 {
     CheckPanic( m_valid, "Invalid DDS file" );
 
-    FileBuffer buf( m_file );
-    const auto ptr = (uint32_t*)buf.data();
+    if( IsHdr() ) return LoadHdr()->Tonemap( m_tonemap, m_td );
 
-    uint32_t width = ptr[4];
-    uint32_t height = ptr[3];
+    uint32_t width, height;
+    auto src = SelectLevel( width, height );
 
     auto bmp = std::make_unique<Bitmap>( width, height );
+    auto dst = (uint32_t*)bmp->Data();
 
     switch( m_format )
     {
-    case 0x31545844:
-        DecodeBc1( (uint32_t*)bmp->Data(), (const uint64_t*)(buf.data() + m_offset), width, height );
+    case Format::Bc1:
+        DecodeLevel( DecodeBc1, dst, src, width, height, 1, m_td );
+        break;
+    case Format::Bc2:
+        DecodeLevel( DecodeBc2, dst, src, width, height, 2, m_td );
         break;
-    case 0x35545844:
-        DecodeBc3( (uint32_t*)bmp->Data(), (const uint64_t*)(buf.data() + m_offset), width, height );
+    case Format::Bc3:
+        DecodeLevel( DecodeBc3, dst, src, width, height, 2, m_td );
         break;
-    case 0x31495441:
-    case 0x55344342:
-    case 80:
-        DecodeBc4( (uint32_t*)bmp->Data(), (const uint64_t*)(buf.data() + m_offset), width, height );
+    case Format::Bc4:
+        DecodeLevel( DecodeBc4, dst, src, width, height, 1, m_td );
         break;
-    case 0x32495441:
-    case 0x55354342:
-    case 83:
-        DecodeBc5( (uint32_t*)bmp->Data(), (const uint64_t*)(buf.data() + m_offset), width, height );
+    case Format::Bc5:
+        DecodeLevel( DecodeBc5, dst, src, width, height, 2, m_td );
         break;
-    case 98:
-        DecodeBc7( (uint32_t*)bmp->Data(), (const uint64_t*)(buf.data() + m_offset), width, height );
+    case Format::Bc7:
+        DecodeLevel( DecodeBc7, dst, src, width, height, 2, m_td );
         break;
+    case Format::Rgba:
+    {
+        const auto stride = size_t( width ) * ( m_bpp / 8 );
+        const auto rowsPerJob = std::max<uint32_t>( 1, 16 * 1024 / width );
+        if( !m_td || height <= rowsPerJob )
+        {
+            DecodeRgba( dst, (const uint8_t*)src, width, height );
+        }
+        else
+        {
+            for( uint32_t y=0; y<height; y+=rowsPerJob )
+            {
+                const auto cnt = std::min( rowsPerJob, height - y );
+                m_td->Queue( [this, dst, src, width, cnt] {
+                    DecodeRgba( dst, (const uint8_t*)src, width, cnt );
+                } );
+                dst += size_t( width ) * cnt;
+                src += stride * cnt;
+            }
+            m_td->Sync();
+        }
+        break;
+    }
     default:
         CheckPanic( false, "Unsupported DDS format" );
     }
 
     return bmp;
 }
+
+std::unique_ptr<BitmapHdr> DdsLoader::LoadHdr()
+{
+    CheckPanic( m_valid, "Invalid DDS file" );
+
+    uint32_t width, height;
+    const auto src = SelectLevel( width, height );
+
+    std::unique_ptr<BitmapHdr> hdr;
+    switch( m_format )
+    {
+    case Format::Bc6h:
+        hdr = std::make_unique<BitmapHdr>( width, height, BitmapHdr::Format::Half );
+        DecodeLevel( DecodeBc6h, (uint64_t*)hdr->DataHalf(), src, width, height, 2, m_td );
+        break;
+    case Format::Bc6hSigned:
+        hdr = std::make_unique<BitmapHdr>( width, height, BitmapHdr::Format::Half );
+        DecodeLevel( DecodeBc6hSigned, (uint64_t*)hdr->DataHalf(), src, width, height, 2, m_td );
+        break;
+    case Format::Half:
+        hdr = std::make_unique<BitmapHdr>( width, height, BitmapHdr::Format::Half );
+        memcpy( hdr->DataHalf(), src, size_t( width ) * height * 8 );
+        break;
+    case Format::Float:
+        hdr = std::make_unique<BitmapHdr>( width, height );
+        memcpy( hdr->Data(), src, size_t( width ) * height * 16 );
+        break;
+    default:
+        return nullptr;
+    }
+
+    return hdr;
+}
@@ -1,28 +1,70 @@
 #pragma once
 
 #include <memory>
+#include <stddef.h>
 #include <stdint.h>
 
 #include "ImageLoader.hpp"
 #include "util/NoCopy.hpp"
 
 class Bitmap;
+class BitmapHdr;
+class DataBuffer;
 class FileWrapper;
+class TaskDispatch;
 
 class DdsLoader : public ImageLoader
 {
+    enum class Format
+    {
+        Bc1,
+        Bc2,
+        Bc3,
+        Bc4,
+        Bc5,
+        Bc6h,
+        Bc6hSigned,
+        Bc7,
+        Rgba,
+        Half,
+        Float
+    };
+
 public:
-    explicit DdsLoader( std::shared_ptr<FileWrapper> file );
+    explicit DdsLoader( const std::shared_ptr<FileWrapper>& file, ToneMap::Operator tonemap, TaskDispatch* td );
+    explicit DdsLoader( std::shared_ptr<DataBuffer> buf, ToneMap::Operator tonemap, TaskDispatch* td );
+    ~DdsLoader() override;
 
     NoCopy( DdsLoader );
 
     [[nodiscard]] bool IsValid() const override;
+    [[nodiscard]] bool IsHdr() override;
+    [[nodiscard]] bool PreferHdr() override { return true; }
+
     [[nodiscard]] std::unique_ptr<Bitmap> Load() override;
+    [[nodiscard]] std::unique_ptr<BitmapHdr> LoadHdr() override;
 
 private:
+    [[nodiscard]] bool ParseHeader();
+    [[nodiscard]] bool SetMasks( uint32_t bpp, uint32_t r, uint32_t g, uint32_t b, uint32_t a );
+    [[nodiscard]] size_t LevelSize( uint32_t width, uint32_t height, uint32_t depth ) const;
+    [[nodiscard]] const char* SelectLevel( uint32_t& width, uint32_t& height ) const;
+
+    void DecodeRgba( uint32_t* dst, const uint8_t* src, uint32_t width, uint32_t height ) const;
+
     bool m_valid;
-    std::shared_ptr<FileWrapper> m_file;
+    ToneMap::Operator m_tonemap;
+    std::shared_ptr<DataBuffer> m_buf;
+    TaskDispatch* m_td;
+
+    Format m_format;
+    size_t m_offset;
+    uint32_t m_width, m_height, m_depth;
+    uint32_t m_levels;
 
-    uint32_t m_format;
-    uint32_t m_offset;
+    uint32_t m_bpp;
+    uint32_t m_mask[4];
+    uint32_t m_shift[4];
+    uint32_t m_max[4];
+    bool m_luminance;
 };
@@ -0,0 +1,9 @@
+#pragma once
+
+#include <stdint.h>
+
+// Decoders of rows of 4x4 ETC1/ETC2/EAC blocks, to be driven by DecodeBlocks().
+void DecodeEtc2Rgb( uint32_t* dst, const uint64_t* src, uint32_t width, uint32_t height );
+void DecodeEtc2Rgba( uint32_t* dst, const uint64_t* src, uint32_t width, uint32_t height );
+void DecodeEacR( uint32_t* dst, const uint64_t* src, uint32_t width, uint32_t height );
+void DecodeEacRg( uint32_t* dst, const uint64_t* src, uint32_t width, uint32_t height );
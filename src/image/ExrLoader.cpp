@@ -1,14 +1,31 @@
+#include <algorithm>
+#include <format>
+#include <set>
+#include <stdexcept>
+#include <string.h>
+#include <string>
+#include <strings.h>
+#include <utility>
 #include <vector>
 
+#include <ImfChannelList.h>
 #include <ImfChromaticities.h>
+#include <ImfMultiPartInputFile.h>
+#include <ImfPartType.h>
 #include <ImfRgbaFile.h>
 #include <ImfStandardAttributes.h>
+#include <ImfThreading.h>
+#include <ImfTiledRgbaFile.h>
 #include <lcms2.h>
 
 #include "ExrLoader.hpp"
 #include "util/Bitmap.hpp"
 #include "util/BitmapHdr.hpp"
+#include "util/ColorTransform.hpp"
+#include "util/FileBuffer.hpp"
 #include "util/FileWrapper.hpp"
+#include "util/Half.hpp"
+#include "util/Logs.hpp"
 #include "util/Panic.hpp"
 #include "util/TaskDispatch.hpp"
 #include "util/Tonemapper.hpp"
@@ -16,30 +33,259 @@
 class ExrStream : public Imf::IStream
 {
 public:
-    explicit ExrStream( std::shared_ptr<FileWrapper>&& file )
+    explicit ExrStream( std::shared_ptr<DataBuffer> buf )
         : Imf::IStream( "<unknown>" )
-        , m_file( std::move( file ) )
+        , m_buf( std::move( buf ) )
+        , m_pos( 0 )
     {
-        fseek( *m_file, 0, SEEK_SET );
     }
 
-    bool isMemoryMapped() const override { return false; }
-    bool read( char c[], int n ) override { fread( c, 1, n, *m_file ); return !feof( *m_file ); }
-    uint64_t tellg() override { return ftell( *m_file ); }
-    void seekg( uint64_t pos ) override { fseek( *m_file, pos, SEEK_SET ); }
+    bool isMemoryMapped() const override { return true; }
+    char* readMemoryMapped( int n ) override { return (char*)Advance( n ); }
+    bool read( char c[], int n ) override { memcpy( c, Advance( n ), n ); return m_pos < m_buf->size(); }
+    uint64_t tellg() override { return m_pos; }
+    void seekg( uint64_t pos ) override { m_pos = pos; }
+
+#if OPENEXR_VERSION_MAJOR > 3 || ( OPENEXR_VERSION_MAJOR == 3 && OPENEXR_VERSION_MINOR >= 2 )
+    // Lets OpenEXR fetch chunks from its worker threads without serializing on the stream position
+    bool isStatelessRead() const override { return true; }
+    int64_t read( void* buf, uint64_t sz, uint64_t offset ) override
+    {
+        if( offset >= m_buf->size() ) return 0;
+        sz = std::min<uint64_t>( sz, m_buf->size() - offset );
+        memcpy( buf, m_buf->data() + offset, sz );
+        return sz;
+    }
+    int64_t size() override { return m_buf->size(); }
+#endif
 
 private:
-    std::shared_ptr<FileWrapper> m_file;
+    const char* Advance( int n )
+    {
+        if( m_pos + n > m_buf->size() ) throw std::runtime_error( "Unexpected end of EXR file" );
+        auto ptr = m_buf->data() + m_pos;
+        m_pos += n;
+        return ptr;
+    }
+
+    std::shared_ptr<DataBuffer> m_buf;
+    uint64_t m_pos;
 };
 
-ExrLoader::ExrLoader( std::shared_ptr<FileWrapper> file, ToneMap::Operator tonemap, TaskDispatch* td )
+namespace
+{
+bool HasColor( const Imf::ChannelList& channels, const std::string& prefix )
+{
+    return channels.findChannel( prefix + "R" ) || channels.findChannel( prefix + "G" ) || channels.findChannel( prefix + "B" ) || channels.findChannel( prefix + "Y" );
+}
+
+// Returns an empty string if the default layer has color, otherwise the
+// best layer that does: a beauty pass if one can be recognized, or the first
+std::string FindLayer( const Imf::ChannelList& channels )
+{
+    if( HasColor( channels, "" ) ) return {};
+
+    std::set<std::string> layers;
+    channels.layers( layers );
+
+    std::string ret;
+    for( auto& layer : layers )
+    {
+        if( !HasColor( channels, layer + "." ) ) continue;
+
+        const auto dot = layer.rfind( '.' );
+        const auto name = dot == std::string::npos ? layer : layer.substr( dot + 1 );
+        if( strcasecmp( name.c_str(), "combined" ) == 0 || strcasecmp( name.c_str(), "beauty" ) == 0 || strcasecmp( name.c_str(), "rgba" ) == 0 ) return layer;
+        if( ret.empty() ) ret = layer;
+    }
+    return ret;
+}
+
+#if OPENEXR_VERSION_MAJOR > 3 || ( OPENEXR_VERSION_MAJOR == 3 && OPENEXR_VERSION_MINOR >= 1 )
+#  define EXR_RGBA_MULTIPART
+#endif
+
+bool IsMultiPart( const DataBuffer& buf )
+{
+    if( buf.size() < 8 ) return false;
+    uint32_t version;
+    memcpy( &version, buf.data() + 4, 4 );
+    return version & 0x1000;
+}
+
+#ifdef EXR_RGBA_MULTIPART
+// Multipart files may keep passes without color, such as depth or object
+// IDs, in any part. The first part that has color, in its default layer or
+// in any other, is used.
+int FindPart( Imf::IStream& stream )
+{
+    Imf::MultiPartInputFile file( stream );
+
+    int ret = -1;
+    for( int i=0; i<file.parts(); i++ )
+    {
+        const auto& header = file.header( i );
+        const auto name = header.hasName() ? header.name().c_str() : "";
+        const auto deep = header.hasType() && Imf::isDeepData( header.type() );
+        if( ret < 0 && !deep && ( HasColor( header.channels(), "" ) || !FindLayer( header.channels() ).empty() ) )
+        {
+            mclog( LogLevel::Info, "EXR part %i: %s", i, name );
+            ret = i;
+        }
+        else
+        {
+            mclog( LogLevel::Info, "EXR part %i skipped: %s", i, name );
+        }
+    }
+    return std::max( ret, 0 );
+}
+#endif
+
+std::unique_ptr<Imf::RgbaInputFile> OpenPart( Imf::IStream& stream, int part, const std::string& layer )
+{
+    stream.seekg( 0 );
+#ifdef EXR_RGBA_MULTIPART
+    return std::make_unique<Imf::RgbaInputFile>( part, stream, layer );
+#else
+    return std::make_unique<Imf::RgbaInputFile>( stream, layer );
+#endif
+}
+
+std::shared_ptr<void> CreateTransform( const Imf::Header& header )
+{
+    const auto chroma = header.findTypedAttribute<OPENEXR_IMF_INTERNAL_NAMESPACE::ChromaticitiesAttribute>( "chromaticities" );
+    if( !chroma ) return nullptr;
+
+    const auto neutral = header.findTypedAttribute<IMATH_NAMESPACE::V2f>( "adoptedNeutral" );
+    const auto white = neutral ? cmsCIExyY { neutral->x, neutral->y, 1 } : cmsCIExyY { 0.3127f, 0.329f, 1 };
+
+    const cmsCIExyYTRIPLE primaries = {
+        { chroma->value().red.x, chroma->value().red.y, 1 },
+        { chroma->value().green.x, chroma->value().green.y, 1 },
+        { chroma->value().blue.x, chroma->value().blue.y, 1 }
+    };
+    cmsToneCurve* linear = cmsBuildGamma( nullptr, 1 );
+    cmsToneCurve* linear3[3] = { linear, linear, linear };
+
+    constexpr cmsCIExyY white709 = { 0.3127f, 0.329f, 1 };
+    constexpr cmsCIExyYTRIPLE primaries709 = {
+        { 0.64f, 0.33f, 1 },
+        { 0.30f, 0.60f, 1 },
+        { 0.15f, 0.06f, 1 }
+    };
+
+    // Converted in place; the alpha channel is not touched by the transform
+    const auto key = std::format( "linear709\nlinear {} {} {} {} {} {} {} {}", white.x, white.y, primaries.Red.x, primaries.Red.y, primaries.Green.x, primaries.Green.y, primaries.Blue.x, primaries.Blue.y );
+    auto transform = GetColorTransform( key, TYPE_RGBA_HALF_FLT, TYPE_RGBA_HALF_FLT, 0, [&] {
+        return std::make_pair( cmsCreateRGBProfile( &white, &primaries, linear3 ), cmsCreateRGBProfile( &white709, &primaries709, linear3 ) );
+    } );
+
+    cmsFreeToneCurve( linear );
+
+    return transform;
+}
+
+void Prepare( Imf::Rgba* ptr, size_t sz, cmsHTRANSFORM transform )
+{
+    if( transform ) cmsDoTransform( transform, ptr, ptr, sz );
+
+    const half one = 1.f;
+    while( sz-- )
+    {
+        ptr->a = one;
+        ptr++;
+    }
+}
+
+// Partial boxes at the right and bottom edges average only the pixels they cover
+void BoxReduce( float* dst, const Imf::Rgba* src, int width, int rows, int reduction )
+{
+    const auto outWidth = ( width + reduction - 1 ) / reduction;
+
+    std::vector<float> line( width * 4 );
+    std::vector<float> acc( outWidth * 4 );
+
+    for( int y=0; y<rows; y+=reduction )
+    {
+        const auto ry = std::min( reduction, rows - y );
+        std::fill( acc.begin(), acc.end(), 0.f );
+
+        for( int i=0; i<ry; i++ )
+        {
+            HalfToFloat( line.data(), (const uint16_t*)( src + size_t( y + i ) * width ), width * 4 );
+
+            auto l = line.data();
+            auto a = acc.data();
+            for( int x=0; x<width; x+=reduction )
+            {
+                const auto rx = std::min( reduction, width - x );
+                for( int j=0; j<rx; j++ )
+                {
+                    a[0] += l[0];
+                    a[1] += l[1];
+                    a[2] += l[2];
+                    a[3] += l[3];
+                    l += 4;
+                }
+                a += 4;
+            }
+        }
+
+        auto a = acc.data();
+        for( int x=0; x<width; x+=reduction )
+        {
+            const auto div = 1.f / ( ry * std::min( reduction, width - x ) );
+            *dst++ = *a++ * div;
+            *dst++ = *a++ * div;
+            *dst++ = *a++ * div;
+            *dst++ = *a++ * div;
+        }
+    }
+}
+}
+
+ExrLoader::ExrLoader( const std::shared_ptr<FileWrapper>& file, ToneMap::Operator tonemap, TaskDispatch* td )
+    : ExrLoader( std::make_shared<FileBuffer>( file ), tonemap, td )
+{
+}
+
+ExrLoader::ExrLoader( std::shared_ptr<DataBuffer> buf, ToneMap::Operator tonemap, TaskDispatch* td )
     : m_td( td )
     , m_tonemap( tonemap )
 {
     try
     {
-        m_stream = std::make_unique<ExrStream>( std::move( file ) );
-        m_exr = std::make_unique<Imf::RgbaInputFile>( *m_stream );
+        if( td && Imf::globalThreadCount() != int( td->NumWorkers() ) ) Imf::setGlobalThreadCount( td->NumWorkers() );
+
+        const auto multiPart = IsMultiPart( *buf );
+        m_stream = std::make_unique<ExrStream>( std::move( buf ) );
+
+        int part = 0;
+        if( multiPart )
+        {
+#ifdef EXR_RGBA_MULTIPART
+            part = FindPart( *m_stream );
+#else
+            mclog( LogLevel::Warning, "EXR: only the first part of a multipart file can be read with this OpenEXR version" );
+#endif
+        }
+
+        m_exr = OpenPart( *m_stream, part, {} );
+
+        const auto layer = FindLayer( m_exr->header().channels() );
+        if( !layer.empty() )
+        {
+            mclog( LogLevel::Info, "EXR layer: %s", layer.c_str() );
+            m_exr = OpenPart( *m_stream, part, layer );
+        }
+
+        // The tiled reader can open only the first part, other parts are read at full resolution
+        if( part == 0 && m_exr->header().hasTileDescription() && m_exr->header().tileDescription().mode != Imf::ONE_LEVEL )
+        {
+            m_stream->seekg( 0 );
+            m_tiled = std::make_unique<Imf::TiledRgbaInputFile>( *m_stream, layer );
+        }
+
         m_valid = true;
     }
     catch( const std::exception& )
@@ -57,127 +303,180 @@ bool ExrLoader::IsValid() const
     return m_valid;
 }
 
+bool ExrLoader::PreferHdr()
+{
+    return true;
+}
+
 std::unique_ptr<Bitmap> ExrLoader::Load()
 {
-    auto hdr = LoadHdr();
+    CheckPanic( m_exr, "Invalid EXR file" );
+    if( m_tiled ) return LoadLevel()->Tonemap( m_tonemap, m_td );
+
+    auto dw = m_exr->dataWindow();
+    auto width = dw.max.x - dw.min.x + 1;
+    auto height = dw.max.y - dw.min.y + 1;
+
+    const auto reduction = GetReduction( width, height, 8 );
+    auto bmp = std::make_unique<Bitmap>( ( width + reduction - 1 ) / reduction, ( height + reduction - 1 ) / reduction );
+    Stream( (uint32_t*)bmp->Data(), nullptr, reduction );
+    return bmp;
+}
+
+std::unique_ptr<BitmapHdr> ExrLoader::LoadHdr()
+{
+    CheckPanic( m_exr, "Invalid EXR file" );
+    if( m_tiled ) return LoadLevel();
+
+    auto dw = m_exr->dataWindow();
+    auto width = dw.max.x - dw.min.x + 1;
+    auto height = dw.max.y - dw.min.y + 1;
+
+    const auto reduction = GetReduction( width, height, 8 );
+    if( reduction > 1 )
+    {
+        auto bmp = std::make_unique<BitmapHdr>( ( width + reduction - 1 ) / reduction, ( height + reduction - 1 ) / reduction );
+        bmp->SetPremultiplied( true );
+        Stream( nullptr, bmp->Data(), reduction );
+        return bmp;
+    }
+
+    static_assert( sizeof( Imf::Rgba ) == 4 * sizeof( uint16_t ) );
+
+    auto bmp = std::make_unique<BitmapHdr>( width, height, BitmapHdr::Format::Half );
+    bmp->SetPremultiplied( true );
+    auto data = (Imf::Rgba*)bmp->DataHalf();
+
+    m_exr->setFrameBuffer( data - dw.min.x - dw.min.y * width, 1, width );
+    m_exr->readPixels( dw.min.y, dw.max.y );
+
+    Convert( data, size_t( width ) * height );
+
+    return bmp;
+}
+
+std::unique_ptr<BitmapHdr> ExrLoader::LoadLevel()
+{
+    auto dw = m_tiled->dataWindow();
+    auto width = dw.max.x - dw.min.x + 1;
+    auto height = dw.max.y - dw.min.y + 1;
+
+    // Pick the smallest level that still covers the display size
+    const auto maxLevel = std::min( m_tiled->numXLevels(), m_tiled->numYLevels() ) - 1;
+    int level = 0;
+    for( auto r = GetReduction( width, height, 1u << maxLevel ); r > 1; r >>= 1 ) level++;
+
+    dw = m_tiled->dataWindowForLevel( level, level );
+    width = dw.max.x - dw.min.x + 1;
+    height = dw.max.y - dw.min.y + 1;
+    mclog( LogLevel::Info, "EXR level %i: %ix%i", level, width, height );
+
+    auto bmp = std::make_unique<BitmapHdr>( width, height, BitmapHdr::Format::Half );
+    bmp->SetPremultiplied( true );
+    auto data = (Imf::Rgba*)bmp->DataHalf();
+
+    m_tiled->setFrameBuffer( data - dw.min.x - dw.min.y * width, 1, width );
+    m_tiled->readTiles( 0, m_tiled->numXTiles( level ) - 1, 0, m_tiled->numYTiles( level ) - 1, level, level );
+
+    Convert( data, size_t( width ) * height );
+    return bmp;
+}
+
+void ExrLoader::Convert( Imf::Rgba* data, size_t sz )
+{
+    auto transform = CreateTransform( m_exr->header() );
     if( m_td )
     {
-        auto bmp = std::make_unique<Bitmap>( hdr->Width(), hdr->Height() );
-        auto src = hdr->Data();
-        auto dst = bmp->Data();
-        size_t sz = hdr->Width() * hdr->Height();
         while( sz > 0 )
         {
-            const auto chunk = std::min( sz, size_t( 16 * 1024 ) );
-            m_td->Queue( [src, dst, chunk, tonemap = m_tonemap] {
-                ToneMap::Process( tonemap, (uint32_t*)dst, src, chunk );
+            auto chunk = std::min<size_t>( sz, 16 * 1024 );
+            m_td->Queue( [data, chunk, transform] {
+                Prepare( data, chunk, transform.get() );
             } );
-            src += chunk * 4;
-            dst += chunk * 4;
+            data += chunk;
             sz -= chunk;
         }
         m_td->Sync();
-        return bmp;
     }
     else
     {
-        return hdr->Tonemap( m_tonemap );
+        Prepare( data, sz, transform.get() );
     }
 }
 
-std::unique_ptr<BitmapHdr> ExrLoader::LoadHdr()
+void ExrLoader::Stream( uint32_t* bmp, float* hdr, int reduction )
 {
-    CheckPanic( m_exr, "Invalid EXR file" );
+    // A multiple of every reduction factor and of the scanline count in a block
+    // of any compression method, so blocks are never decompressed twice
+    constexpr int BlockRows = 256;
 
     auto dw = m_exr->dataWindow();
     auto width = dw.max.x - dw.min.x + 1;
     auto height = dw.max.y - dw.min.y + 1;
 
-    std::vector<Imf::Rgba> hdr;
-    hdr.resize( width * height );
-
-    m_exr->setFrameBuffer( hdr.data() - dw.min.x - dw.min.y * width, 1, width );
-    m_exr->readPixels( dw.min.y, dw.max.y );
-
-    auto bmp = std::make_unique<BitmapHdr>( width, height );
+    const auto outWidth = ( width + reduction - 1 ) / reduction;
+    const auto taskRows = std::max( 1, 16 * 1024 / ( width * reduction ) ) * reduction;
+    const auto tonemap = m_tonemap;
+    auto transform = CreateTransform( m_exr->header() );
 
-    const auto chroma = m_exr->header().findTypedAttribute<OPENEXR_IMF_INTERNAL_NAMESPACE::ChromaticitiesAttribute>( "chromaticities" );
-    if( chroma )
-    {
-        const auto neutral = m_exr->header().findTypedAttribute<IMATH_NAMESPACE::V2f>( "adoptedNeutral" );
-        const auto white = neutral ? cmsCIExyY { neutral->x, neutral->y, 1 } : cmsCIExyY { 0.3127f, 0.329f, 1 };
-
-        const auto& cv = chroma->value();
-        const cmsCIExyYTRIPLE primaries = {
-            { chroma->value().red.x, chroma->value().red.y, 1 },
-            { chroma->value().green.x, chroma->value().green.y, 1 },
-            { chroma->value().blue.x, chroma->value().blue.y, 1 }
-        };
-        cmsToneCurve* linear = cmsBuildGamma( nullptr, 1 );
-        cmsToneCurve* linear3[3] = { linear, linear, linear };
-
-        constexpr cmsCIExyY white709 = { 0.3127f, 0.329f, 1 };
-        constexpr cmsCIExyYTRIPLE primaries709 = {
-            { 0.64f, 0.33f, 1 },
-            { 0.30f, 0.60f, 1 },
-            { 0.15f, 0.06f, 1 }
-        };
-
-        auto profileIn = cmsCreateRGBProfile( &white, &primaries, linear3 );
-        auto profileOut = cmsCreateRGBProfile( &white709, &primaries709, linear3 );
-        auto transform = cmsCreateTransform( profileIn, TYPE_RGBA_HALF_FLT, profileOut, TYPE_RGBA_FLT, INTENT_PERCEPTUAL, 0 );
-
-        if( m_td )
+    auto process = [=]( Imf::Rgba* src, int rows, size_t offset ) {
+        Prepare( src, size_t( width ) * rows, transform.get() );
+        if( reduction == 1 )
         {
-            auto src = hdr.data();
-            auto dst = bmp->Data();
-            auto sz = width * height;
-            while( sz > 0 )
-            {
-                auto chunk = std::min<size_t>( sz, 16 * 1024 );
-                m_td->Queue( [src, dst, chunk, transform] {
-                    cmsDoTransform( transform, src, dst, chunk );
-                } );
-                src += chunk;
-                dst += chunk * 4;
-                sz -= chunk;
-            }
-            m_td->Sync();
+            ToneMap::Process( tonemap, bmp + offset, (const uint16_t*)src, size_t( width ) * rows );
+        }
+        else if( hdr )
+        {
+            BoxReduce( hdr + offset * 4, src, width, rows, reduction );
         }
         else
         {
-            cmsDoTransform( transform, hdr.data(), bmp->Data(), width * height );
+            const auto sz = size_t( outWidth ) * ( ( rows + reduction - 1 ) / reduction );
+            std::vector<float> tmp( sz * 4 );
+            BoxReduce( tmp.data(), src, width, rows, reduction );
+            ToneMap::Process( tonemap, bmp + offset, tmp.data(), sz );
         }
+    };
 
-        cmsDeleteTransform( transform );
-        cmsCloseProfile( profileIn );
-        cmsCloseProfile( profileOut );
-        cmsFreeToneCurve( linear );
+    // While the workers process one block, the next one is read into the other buffer
+    std::vector<Imf::Rgba> buf[2];
+    buf[0].resize( size_t( width ) * std::min( BlockRows, height ) );
+    if( m_td && height > BlockRows ) buf[1].resize( buf[0].size() );
 
-        auto ptr = bmp->Data() + 3;
-        auto sz = width * height;
-        do
+    int idx = 0;
+    try
+    {
+        for( int y=0; y<height; y+=BlockRows )
         {
-            *ptr = 1;
-            ptr += 4;
+            const auto rows = std::min( BlockRows, height - y );
+            auto data = buf[idx].data();
+
+            m_exr->setFrameBuffer( data - dw.min.x - ( dw.min.y + y ) * width, 1, width );
+            m_exr->readPixels( dw.min.y + y, dw.min.y + y + rows - 1 );
+
+            if( m_td )
+            {
+                m_td->Sync();
+                for( int ty=0; ty<rows; ty+=taskRows )
+                {
+                    const auto cnt = std::min( taskRows, rows - ty );
+                    const auto offset = size_t( ( y + ty ) / reduction ) * outWidth;
+                    auto src = data + size_t( ty ) * width;
+                    m_td->Queue( [&process, src, cnt, offset] { process( src, cnt, offset ); } );
+                }
+                idx ^= 1;
+            }
+            else
+            {
+                process( data, rows, size_t( y / reduction ) * outWidth );
+            }
         }
-        while( --sz );
     }
-    else
+    catch( const std::exception& )
     {
-        auto dst = bmp->Data();
-        auto src = hdr.data();
-        auto sz = width * height;
-        do
-        {
-            *dst++ = src->r;
-            *dst++ = src->g;
-            *dst++ = src->b;
-            *dst++ = 1;
-            src++;
-        }
-        while( --sz );
+        if( m_td ) m_td->Sync();
+        throw;
     }
 
-    return bmp;
+    if( m_td ) m_td->Sync();
 }
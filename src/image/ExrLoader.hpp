@@ -8,29 +8,37 @@
 #include "util/NoCopy.hpp"
 
 class Bitmap;
+class DataBuffer;
 class ExrStream;
 class FileWrapper;
 class TaskDispatch;
 
-namespace OPENEXR_IMF_INTERNAL_NAMESPACE { class RgbaInputFile; }
+namespace OPENEXR_IMF_INTERNAL_NAMESPACE { class RgbaInputFile; class TiledRgbaInputFile; struct Rgba; }
 
 class ExrLoader : public ImageLoader
 {
 public:
-    explicit ExrLoader( std::shared_ptr<FileWrapper> file, ToneMap::Operator tonemap, TaskDispatch* td );
+    explicit ExrLoader( const std::shared_ptr<FileWrapper>& file, ToneMap::Operator tonemap, TaskDispatch* td );
+    explicit ExrLoader( std::shared_ptr<DataBuffer> buf, ToneMap::Operator tonemap, TaskDispatch* td );
     ~ExrLoader() override;
 
     NoCopy( ExrLoader );
 
     [[nodiscard]] bool IsValid() const override;
     [[nodiscard]] bool IsHdr() override { return true; }
+    [[nodiscard]] bool PreferHdr() override;
 
     [[nodiscard]] std::unique_ptr<Bitmap> Load() override;
     [[nodiscard]] std::unique_ptr<BitmapHdr> LoadHdr() override;
 
 private:
+    [[nodiscard]] std::unique_ptr<BitmapHdr> LoadLevel();
+    void Convert( OPENEXR_IMF_INTERNAL_NAMESPACE::Rgba* data, size_t sz );
+    void Stream( uint32_t* bmp, float* hdr, int reduction );
+
     std::unique_ptr<ExrStream> m_stream;
     std::unique_ptr<OPENEXR_IMF_INTERNAL_NAMESPACE::RgbaInputFile> m_exr;
+    std::unique_ptr<OPENEXR_IMF_INTERNAL_NAMESPACE::TiledRgbaInputFile> m_tiled;
 
     TaskDispatch* m_td;
 
@@ -1,16 +1,20 @@
 #include <algorithm>
+#include <atomic>
 #include <cmath>
+#include <format>
 #include <libheif/heif.h>
 #include <lcms2.h>
 #include <pugixml.hpp>
-#include <stb_image_resize2.h>
 #include <string.h>
+#include <string>
+#include <utility>
 #include <vector>
 
 #include "HeifLoader.hpp"
 #include "util/Alloca.h"
 #include "util/Bitmap.hpp"
 #include "util/BitmapHdr.hpp"
+#include "util/ColorTransform.hpp"
 #include "util/FileBuffer.hpp"
 #include "util/FileWrapper.hpp"
 #include "util/Panic.hpp"
@@ -18,6 +22,22 @@
 #include "util/TaskDispatch.hpp"
 #include "util/Tonemapper.hpp"
 
+struct YCbCrPlanes
+{
+    const uint8_t* y;
+    const uint8_t* cb;
+    const uint8_t* cr;
+    const uint8_t* a;
+
+    size_t strideY, strideC, strideA;
+    int width, height;
+    int shiftX, shiftY;
+    int x0, y0;
+
+    // Chroma planes have one sample of the adjacent tiles on each side
+    bool border;
+};
+
 namespace
 {
 constexpr cmsCIExyY white709 = { 0.3127f, 0.329f, 1 };
@@ -160,40 +180,208 @@ void LinearizePq( float* ptr, int sz )
     }
 }
 #endif
+
+// Bilinear chroma upsampling with centered chroma siting. Subsampled samples
+// are weighted 3/4 for the nearest and 1/4 for the neighbouring one. At the
+// edges the neighbouring sample is taken from the border, if there is one.
+template<typename T, bool Alpha>
+void ProcessYCbCrRow( float* ptr, const YCbCrPlanes& p, int x, int y, int cnt, float div )
+{
+    x -= p.x0;
+    y -= p.y0;
+
+    const auto cw = ( p.width + p.shiftX ) >> p.shiftX;
+    const auto ch = ( p.height + p.shiftY ) >> p.shiftY;
+    const auto cmin = p.border ? -1 : 0;
+    const auto cmaxX = p.border ? cw : cw - 1;
+    const auto cmaxY = p.border ? ch : ch - 1;
+
+    const int cy0 = y >> p.shiftY;
+    int cy1 = cy0;
+    float wv0 = 1.f;
+    if( p.shiftY )
+    {
+        cy1 = ( y & 1 ) ? std::min( cy0 + 1, cmaxY ) : std::max( cy0 - 1, cmin );
+        wv0 = 0.75f;
+    }
+    const float wv1 = 1.f - wv0;
+
+    const auto strideC = ptrdiff_t( p.strideC );
+    auto srcY = (const T*)( p.y + y * p.strideY ) + x;
+    auto srcA = Alpha ? (const T*)( p.a + y * p.strideA ) + x : nullptr;
+    auto cb0 = (const T*)( p.cb + cy0 * strideC );
+    auto cb1 = (const T*)( p.cb + cy1 * strideC );
+    auto cr0 = (const T*)( p.cr + cy0 * strideC );
+    auto cr1 = (const T*)( p.cr + cy1 * strideC );
+
+    if( p.shiftX == 0 )
+    {
+        for( int i=x; i<x+cnt; i++ )
+        {
+            *ptr++ = float(*srcY++) * div;
+            *ptr++ = ( wv0 * cb0[i] + wv1 * cb1[i] ) * div - 0.5f;
+            *ptr++ = ( wv0 * cr0[i] + wv1 * cr1[i] ) * div - 0.5f;
+            *ptr++ = Alpha ? float(*srcA++) * div : 1.f;
+        }
+    }
+    else
+    {
+        for( int i=x; i<x+cnt; i++ )
+        {
+            const auto cx0 = i >> 1;
+            const auto cx1 = ( i & 1 ) ? std::min( cx0 + 1, cmaxX ) : std::max( cx0 - 1, cmin );
+
+            const auto cb = 0.75f * ( wv0 * cb0[cx0] + wv1 * cb1[cx0] ) + 0.25f * ( wv0 * cb0[cx1] + wv1 * cb1[cx1] );
+            const auto cr = 0.75f * ( wv0 * cr0[cx0] + wv1 * cr1[cx0] ) + 0.25f * ( wv0 * cr0[cx1] + wv1 * cr1[cx1] );
+
+            *ptr++ = float(*srcY++) * div;
+            *ptr++ = cb * div - 0.5f;
+            *ptr++ = cr * div - 0.5f;
+            *ptr++ = Alpha ? float(*srcA++) * div : 1.f;
+        }
+    }
+}
+
+// Copies the chroma planes of a tile with a one sample border, taken from the
+// adjacent tiles in nb, or repeated at the image edges, and points the planes
+// to the copy. The center of nb is the tile itself, missing tiles are null.
+template<typename T>
+void StitchChroma( YCbCrPlanes& p, const YCbCrPlanes* const nb[3][3], std::vector<T>& buf )
+{
+    auto cw = []( const YCbCrPlanes& t ) { return ( t.width + t.shiftX ) >> t.shiftX; };
+    auto ch = []( const YCbCrPlanes& t ) { return ( t.height + t.shiftY ) >> t.shiftY; };
+
+    const auto w = cw( p );
+    const auto h = ch( p );
+    const auto stride = size_t( w + 2 );
+    const auto size = stride * ( h + 2 );
+    buf.resize( size * 2 );
+
+    for( int y=-1; y<=h; y++ )
+    {
+        int ny = y < 0 ? 0 : ( y < h ? 1 : 2 );
+        int sy = y;
+        if( !nb[ny][1] )
+        {
+            ny = 1;
+            sy = std::clamp( y, 0, h - 1 );
+        }
+
+        for( int c=0; c<2; c++ )
+        {
+            auto src = [&]( int nx ) {
+                const auto& t = *nb[ny][nx];
+                const auto row = ny == 0 ? ch( t ) - 1 : ( ny == 2 ? 0 : sy );
+                return (const T*)( ( c == 0 ? t.cb : t.cr ) + row * t.strideC );
+            };
+
+            auto dst = buf.data() + c * size + ( y + 1 ) * stride;
+            auto mid = src( 1 );
+            memcpy( dst + 1, mid, w * sizeof( T ) );
+            dst[0] = nb[ny][0] ? src( 0 )[cw( *nb[ny][0] ) - 1] : mid[0];
+            dst[w+1] = nb[ny][2] ? src( 2 )[0] : mid[w-1];
+        }
+    }
+
+    p.cb = (const uint8_t*)( buf.data() + stride + 1 );
+    p.cr = (const uint8_t*)( buf.data() + size + stride + 1 );
+    p.strideC = stride * sizeof( T );
+    p.border = true;
+}
+
+// 2x2 box reduction. With 4:2:0 the chroma samples already sit at the
+// center of each luma quad and are used directly.
+template<typename T, bool Alpha>
+void ProcessYCbCrHalfRow( float* ptr, const YCbCrPlanes& p, int x, int y, int cnt, float div )
+{
+    x -= p.x0;
+    y -= p.y0;
+
+    const auto y0 = y * 2;
+    const auto y1 = std::min( y0 + 1, p.height - 1 );
+    const auto cy0 = p.shiftY ? y : y0;
+    const auto cy1 = p.shiftY ? y : y1;
+
+    auto srcY0 = (const T*)( p.y + y0 * p.strideY );
+    auto srcY1 = (const T*)( p.y + y1 * p.strideY );
+    auto srcA0 = Alpha ? (const T*)( p.a + y0 * p.strideA ) : nullptr;
+    auto srcA1 = Alpha ? (const T*)( p.a + y1 * p.strideA ) : nullptr;
+    auto cb0 = (const T*)( p.cb + cy0 * p.strideC );
+    auto cb1 = (const T*)( p.cb + cy1 * p.strideC );
+    auto cr0 = (const T*)( p.cr + cy0 * p.strideC );
+    auto cr1 = (const T*)( p.cr + cy1 * p.strideC );
+
+    const auto div4 = div * 0.25f;
+    for( int i=x; i<x+cnt; i++ )
+    {
+        const auto x0 = i * 2;
+        const auto x1 = std::min( x0 + 1, p.width - 1 );
+        const auto cx0 = p.shiftX ? i : x0;
+        const auto cx1 = p.shiftX ? i : x1;
+
+        *ptr++ = float( srcY0[x0] + srcY0[x1] + srcY1[x0] + srcY1[x1] ) * div4;
+        *ptr++ = float( cb0[cx0] + cb0[cx1] + cb1[cx0] + cb1[cx1] ) * div4 - 0.5f;
+        *ptr++ = float( cr0[cx0] + cr0[cx1] + cr1[cx0] + cr1[cx1] ) * div4 - 0.5f;
+        *ptr++ = Alpha ? float( srcA0[x0] + srcA0[x1] + srcA1[x0] + srcA1[x1] ) * div4 : 1.f;
+    }
+}
+
+template<typename T, bool Alpha>
+void ProcessYCbCr( float* ptr, const YCbCrPlanes& p, size_t sz, size_t offset, int width, int reduction, float div )
+{
+    int y = offset / width;
+    int x = offset % width;
+
+    while( sz > 0 )
+    {
+        const auto line = std::min( sz, size_t( width - x ) );
+        if( reduction == 2 )
+        {
+            ProcessYCbCrHalfRow<T, Alpha>( ptr, p, x, y, line, div );
+        }
+        else
+        {
+            ProcessYCbCrRow<T, Alpha>( ptr, p, x, y, line, div );
+        }
+        ptr += line * 4;
+        sz -= line;
+        x = 0;
+        y++;
+    }
+}
+}
+
+HeifLoader::HeifLoader( const std::shared_ptr<FileWrapper>& file, ToneMap::Operator tonemap, TaskDispatch* td )
+    : HeifLoader( std::make_shared<FileBuffer>( file ), tonemap, td )
+{
 }
 
-HeifLoader::HeifLoader( std::shared_ptr<FileWrapper> file, ToneMap::Operator tonemap, TaskDispatch* td )
+HeifLoader::HeifLoader( std::shared_ptr<DataBuffer> buf, ToneMap::Operator tonemap, TaskDispatch* td )
     : m_valid( false )
     , m_tonemap( tonemap )
-    , m_file( std::move( file ) )
+    , m_buf( std::move( buf ) )
     , m_ctx( nullptr )
     , m_handle( nullptr )
     , m_handleGainMap( nullptr )
     , m_image( nullptr )
     , m_nclx( nullptr )
+    , m_gainMapImage( nullptr )
     , m_gainMap( nullptr )
+    , m_tileColumns( 0 )
     , m_iccData( nullptr )
-    , m_profileIn( nullptr )
-    , m_profileOut( nullptr )
-    , m_transform( nullptr )
     , m_td( td )
 {
-    fseek( *m_file, 0, SEEK_SET );
-    uint8_t hdr[12];
-    if( fread( hdr, 1, 12, *m_file ) == 12 )
+    if( m_buf->size() >= 12 )
     {
-        const auto res = heif_check_filetype( hdr, 12 );
+        const auto res = heif_check_filetype( (const uint8_t*)m_buf->data(), 12 );
         m_valid = res == heif_filetype_yes_supported || res == heif_filetype_maybe;
     }
 }
 
 HeifLoader::~HeifLoader()
 {
-    if( m_transform ) cmsDeleteTransform( m_transform );
-    if( m_profileOut ) cmsCloseProfile( m_profileOut );
-    if( m_profileIn ) cmsCloseProfile( m_profileIn );
     delete[] m_iccData;
-    delete[] m_gainMap;
+    if( m_gainMapImage ) heif_image_release( m_gainMapImage );
     if( m_nclx ) heif_nclx_color_profile_free( m_nclx );
     if( m_image ) heif_image_release( m_image );
     if( m_handleGainMap ) heif_image_handle_release( m_handleGainMap );
@@ -208,7 +396,7 @@ bool HeifLoader::IsValid() const
 
 bool HeifLoader::IsHdr()
 {
-    if( !m_buf && !Open() ) return false;
+    if( !m_ctx && !Open() ) return false;
     if( m_handleGainMap ) return true;
     if( m_nclx )
     {
@@ -221,124 +409,31 @@ bool HeifLoader::IsHdr()
 
 std::unique_ptr<Bitmap> HeifLoader::Load()
 {
-    if( !m_buf && !Open() ) return nullptr;
+    if( !m_ctx && !Open() ) return nullptr;
 
-    if( !IsHdr() || m_handleGainMap )
-    {
-        if( !SetupDecode( false ) ) return nullptr;
-
-        auto bmp = std::make_unique<Bitmap>( m_width, m_height );
-        auto out = (uint32_t*)bmp->Data();
+    const auto hdr = IsHdr() && !m_handleGainMap;
+    if( !SetupDecode( hdr ) ) return nullptr;
 
-        if( m_td )
-        {
-            size_t offset = 0;
-            size_t sz = m_width * m_height;
-            while( sz > 0 )
-            {
-                const auto chunk = std::min( sz, size_t( 16 * 1024 ) );
-                m_td->Queue( [this, out, chunk, offset] {
-                    auto ptr = (float*)alloca( chunk * 4 * sizeof( float ) );
-                    LoadYCbCr( ptr, chunk, offset );
-                    ConvertYCbCrToRGB( ptr, chunk );
-                    cmsDoTransform( m_transform, ptr, out, chunk );
-                } );
-                out += chunk;
-                sz -= chunk;
-                offset += chunk;
-            }
-            m_td->Sync();
-        }
-        else
-        {
-            auto tmp = std::make_unique<BitmapHdr>( m_width, m_height );
-            LoadYCbCr( tmp->Data(), m_width * m_height, 0 );
-            ConvertYCbCrToRGB( tmp->Data(), m_width * m_height );
-            cmsDoTransform( m_transform, tmp->Data(), out, m_width * m_height );
-        }
-
-        return bmp;
-    }
-    else
-    {
-        if( m_td )
-        {
-            if( !SetupDecode( true ) ) return nullptr;
-
-            auto bmp = std::make_unique<Bitmap>( m_width, m_height );
-            auto out = (uint32_t*)bmp->Data();
-
-            size_t offset = 0;
-            size_t sz = m_width * m_height;
-            while( sz > 0 )
-            {
-                const auto chunk = std::min( sz, size_t( 16 * 1024 ) );
-                m_td->Queue( [this, out, chunk, offset] {
-                    auto ptr = (float*)alloca( chunk * 4 * sizeof( float ) );
-                    LoadYCbCr( ptr, chunk, offset );
-                    ConvertYCbCrToRGB( ptr, chunk );
-                    if( m_transform ) cmsDoTransform( m_transform, ptr, ptr, chunk );
-                    ApplyTransfer( ptr, chunk, offset );
-                    ToneMap::Process( m_tonemap, out, ptr, chunk );
-                } );
-                out += chunk;
-                sz -= chunk;
-                offset += chunk;
-            }
-            m_td->Sync();
-            return bmp;
-        }
-        else
-        {
-            std::unique_ptr<BitmapHdr> hdr = LoadHdr();
-            return hdr->Tonemap( m_tonemap );
-        }
-    }
+    auto bmp = std::make_unique<Bitmap>( m_outWidth, m_outHeight );
+    if( !Decode( hdr ? Output::Tonemap : Output::Sdr, bmp->Data() ) ) return nullptr;
+    return bmp;
 }
 
 std::unique_ptr<BitmapHdr> HeifLoader::LoadHdr()
 {
-    if( !m_buf && !Open() ) return nullptr;
+    if( !m_ctx && !Open() ) return nullptr;
     if( !SetupDecode( true ) ) return nullptr;
 
-    auto bmp = std::make_unique<BitmapHdr>( m_width, m_height );
-    if( m_td )
-    {
-        auto ptr = bmp->Data();
-        size_t offset = 0;
-        size_t sz = m_width * m_height;
-        while( sz > 0 )
-        {
-            const auto chunk = std::min( sz, size_t( 16 * 1024 ) );
-            m_td->Queue( [this, ptr, chunk, offset] {
-                LoadYCbCr( ptr, chunk, offset );
-                ConvertYCbCrToRGB( ptr, chunk );
-                if( m_transform ) cmsDoTransform( m_transform, ptr, ptr, chunk );
-                ApplyTransfer( ptr, chunk, offset );
-            } );
-            ptr += chunk * 4;
-            sz -= chunk;
-            offset += chunk;
-        }
-        m_td->Sync();
-    }
-    else
-    {
-        LoadYCbCr( bmp->Data(), m_width * m_height, 0 );
-        ConvertYCbCrToRGB( bmp->Data(), m_width * m_height );
-        if( m_transform ) cmsDoTransform( m_transform, bmp->Data(), bmp->Data(), m_width * m_height );
-        ApplyTransfer( bmp->Data(), m_width * m_height, 0 );
-    }
-
+    auto bmp = std::make_unique<BitmapHdr>( m_outWidth, m_outHeight );
+    if( !Decode( Output::Hdr, bmp->Data() ) ) return nullptr;
     return bmp;
 }
 
 bool HeifLoader::Open()
 {
     CheckPanic( m_valid, "Invalid HEIF file" );
-    CheckPanic( !m_buf, "Already opened" );
-
-    m_buf = std::make_unique<FileBuffer>( m_file );
+    CheckPanic( !m_ctx, "Already opened" );
+    m_buf->Advise( DataBuffer::Access::Sequential );
 
     m_ctx = heif_context_alloc();
     auto err = heif_context_read_from_memory_without_copy( m_ctx, m_buf->data(), m_buf->size(), nullptr );
@@ -402,8 +497,68 @@ bool HeifLoader::Open()
 
 bool HeifLoader::SetupDecode( bool hdr )
 {
-    auto err = heif_decode_image( m_handle, &m_image, heif_colorspace_YCbCr, heif_chroma_444, nullptr );
-    if( err.code != heif_error_Ok ) return false;
+    m_tileColumns = 0;
+#if LIBHEIF_HAVE_VERSION( 1, 19, 0 )
+    heif_image_tiling tiling;
+    auto err = heif_image_handle_get_image_tiling( m_handle, 1, &tiling );
+    if( err.code == heif_error_Ok &&
+        tiling.num_columns * tiling.num_rows > 1 &&
+        tiling.image_width == uint32_t( m_width ) &&
+        tiling.image_height == uint32_t( m_height ) &&
+        !heif_image_handle_has_alpha_channel( m_handle ) )
+    {
+        m_tileColumns = tiling.num_columns;
+        m_tileRows = tiling.num_rows;
+        m_tileWidth = tiling.tile_width;
+        m_tileHeight = tiling.tile_height;
+        mclog( LogLevel::Info, "HEIF: Grid of %ux%u tiles, %ux%u each", m_tileColumns, m_tileRows, m_tileWidth, m_tileHeight );
+    }
+#else
+    heif_error err;
+#endif
+
+    m_image = DecodeImage( 0, 0, heif_chroma_undefined );
+    if( m_image )
+    {
+        const auto chroma = heif_image_get_chroma_format( m_image );
+        if( chroma != heif_chroma_420 && chroma != heif_chroma_422 && chroma != heif_chroma_444 )
+        {
+            heif_image_release( m_image );
+            m_image = nullptr;
+        }
+    }
+    if( !m_image )
+    {
+        mclog( LogLevel::Info, "HEIF: Native chroma format not supported, decoding to 4:4:4" );
+        m_image = DecodeImage( 0, 0, heif_chroma_444 );
+        if( !m_image ) return false;
+    }
+    m_chroma = heif_image_get_chroma_format( m_image );
+
+    switch( m_chroma )
+    {
+    case heif_chroma_420:
+        m_chromaShiftX = 1;
+        m_chromaShiftY = 1;
+        mclog( LogLevel::Info, "HEIF: Chroma 4:2:0" );
+        break;
+    case heif_chroma_422:
+        m_chromaShiftX = 1;
+        m_chromaShiftY = 0;
+        mclog( LogLevel::Info, "HEIF: Chroma 4:2:2" );
+        break;
+    default:
+        m_chromaShiftX = 0;
+        m_chromaShiftY = 0;
+        mclog( LogLevel::Info, "HEIF: Chroma 4:4:4" );
+        break;
+    }
+
+    const bool oddTiles = m_tileColumns != 0 && ( ( m_tileWidth | m_tileHeight ) & 1 ) != 0;
+    m_reduction = GetReduction( m_width, m_height, oddTiles ? 1 : 2 );
+    m_outWidth = ( m_width + m_reduction - 1 ) / m_reduction;
+    m_outHeight = ( m_height + m_reduction - 1 ) / m_reduction;
+    if( m_reduction != 1 ) mclog( LogLevel::Info, "HEIF: Decoding at reduced size %dx%d", m_outWidth, m_outHeight );
 
     if( !m_nclx )
     {
@@ -425,16 +580,6 @@ bool HeifLoader::SetupDecode( bool hdr )
         heif_image_get_raw_color_profile( m_image, m_iccData );
     }
 
-    int strideY, strideCb, strideCr, strideA;
-    m_planeY  = heif_image_get_plane_readonly( m_image, heif_channel_Y, &strideY );
-    m_planeCb = heif_image_get_plane_readonly( m_image, heif_channel_Cb, &strideCb );
-    m_planeCr = heif_image_get_plane_readonly( m_image, heif_channel_Cr, &strideCr );
-    m_planeA  = heif_image_get_plane_readonly( m_image, heif_channel_Alpha, &strideA );
-    CheckPanic( strideY == strideCb && strideY == strideCr, "Decoded output is not 444" );
-    m_stride = strideY;
-
-    if( !m_planeY || !m_planeCb || !m_planeCr ) return false;
-
     const auto bppY = heif_image_get_bits_per_pixel_range( m_image, heif_channel_Y );
     const auto bppCb = heif_image_get_bits_per_pixel_range( m_image, heif_channel_Cb );
     const auto bppCr = heif_image_get_bits_per_pixel_range( m_image, heif_channel_Cr );
@@ -444,7 +589,8 @@ bool HeifLoader::SetupDecode( bool hdr )
     m_bppDiv = 1.f / ( ( 1 << bppY ) - 1 );
     mclog( LogLevel::Info, "HEIF: %d bpp", bppY );
 
-    if( bppY > 8 ) m_stride /= 2;
+    YCbCrPlanes planes;
+    if( !GetPlanes( m_image, 0, 0, planes ) ) return false;
 
     // H.273, 8.3, VideoFullRangeFlag is false if not present
     if( !m_nclx || !m_nclx->full_range_flag )
@@ -506,21 +652,16 @@ bool HeifLoader::SetupDecode( bool hdr )
     cmsToneCurve* gamma = cmsBuildGamma( nullptr, 2.2f );
     cmsToneCurve* gamma3[3] = { gamma, gamma, gamma };
 
+    // Transform keys start with the output profile, followed by the input profile
     if( m_iccData )
     {
-        m_profileIn = cmsOpenProfileFromMem( m_iccData, m_iccSize );
-        int outType;
-        if( hdr )
-        {
-            m_profileOut = cmsCreateRGBProfile( &white709, &primaries709, linear3 );
-            outType = TYPE_RGBA_FLT;
-        }
-        else
-        {
-            m_profileOut = cmsCreate_sRGBProfile();
-            outType = TYPE_RGBA_8;
-        }
-        m_transform = cmsCreateTransform( m_profileIn, TYPE_RGBA_FLT, m_profileOut, outType, INTENT_PERCEPTUAL, cmsFLAGS_COPY_ALPHA );
+        std::string key( hdr ? "linear709\n" : "srgb\n" );
+        key.append( m_iccData, m_iccSize );
+        m_transform = GetColorTransform( key, TYPE_RGBA_FLT, hdr ? TYPE_RGBA_FLT : TYPE_RGBA_8, cmsFLAGS_COPY_ALPHA, [&] {
+            return std::make_pair(
+                cmsOpenProfileFromMem( m_iccData, m_iccSize ),
+                hdr ? cmsCreateRGBProfile( &white709, &primaries709, linear3 ) : cmsCreate_sRGBProfile() );
+        } );
     }
     else if( m_nclx )
     {
@@ -530,30 +671,31 @@ bool HeifLoader::SetupDecode( bool hdr )
             { m_nclx->color_primary_green_x, m_nclx->color_primary_green_y, 1 },
             { m_nclx->color_primary_blue_x, m_nclx->color_primary_blue_y, 1 }
         };
+        const auto nclx = std::format( "{} {} {} {} {} {} {} {}", white.x, white.y, primaries.Red.x, primaries.Red.y, primaries.Green.x, primaries.Green.y, primaries.Blue.x, primaries.Blue.y );
 
         if( hdr )
         {
-            m_profileIn = cmsCreateRGBProfile( &white, &primaries, linear3 );
             if( m_nclx->color_primaries != heif_color_primaries_ITU_R_BT_709_5 )
             {
-                m_profileOut = cmsCreateRGBProfile( &white709, &primaries709, linear3 );
-                m_transform = cmsCreateTransform( m_profileIn, TYPE_RGBA_FLT, m_profileOut, TYPE_RGBA_FLT, INTENT_PERCEPTUAL, cmsFLAGS_COPY_ALPHA );
+                m_transform = GetColorTransform( "linear709\nlinear " + nclx, TYPE_RGBA_FLT, TYPE_RGBA_FLT, cmsFLAGS_COPY_ALPHA, [&] {
+                    return std::make_pair( cmsCreateRGBProfile( &white, &primaries, linear3 ), cmsCreateRGBProfile( &white709, &primaries709, linear3 ) );
+                } );
             }
         }
         else
         {
-            m_profileIn = cmsCreateRGBProfile( &white, &primaries, gamma3 );
-            m_profileOut = cmsCreate_sRGBProfile();
-            m_transform = cmsCreateTransform( m_profileIn, TYPE_RGBA_FLT, m_profileOut, TYPE_RGBA_8, INTENT_PERCEPTUAL, cmsFLAGS_COPY_ALPHA );
+            m_transform = GetColorTransform( "srgb\ngamma " + nclx, TYPE_RGBA_FLT, TYPE_RGBA_8, cmsFLAGS_COPY_ALPHA, [&] {
+                return std::make_pair( cmsCreateRGBProfile( &white, &primaries, gamma3 ), cmsCreate_sRGBProfile() );
+            } );
         }
     }
     else
     {
         CheckPanic( !hdr, "Can't be HDR here" );
 
-        m_profileIn = cmsCreateRGBProfile( &white709, &primaries709, gamma3 );
-        m_profileOut = cmsCreate_sRGBProfile();
-        m_transform = cmsCreateTransform( m_profileIn, TYPE_RGBA_FLT, m_profileOut, TYPE_RGBA_8, INTENT_PERCEPTUAL, cmsFLAGS_COPY_ALPHA );
+        m_transform = GetColorTransform( "srgb\ngamma 709", TYPE_RGBA_FLT, TYPE_RGBA_8, cmsFLAGS_COPY_ALPHA, [&] {
+            return std::make_pair( cmsCreateRGBProfile( &white709, &primaries709, gamma3 ), cmsCreate_sRGBProfile() );
+        } );
     }
 
     cmsFreeToneCurve( linear );
@@ -561,137 +703,305 @@ bool HeifLoader::SetupDecode( bool hdr )
 
     if( hdr && m_handleGainMap )
     {
-        heif_image* gainMap;
-        err = heif_decode_image( m_handleGainMap, &gainMap, heif_colorspace_monochrome, heif_chroma_monochrome, nullptr );
+        err = heif_decode_image( m_handleGainMap, &m_gainMapImage, heif_colorspace_monochrome, heif_chroma_monochrome, nullptr );
         if( err.code != heif_error_Ok ) return false;
 
-        int stride;
-        auto src = heif_image_get_plane_readonly( gainMap, heif_channel_Y, &stride );
-        if( !src )
+        m_gainMap = heif_image_get_plane_readonly( m_gainMapImage, heif_channel_Y, &m_gainMapStride );
+        if( !m_gainMap ) return false;
+
+        m_gainMapWidth = heif_image_handle_get_width( m_handleGainMap );
+        m_gainMapHeight = heif_image_handle_get_height( m_handleGainMap );
+        CheckPanic( m_gainMapWidth == m_width / 2 && m_gainMapHeight == m_height / 2, "Invalid gain map size" );
+
+        for( int i=0; i<256; i++ )
+        {
+            const auto v = i / 255.f;
+            const auto gain = v < 0.081f ? v / 4.5f : std::pow( ( v + 0.099f ) / 1.099f, 1.f / 0.45f );
+            m_gainMapLut[i] = 1.f + ( m_gainMapHeadroom - 1.f ) * gain;
+        }
+    }
+
+    return true;
+}
+
+heif_image* HeifLoader::DecodeImage( uint32_t tx, uint32_t ty, int chroma )
+{
+    heif_image* img = nullptr;
+    heif_error err;
+#if LIBHEIF_HAVE_VERSION( 1, 19, 0 )
+    if( m_tileColumns != 0 )
+    {
+        err = heif_image_handle_decode_image_tile( m_handle, &img, heif_colorspace_YCbCr, (heif_chroma)chroma, nullptr, tx, ty );
+    }
+    else
+#endif
+    {
+        err = heif_decode_image( m_handle, &img, heif_colorspace_YCbCr, (heif_chroma)chroma, nullptr );
+    }
+    if( err.code != heif_error_Ok )
+    {
+        mclog( LogLevel::Error, "HEIF: Failed to decode image: %s", err.message );
+        if( img ) heif_image_release( img );
+        return nullptr;
+    }
+    return img;
+}
+
+bool HeifLoader::GetPlanes( const heif_image* img, uint32_t tx, uint32_t ty, YCbCrPlanes& planes ) const
+{
+    int sx = 0, sy = 0;
+    int width = m_width;
+    int height = m_height;
+    if( m_tileColumns != 0 )
+    {
+        sx = tx * m_tileWidth;
+        sy = ty * m_tileHeight;
+        width = std::min<int>( m_tileWidth, m_width - sx );
+        height = std::min<int>( m_tileHeight, m_height - sy );
+    }
+
+    int strideY, strideCb, strideCr, strideA;
+    planes.y  = heif_image_get_plane_readonly( img, heif_channel_Y, &strideY );
+    planes.cb = heif_image_get_plane_readonly( img, heif_channel_Cb, &strideCb );
+    planes.cr = heif_image_get_plane_readonly( img, heif_channel_Cr, &strideCr );
+    planes.a  = heif_image_get_plane_readonly( img, heif_channel_Alpha, &strideA );
+    if( !planes.y || !planes.cb || !planes.cr ) return false;
+
+    if( heif_image_get_chroma_format( img ) != m_chroma ||
+        heif_image_get_bits_per_pixel_range( img, heif_channel_Y ) != m_bpp ||
+        heif_image_get_width( img, heif_channel_Y ) < width ||
+        heif_image_get_height( img, heif_channel_Y ) < height ||
+        heif_image_get_width( img, heif_channel_Cb ) < ( ( width + m_chromaShiftX ) >> m_chromaShiftX ) ||
+        heif_image_get_height( img, heif_channel_Cb ) < ( ( height + m_chromaShiftY ) >> m_chromaShiftY ) ||
+        strideCb != strideCr )
+    {
+        mclog( LogLevel::Error, "HEIF: Unexpected decoded plane layout" );
+        return false;
+    }
+
+    planes.strideY = strideY;
+    planes.strideC = strideCb;
+    planes.strideA = strideA;
+    planes.width = width;
+    planes.height = height;
+    planes.shiftX = m_chromaShiftX;
+    planes.shiftY = m_chromaShiftY;
+    planes.x0 = sx / m_reduction;
+    planes.y0 = sy / m_reduction;
+    planes.border = false;
+    return true;
+}
+
+bool HeifLoader::Decode( Output output, void* dst )
+{
+    // Upsampled chroma at tile edges depends on the adjacent tiles, so with
+    // subsampled chroma at full size all tiles are decoded before conversion
+    if( m_tileColumns != 0 && m_reduction == 1 && ( m_chromaShiftX | m_chromaShiftY ) != 0 )
+    {
+        std::vector<heif_image*> tiles( m_tileColumns * m_tileRows, nullptr );
+        tiles[0] = m_image;
+        m_image = nullptr;
+
+        std::atomic<bool> ok = true;
+        for( size_t i=1; i<tiles.size(); i++ )
         {
-            heif_image_release( gainMap );
-            return false;
+            auto decode = [this, &tiles, &ok, i] {
+                tiles[i] = DecodeImage( i % m_tileColumns, i / m_tileColumns, m_chroma );
+                if( !tiles[i] ) ok.store( false, std::memory_order_relaxed );
+            };
+            if( m_td )
+            {
+                m_td->Queue( decode );
+            }
+            else
+            {
+                decode();
+            }
+        }
+        if( m_td ) m_td->Sync();
+
+        if( ok.load( std::memory_order_relaxed ) )
+        {
+            for( uint32_t ty=0; ty<m_tileRows; ty++ )
+            {
+                for( uint32_t tx=0; tx<m_tileColumns; tx++ )
+                {
+                    auto convert = [this, output, dst, &tiles, &ok, tx, ty] {
+                        if( !ConvertStitchedTile( output, dst, tiles, tx, ty ) ) ok.store( false, std::memory_order_relaxed );
+                    };
+                        if( m_td )
+                    {
+                        m_td->Queue( convert );
+                    }
+                    else
+                    {
+                        convert();
+                    }
+                }
+            }
+            if( m_td ) m_td->Sync();
         }
 
-        const auto w = heif_image_handle_get_width( m_handleGainMap );
-        const auto h = heif_image_handle_get_height( m_handleGainMap );
-        CheckPanic( w == m_width / 2 && h == m_height / 2, "Invalid gain map size" );
+        for( auto img : tiles )
+        {
+            if( img ) heif_image_release( img );
+        }
+        return ok.load( std::memory_order_relaxed );
+    }
 
-        std::vector<float> tmp( w * h );
-        auto dst = tmp.data();
-        for( int i=0; i<h; i++ )
+    if( m_tileColumns != 0 )
+    {
+        std::atomic<bool> ok = true;
+        for( uint32_t ty=0; ty<m_tileRows; ty++ )
         {
-            for( int i=0; i<w; i++ )
+            for( uint32_t tx=0; tx<m_tileColumns; tx++ )
             {
-                const auto v = *src++ / 255.f;
-                if( v < 0.081f )
+                if( m_td )
                 {
-                    *dst++ = v / 4.5f;
+                    m_td->Queue( [this, output, dst, tx, ty, &ok] {
+                        if( !DecodeTile( output, dst, tx, ty ) ) ok.store( false, std::memory_order_relaxed );
+                    } );
                 }
-                else
+                else if( !DecodeTile( output, dst, tx, ty ) )
                 {
-                    *dst++ = pow( ( v + 0.099f ) / 1.099f, 1.f / 0.45f );
+                    ok.store( false, std::memory_order_relaxed );
                 }
             }
-            src += stride - w;
         }
-        heif_image_release( gainMap );
+        if( m_td ) m_td->Sync();
+
+        heif_image_release( m_image );
+        m_image = nullptr;
+        return ok.load( std::memory_order_relaxed );
+    }
+
+    YCbCrPlanes planes;
+    if( !GetPlanes( m_image, 0, 0, planes ) ) return false;
 
-        m_gainMap = new float[m_width * m_height];
-        stbir_resize_float_linear( tmp.data(), w, h, 0, m_gainMap, m_width, m_height, 0, STBIR_1CHANNEL );
+    size_t offset = 0;
+    size_t sz = m_outWidth * m_outHeight;
+    while( sz > 0 )
+    {
+        const auto chunk = std::min( sz, size_t( 16 * 1024 ) );
+        if( m_td )
+        {
+            m_td->Queue( [this, planes, output, dst, chunk, offset] {
+                ConvertSpan( planes, output, dst, chunk, offset );
+            } );
+        }
+        else
+        {
+            ConvertSpan( planes, output, dst, chunk, offset );
+        }
+        sz -= chunk;
+        offset += chunk;
     }
+    if( m_td ) m_td->Sync();
 
     return true;
 }
 
-template<typename T>
-static inline void ProcessYCbCrAlpha( float* ptr, const T* srcY, const T* srcCb, const T* srcCr, const T* srcA, size_t sz, size_t offset, size_t width, size_t stride, float div )
+bool HeifLoader::DecodeTile( Output output, void* dst, uint32_t tx, uint32_t ty )
 {
-    const auto gap = stride - width;
+    auto img = tx == 0 && ty == 0 ? m_image : DecodeImage( tx, ty, m_chroma );
+    if( !img ) return false;
 
-    const int py = offset / width;
-    int px = offset % width;
+    YCbCrPlanes planes;
+    const auto ok = GetPlanes( img, tx, ty, planes );
+    if( ok ) ConvertTile( planes, output, dst );
 
-    srcY += py * stride + px;
-    srcCb += py * stride + px;
-    srcCr += py * stride + px;
-    srcA += py * stride + px;
+    if( img != m_image ) heif_image_release( img );
+    return ok;
+}
 
-    for(;;)
+bool HeifLoader::ConvertStitchedTile( Output output, void* dst, const std::vector<heif_image*>& tiles, uint32_t tx, uint32_t ty )
+{
+    YCbCrPlanes planes[3][3];
+    const YCbCrPlanes* nb[3][3] = {};
+    for( int dy=0; dy<3; dy++ )
     {
-        auto line = std::min( sz, size_t( width - px ) );
-        sz -= line;
-        while( line-- )
+        for( int dx=0; dx<3; dx++ )
         {
-            *ptr++ = float(*srcY++) * div;
-            *ptr++ = float(*srcCb++) * div - 0.5f;
-            *ptr++ = float(*srcCr++) * div - 0.5f;
-            *ptr++ = float(*srcA++) * div;
+            const auto x = tx + dx - 1;
+            const auto y = ty + dy - 1;
+            if( x >= m_tileColumns || y >= m_tileRows ) continue;
+            if( !GetPlanes( tiles[y * m_tileColumns + x], x, y, planes[dy][dx] ) ) return false;
+            nb[dy][dx] = &planes[dy][dx];
         }
-        if( sz == 0 ) break;
-        px = 0;
+    }
 
-        srcY += gap;
-        srcCb += gap;
-        srcCr += gap;
-        srcA += gap;
+    auto p = planes[1][1];
+    if( m_bpp > 8 )
+    {
+        std::vector<uint16_t> buf;
+        StitchChroma( p, nb, buf );
+        ConvertTile( p, output, dst );
     }
+    else
+    {
+        std::vector<uint8_t> buf;
+        StitchChroma( p, nb, buf );
+        ConvertTile( p, output, dst );
+    }
+    return true;
 }
 
-template<typename T>
-static inline void ProcessYCbCr( float* ptr, const T* srcY, const T* srcCb, const T* srcCr, size_t sz, size_t offset, size_t width, size_t stride, float div )
+void HeifLoader::ConvertTile( const YCbCrPlanes& planes, Output output, void* dst )
 {
-    const auto gap = stride - width;
+    const auto w = ( planes.width + m_reduction - 1 ) / m_reduction;
+    const auto h = ( planes.height + m_reduction - 1 ) / m_reduction;
+    for( int y=0; y<h; y++ )
+    {
+        ConvertSpan( planes, output, dst, w, size_t( planes.y0 + y ) * m_outWidth + planes.x0 );
+    }
+}
 
-    const int py = offset / width;
-    int px = offset % width;
+void HeifLoader::ConvertSpan( const YCbCrPlanes& planes, Output output, void* dst, size_t sz, size_t offset )
+{
+    auto ptr = output == Output::Hdr ? (float*)dst + offset * 4 : (float*)alloca( sz * 4 * sizeof( float ) );
 
-    srcY += py * stride + px;
-    srcCb += py * stride + px;
-    srcCr += py * stride + px;
+    LoadYCbCr( ptr, planes, sz, offset );
+    ConvertYCbCrToRGB( ptr, sz );
 
-    for(;;)
+    switch( output )
     {
-        auto line = std::min( sz, size_t( width - px ) );
-        sz -= line;
-        while( line-- )
-        {
-            *ptr++ = float(*srcY++) * div;
-            *ptr++ = float(*srcCb++) * div - 0.5f;
-            *ptr++ = float(*srcCr++) * div - 0.5f;
-            *ptr++ = 1.f;
-        }
-        if( sz == 0 ) break;
-        px = 0;
-
-        srcY += gap;
-        srcCb += gap;
-        srcCr += gap;
+    case Output::Sdr:
+        cmsDoTransform( m_transform.get(), ptr, (uint32_t*)dst + offset, sz );
+        break;
+    case Output::Tonemap:
+        if( m_transform ) cmsDoTransform( m_transform.get(), ptr, ptr, sz );
+        ApplyTransfer( ptr, sz, offset );
+        ToneMap::Process( m_tonemap, (uint32_t*)dst + offset, ptr, sz );
+        break;
+    case Output::Hdr:
+        if( m_transform ) cmsDoTransform( m_transform.get(), ptr, ptr, sz );
+        ApplyTransfer( ptr, sz, offset );
+        break;
     }
 }
 
-void HeifLoader::LoadYCbCr( float* ptr, size_t sz, size_t offset )
+void HeifLoader::LoadYCbCr( float* ptr, const YCbCrPlanes& planes, size_t sz, size_t offset )
 {
-    if( m_planeA )
+    if( planes.a )
     {
         if( m_bpp > 8 )
         {
-            ProcessYCbCrAlpha( ptr, (uint16_t*)m_planeY, (uint16_t*)m_planeCb, (uint16_t*)m_planeCr, (uint16_t*)m_planeA, sz, offset, m_width, m_stride, m_bppDiv );
+            ProcessYCbCr<uint16_t, true>( ptr, planes, sz, offset, m_outWidth, m_reduction, m_bppDiv );
         }
         else
         {
-            ProcessYCbCrAlpha( ptr, m_planeY, m_planeCb, m_planeCr, m_planeA, sz, offset, m_width, m_stride, m_bppDiv );
+            ProcessYCbCr<uint8_t, true>( ptr, planes, sz, offset, m_outWidth, m_reduction, m_bppDiv );
         }
     }
     else
     {
         if( m_bpp > 8 )
         {
-            ProcessYCbCr( ptr, (uint16_t*)m_planeY, (uint16_t*)m_planeCb, (uint16_t*)m_planeCr, sz, offset, m_width, m_stride, m_bppDiv );
+            ProcessYCbCr<uint16_t, false>( ptr, planes, sz, offset, m_outWidth, m_reduction, m_bppDiv );
         }
         else
         {
-            ProcessYCbCr( ptr, m_planeY, m_planeCb, m_planeCr, sz, offset, m_width, m_stride, m_bppDiv );
+            ProcessYCbCr<uint8_t, false>( ptr, planes, sz, offset, m_outWidth, m_reduction, m_bppDiv );
         }
     }
 
@@ -780,17 +1090,17 @@ void HeifLoader::ApplyTransfer( float* ptr, size_t sz, size_t offset )
 {
     if( m_gainMap )
     {
-        auto gptr = m_gainMap + offset;
-        do
+        int x = offset % m_outWidth;
+        int y = offset / m_outWidth;
+        while( sz > 0 )
         {
-            const auto gain = *gptr++;
-            const auto mul = 1.f + ( m_gainMapHeadroom - 1.f ) * gain;
-            ptr[0] *= mul;
-            ptr[1] *= mul;
-            ptr[2] *= mul;
-            ptr += 4;
+            const auto line = std::min( sz, size_t( m_outWidth - x ) );
+            ApplyGainMap( ptr, x, y, line );
+            ptr += line * 4;
+            sz -= line;
+            x = 0;
+            y++;
         }
-        while( --sz );
     }
     else
     {
@@ -824,6 +1134,77 @@ void HeifLoader::ApplyTransfer( float* ptr, size_t sz, size_t offset )
     }
 }
 
+void HeifLoader::ApplyGainMap( float* ptr, int x, int y, int cnt )
+{
+    const auto sx = float( m_gainMapWidth ) / m_outWidth;
+    const auto sy = float( m_gainMapHeight ) / m_outHeight;
+
+    const auto gy = std::max( 0.f, ( y + 0.5f ) * sy - 0.5f );
+    const auto y0 = std::min( int( gy ), m_gainMapHeight - 1 );
+    const auto y1 = std::min( y0 + 1, m_gainMapHeight - 1 );
+    const auto fy = gy - y0;
+
+    const auto gx0 = std::min( int( std::max( 0.f, ( x + 0.5f ) * sx - 0.5f ) ), m_gainMapWidth - 1 );
+    const auto gx1 = std::min( int( std::max( 0.f, ( x + cnt - 0.5f ) * sx - 0.5f ) ) + 2, m_gainMapWidth );
+
+    auto src0 = m_gainMap + y0 * m_gainMapStride;
+    auto src1 = m_gainMap + y1 * m_gainMapStride;
+    auto row = (float*)alloca( ( gx1 - gx0 ) * sizeof( float ) );
+    for( int i=gx0; i<gx1; i++ )
+    {
+        const auto v0 = m_gainMapLut[src0[i]];
+        const auto v1 = m_gainMapLut[src1[i]];
+        row[i - gx0] = v0 + fy * ( v1 - v0 );
+    }
+
+    const auto end = x + cnt;
+#if defined __SSE4_1__ && defined __FMA__
+    const auto vsx = _mm_set1_ps( sx );
+    const auto vmax = _mm_set1_epi32( m_gainMapWidth - 1 );
+    const auto vgx0 = _mm_set1_epi32( gx0 );
+    const auto one = _mm_set1_ps( 1.f );
+    auto vx = _mm_add_ps( _mm_set1_ps( x + 0.5f ), _mm_setr_ps( 0, 1, 2, 3 ) );
+    while( x + 4 <= end )
+    {
+        const auto gx = _mm_max_ps( _mm_fmsub_ps( vx, vsx, _mm_set1_ps( 0.5f ) ), _mm_setzero_ps() );
+        const auto i0 = _mm_min_epi32( _mm_cvttps_epi32( gx ), vmax );
+        const auto fx = _mm_sub_ps( gx, _mm_cvtepi32_ps( i0 ) );
+        const auto o0 = _mm_sub_epi32( i0, vgx0 );
+        const auto o1 = _mm_sub_epi32( _mm_min_epi32( _mm_add_epi32( i0, _mm_set1_epi32( 1 ) ), vmax ), vgx0 );
+
+        const auto v0 = _mm_setr_ps( row[_mm_extract_epi32( o0, 0 )], row[_mm_extract_epi32( o0, 1 )], row[_mm_extract_epi32( o0, 2 )], row[_mm_extract_epi32( o0, 3 )] );
+        const auto v1 = _mm_setr_ps( row[_mm_extract_epi32( o1, 0 )], row[_mm_extract_epi32( o1, 1 )], row[_mm_extract_epi32( o1, 2 )], row[_mm_extract_epi32( o1, 3 )] );
+        const auto mul = _mm_fmadd_ps( fx, _mm_sub_ps( v1, v0 ), v0 );
+
+        _mm_storeu_ps( ptr,      _mm_mul_ps( _mm_loadu_ps( ptr      ), _mm_blend_ps( _mm_shuffle_ps( mul, mul, _MM_SHUFFLE( 0, 0, 0, 0 ) ), one, 0x8 ) ) );
+        _mm_storeu_ps( ptr + 4,  _mm_mul_ps( _mm_loadu_ps( ptr + 4  ), _mm_blend_ps( _mm_shuffle_ps( mul, mul, _MM_SHUFFLE( 1, 1, 1, 1 ) ), one, 0x8 ) ) );
+        _mm_storeu_ps( ptr + 8,  _mm_mul_ps( _mm_loadu_ps( ptr + 8  ), _mm_blend_ps( _mm_shuffle_ps( mul, mul, _MM_SHUFFLE( 2, 2, 2, 2 ) ), one, 0x8 ) ) );
+        _mm_storeu_ps( ptr + 12, _mm_mul_ps( _mm_loadu_ps( ptr + 12 ), _mm_blend_ps( _mm_shuffle_ps( mul, mul, _MM_SHUFFLE( 3, 3, 3, 3 ) ), one, 0x8 ) ) );
+
+        vx = _mm_add_ps( vx, _mm_set1_ps( 4 ) );
+        ptr += 16;
+        x += 4;
+    }
+#endif
+    while( x < end )
+    {
+        const auto gx = std::max( 0.f, ( x + 0.5f ) * sx - 0.5f );
+        const auto i0 = std::min( int( gx ), m_gainMapWidth - 1 );
+        const auto i1 = std::min( i0 + 1, m_gainMapWidth - 1 );
+        const auto fx = gx - i0;
+        const auto v0 = row[i0 - gx0];
+        const auto v1 = row[i1 - gx0];
+        const auto mul = v0 + fx * ( v1 - v0 );
+
+        ptr[0] *= mul;
+        ptr[1] *= mul;
+        ptr[2] *= mul;
+
+        ptr += 4;
+        x++;
+    }
+}
+
 bool HeifLoader::GetGainMapHeadroom( heif_image_handle* handle )
 {
     const auto metanum = heif_image_handle_get_number_of_metadata_blocks( handle, nullptr );
@@ -1,13 +1,14 @@
 #pragma once
 
 #include <memory>
+#include <vector>
 
 #include "ImageLoader.hpp"
 #include "util/NoCopy.hpp"
 
 class Bitmap;
 class BitmapHdr;
-class FileBuffer;
+class DataBuffer;
 class FileWrapper;
 class TaskDispatch;
 
@@ -15,6 +16,7 @@ struct heif_context;
 struct heif_image;
 struct heif_image_handle;
 struct heif_color_profile_nclx;
+struct YCbCrPlanes;
 
 class HeifLoader : public ImageLoader
 {
@@ -26,8 +28,16 @@ class HeifLoader : public ImageLoader
         BT2020
     };
 
+    enum class Output
+    {
+        Sdr,
+        Tonemap,
+        Hdr
+    };
+
 public:
-    explicit HeifLoader( std::shared_ptr<FileWrapper> file, ToneMap::Operator tonemap, TaskDispatch* td );
+    explicit HeifLoader( const std::shared_ptr<FileWrapper>& file, ToneMap::Operator tonemap, TaskDispatch* td );
+    explicit HeifLoader( std::shared_ptr<DataBuffer> buf, ToneMap::Operator tonemap, TaskDispatch* td );
     ~HeifLoader() override;
 
     NoCopy( HeifLoader );
@@ -43,16 +53,25 @@ private:
 
     [[nodiscard]] bool SetupDecode( bool hdr );
 
-    void LoadYCbCr( float* ptr, size_t sz, size_t offset );
+    [[nodiscard]] heif_image* DecodeImage( uint32_t tx, uint32_t ty, int chroma );
+    [[nodiscard]] bool GetPlanes( const heif_image* img, uint32_t tx, uint32_t ty, YCbCrPlanes& planes ) const;
+
+    [[nodiscard]] bool Decode( Output output, void* dst );
+    [[nodiscard]] bool DecodeTile( Output output, void* dst, uint32_t tx, uint32_t ty );
+    [[nodiscard]] bool ConvertStitchedTile( Output output, void* dst, const std::vector<heif_image*>& tiles, uint32_t tx, uint32_t ty );
+    void ConvertTile( const YCbCrPlanes& planes, Output output, void* dst );
+    void ConvertSpan( const YCbCrPlanes& planes, Output output, void* dst, size_t sz, size_t offset );
+
+    void LoadYCbCr( float* ptr, const YCbCrPlanes& planes, size_t sz, size_t offset );
     void ConvertYCbCrToRGB( float* ptr, size_t sz );
     void ApplyTransfer( float* ptr, size_t sz, size_t offset );
+    void ApplyGainMap( float* ptr, int x, int y, int cnt );
 
     [[nodiscard]] bool GetGainMapHeadroom( heif_image_handle* handle );
 
     bool m_valid;
     ToneMap::Operator m_tonemap;
-    std::shared_ptr<FileWrapper> m_file;
-    std::unique_ptr<FileBuffer> m_buf;
+    std::shared_ptr<DataBuffer> m_buf;
 
     heif_context* m_ctx;
     heif_image_handle* m_handle;
@@ -61,7 +80,11 @@ private:
     heif_color_profile_nclx* m_nclx;
 
     int m_width, m_height;
-    int m_stride, m_bpp;
+    int m_outWidth, m_outHeight;
+    int m_reduction;
+    int m_chroma;
+    int m_chromaShiftX, m_chromaShiftY;
+    int m_bpp;
     float m_bppDiv;
     float m_gainMapHeadroom;
 
@@ -70,16 +93,16 @@ private:
     size_t m_iccSize;
     char* m_iccData;
 
-    float* m_gainMap;
+    heif_image* m_gainMapImage;
+    const uint8_t* m_gainMap;
+    int m_gainMapStride;
+    int m_gainMapWidth, m_gainMapHeight;
+    float m_gainMapLut[256];
 
-    const uint8_t* m_planeY;
-    const uint8_t* m_planeCb;
-    const uint8_t* m_planeCr;
-    const uint8_t* m_planeA;
+    uint32_t m_tileColumns, m_tileRows;
+    uint32_t m_tileWidth, m_tileHeight;
 
-    void* m_profileIn;
-    void* m_profileOut;
-    void* m_transform;
+    std::shared_ptr<void> m_transform;
 
     TaskDispatch* m_td;
 };
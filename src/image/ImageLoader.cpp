@@ -1,4 +1,8 @@
+#include <algorithm>
 #include <concepts>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include <tracy/Tracy.hpp>
 
 #include "DdsLoader.hpp"
@@ -7,6 +11,7 @@
 #include "ImageLoader.hpp"
 #include "JpgLoader.hpp"
 #include "JxlLoader.hpp"
+#include "KtxLoader.hpp"
 #include "PcxLoader.hpp"
 #include "PngLoader.hpp"
 #include "PvrLoader.hpp"
@@ -17,27 +22,99 @@
 #include "util/Bitmap.hpp"
 #include "util/BitmapAnim.hpp"
 #include "util/BitmapHdr.hpp"
+#include "util/FileBuffer.hpp"
 #include "util/FileWrapper.hpp"
 #include "util/Home.hpp"
 #include "util/Logs.hpp"
+#include "util/StreamBuffer.hpp"
 #include "vector/PdfImage.hpp"
 #include "vector/SvgImage.hpp"
 
 template<typename T>
-concept ImageLoaderConcept = requires( T loader, const std::shared_ptr<FileWrapper>& file )
+concept ImageLoaderConcept = requires( T loader )
 {
     { loader.IsValid() } -> std::convertible_to<bool>;
     { loader.Load() } -> std::convertible_to<std::unique_ptr<Bitmap>>;
 };
 
 template<ImageLoaderConcept T, typename... Args>
-static inline std::unique_ptr<ImageLoader> CheckImageLoader( const std::shared_ptr<FileWrapper>& file, Args&&... args )
+static inline std::unique_ptr<ImageLoader> CheckImageLoader( const std::shared_ptr<DataBuffer>& buf, Args&&... args )
 {
-    auto loader = std::make_unique<T>( file, std::forward<Args>( args )... );
+    auto loader = std::make_unique<T>( buf, std::forward<Args>( args )... );
     if( loader->IsValid() ) return loader;
     return nullptr;
 }
 
+namespace
+{
+enum class Signature
+{
+    Unknown,
+    Png,
+    Jpg,
+    Jxl,
+    Webp,
+    IsoBmff,
+    Pvr,
+    Dds,
+    Ktx,
+    Exr,
+    Tiff,
+    RawTiff,
+    Pcx,
+    Stb
+};
+
+// TIFF is also the container of most camera raw formats. These are recognized
+// by the CR2 marker, or by the camera make or DNG version tags in the first IFD.
+bool IsRawTiff( const uint8_t* hdr, size_t size )
+{
+    if( size >= 10 && hdr[8] == 'C' && hdr[9] == 'R' ) return true;
+    if( size < 8 ) return false;
+
+    const bool le = hdr[0] == 'I';
+    auto u16 = [le]( const uint8_t* p ) -> uint32_t { return le ? ( p[0] | ( p[1] << 8 ) ) : ( ( p[0] << 8 ) | p[1] ); };
+    auto u32 = [le]( const uint8_t* p ) -> uint32_t { return le ? ( p[0] | ( p[1] << 8 ) | ( p[2] << 16 ) | ( uint32_t( p[3] ) << 24 ) ) : ( ( uint32_t( p[0] ) << 24 ) | ( p[1] << 16 ) | ( p[2] << 8 ) | p[3] ); };
+
+    const size_t offset = u32( hdr + 4 );
+    if( offset >= size || size - offset < 2 ) return false;
+
+    const auto ifd = hdr + offset + 2;
+    const auto entries = std::min<size_t>( u16( hdr + offset ), ( size - offset - 2 ) / 12 );
+    for( size_t i=0; i<entries; i++ )
+    {
+        const auto tag = u16( ifd + i * 12 );
+        if( tag == 0x010F || tag == 0xC612 ) return true;
+    }
+    return false;
+}
+
+Signature Sniff( const DataBuffer& buf )
+{
+    const auto hdr = (const uint8_t*)buf.data();
+    const auto size = buf.size();
+    if( size < 4 ) return Signature::Unknown;
+
+    auto match = [&]( size_t offset, const void* magic, size_t len ) { return size >= offset + len && memcmp( hdr + offset, magic, len ) == 0; };
+
+    if( match( 0, "\x89PNG\r\n\x1a\n", 8 ) ) return Signature::Png;
+    if( hdr[0] == 0xFF && hdr[1] == 0xD8 ) return Signature::Jpg;
+    if( hdr[0] == 0xFF && hdr[1] == 0x0A ) return Signature::Jxl;
+    if( match( 0, "\0\0\0\x0cJXL \r\n\x87\n", 12 ) ) return Signature::Jxl;
+    if( match( 0, "RIFF", 4 ) && match( 8, "WEBP", 4 ) ) return Signature::Webp;
+    if( match( 4, "ftyp", 4 ) ) return Signature::IsoBmff;
+    if( match( 0, "PVR\x03", 4 ) ) return Signature::Pvr;
+    if( match( 0, "DDS ", 4 ) ) return Signature::Dds;
+    if( match( 0, "\xabKTX ", 5 ) ) return Signature::Ktx;
+    if( match( 0, "v/1\x01", 4 ) ) return Signature::Exr;
+    if( match( 0, "II*\0", 4 ) || match( 0, "MM\0*", 4 ) ) return IsRawTiff( hdr, size ) ? Signature::RawTiff : Signature::Tiff;
+    if( match( 0, "GIF8", 4 ) || match( 0, "BM", 2 ) || match( 0, "8BPS", 4 ) || match( 0, "#?", 2 ) || match( 0, "\x53\x80\xf6\x34", 4 ) ) return Signature::Stb;
+    if( hdr[0] == 'P' && ( hdr[1] == '5' || hdr[1] == '6' ) ) return Signature::Stb;
+    if( hdr[0] == 0x0A && hdr[1] <= 5 && hdr[2] == 1 ) return Signature::Pcx;
+    return Signature::Unknown;
+}
+}
+
 std::unique_ptr<BitmapAnim> ImageLoader::LoadAnim()
 {
     return nullptr;
@@ -48,32 +125,90 @@ std::unique_ptr<BitmapHdr> ImageLoader::LoadHdr()
     return nullptr;
 }
 
+void ImageLoader::SetTargetSize( uint32_t width, uint32_t height )
+{
+    m_targetWidth = width;
+    m_targetHeight = height;
+}
+
+uint32_t ImageLoader::GetReduction( uint32_t width, uint32_t height, uint32_t maxFactor ) const
+{
+    if( m_targetWidth == 0 || m_targetHeight == 0 || width == 0 || height == 0 ) return 1;
+
+    // Orientation may still be applied after load, so take the larger of both fits
+    const auto ratio = std::max(
+        std::min( float( m_targetWidth ) / width, float( m_targetHeight ) / height ),
+        std::min( float( m_targetWidth ) / height, float( m_targetHeight ) / width ) );
+
+    uint32_t factor = 1;
+    while( factor < maxFactor && ratio * factor * 2 <= 1.f ) factor *= 2;
+    return factor;
+}
+
 std::unique_ptr<ImageLoader> GetImageLoader( const char* filename, ToneMap::Operator tonemap, TaskDispatch* td )
 {
     ZoneScoped;
 
-    auto path = ExpandHome( filename );
-    auto file = std::make_shared<FileWrapper>( path.c_str(), "rb" );
-    if( !*file )
+    auto buf = OpenImageData( filename );
+    if( !buf ) return nullptr;
+
+    auto loader = GetImageLoader( std::move( buf ), tonemap, td );
+    if( !loader ) mclog( LogLevel::Info, "Raster image loaders can't open %s", filename );
+    return loader;
+}
+
+std::unique_ptr<ImageLoader> GetImageLoader( std::shared_ptr<DataBuffer> buf, ToneMap::Operator tonemap, TaskDispatch* td )
+{
+    ZoneScoped;
+
+    // Formats with a reliable signature go straight to their loader. Camera raw
+    // files and TGA have no common signature and are probed last.
+    switch( Sniff( *buf ) )
     {
-        mclog( LogLevel::Error, "Image %s does not exist.", path.c_str() );
-        return nullptr;
+    case Signature::Png:
+        if( auto loader = CheckImageLoader<PngLoader>( buf ); loader ) return loader;
+        break;
+    case Signature::Jpg:
+        if( auto loader = CheckImageLoader<JpgLoader>( buf ); loader ) return loader;
+        break;
+    case Signature::Jxl:
+        if( auto loader = CheckImageLoader<JxlLoader>( buf ); loader ) return loader;
+        break;
+    case Signature::Webp:
+        if( auto loader = CheckImageLoader<WebpLoader>( buf ); loader ) return loader;
+        break;
+    case Signature::IsoBmff:
+        if( auto loader = CheckImageLoader<HeifLoader>( buf, tonemap, td ); loader ) return loader;
+        break;
+    case Signature::Pvr:
+        if( auto loader = CheckImageLoader<PvrLoader>( buf, td ); loader ) return loader;
+        break;
+    case Signature::Dds:
+        if( auto loader = CheckImageLoader<DdsLoader>( buf, tonemap, td ); loader ) return loader;
+        break;
+    case Signature::Ktx:
+        if( auto loader = CheckImageLoader<KtxLoader>( buf, tonemap, td ); loader ) return loader;
+        break;
+    case Signature::Exr:
+        if( auto loader = CheckImageLoader<ExrLoader>( buf, tonemap, td ); loader ) return loader;
+        break;
+    case Signature::Tiff:
+        if( auto loader = CheckImageLoader<TiffLoader>( buf ); loader ) return loader;
+        break;
+    case Signature::RawTiff:
+        if( auto loader = CheckImageLoader<RawLoader>( buf ); loader ) return loader;
+        if( auto loader = CheckImageLoader<TiffLoader>( buf ); loader ) return loader;
+        break;
+    case Signature::Pcx:
+        if( auto loader = CheckImageLoader<PcxLoader>( buf ); loader ) return loader;
+        break;
+    default:
+        break;
     }
 
-    if( auto loader = CheckImageLoader<PngLoader>( file ); loader ) return loader;
-    if( auto loader = CheckImageLoader<JpgLoader>( file ); loader ) return loader;
-    if( auto loader = CheckImageLoader<JxlLoader>( file ); loader ) return loader;
-    if( auto loader = CheckImageLoader<WebpLoader>( file ); loader ) return loader;
-    if( auto loader = CheckImageLoader<HeifLoader>( file, tonemap, td ); loader ) return loader;
-    if( auto loader = CheckImageLoader<PvrLoader>( file ); loader ) return loader;
-    if( auto loader = CheckImageLoader<DdsLoader>( file ); loader ) return loader;
-    if( auto loader = CheckImageLoader<StbImageLoader>( file ); loader ) return loader;
-    if( auto loader = CheckImageLoader<RawLoader>( file ); loader ) return loader;
-    if( auto loader = CheckImageLoader<TiffLoader>( file ); loader ) return loader;
-    if( auto loader = CheckImageLoader<ExrLoader>( file, tonemap, td ); loader ) return loader;
-    if( auto loader = CheckImageLoader<PcxLoader>( file ); loader ) return loader;
-
-    mclog( LogLevel::Info, "Raster image loaders can't open %s", path.c_str() );
+    if( auto loader = CheckImageLoader<StbImageLoader>( buf ); loader ) return loader;
+    if( auto loader = CheckImageLoader<RawLoader>( buf ); loader ) return loader;
+
     return nullptr;
 }
 
@@ -108,3 +243,42 @@ std::unique_ptr<VectorImage> LoadVectorImage( const char* filename )
     mclog( LogLevel::Info, "Vector loaders can't open %s", path.c_str() );
     return nullptr;
 }
+
+std::unique_ptr<VectorImage> LoadVectorImage( std::shared_ptr<DataBuffer> buf )
+{
+    ZoneScoped;
+
+    if( auto img = std::make_unique<SvgImage>( buf ); img->IsValid() ) return img;
+    if( auto img = std::make_unique<PdfImage>( buf ); img->IsValid() ) return img;
+
+    return nullptr;
+}
+
+std::shared_ptr<DataBuffer> OpenImageData( const char* filename )
+{
+    ZoneScoped;
+
+    // Pipes, sockets and character devices can't be mapped, so these are read to the end into memory
+    if( strcmp( filename, "-" ) == 0 )
+    {
+        mclog( LogLevel::Info, "Reading image from stdin" );
+        return std::make_shared<StreamBuffer>( STDIN_FILENO );
+    }
+
+    auto path = ExpandHome( filename );
+    auto file = std::make_shared<FileWrapper>( path.c_str(), "rb" );
+    if( !*file )
+    {
+        mclog( LogLevel::Error, "Image %s does not exist.", path.c_str() );
+        return nullptr;
+    }
+
+    struct stat st;
+    if( fstat( fileno( *file ), &st ) == 0 && !S_ISREG( st.st_mode ) )
+    {
+        mclog( LogLevel::Info, "Reading image from stream %s", path.c_str() );
+        return std::make_shared<StreamBuffer>( fileno( *file ) );
+    }
+
+    return std::make_shared<FileBuffer>( file );
+}
@@ -1,12 +1,14 @@
 #pragma once
 
 #include <memory>
+#include <stdint.h>
 
 #include "util/Tonemapper.hpp"
 
 class Bitmap;
 class BitmapAnim;
 class BitmapHdr;
+class DataBuffer;
 class TaskDispatch;
 class VectorImage;
 
@@ -23,8 +25,20 @@ public:
     [[nodiscard]] virtual std::unique_ptr<Bitmap> Load() = 0;
     [[nodiscard]] virtual std::unique_ptr<BitmapAnim> LoadAnim();
     [[nodiscard]] virtual std::unique_ptr<BitmapHdr> LoadHdr();
+
+    void SetTargetSize( uint32_t width, uint32_t height );
+
+protected:
+    [[nodiscard]] uint32_t GetReduction( uint32_t width, uint32_t height, uint32_t maxFactor ) const;
+
+    uint32_t m_targetWidth = 0;
+    uint32_t m_targetHeight = 0;
 };
 
 std::unique_ptr<ImageLoader> GetImageLoader( const char* filename, ToneMap::Operator tonemap, TaskDispatch* td = nullptr );
+std::unique_ptr<ImageLoader> GetImageLoader( std::shared_ptr<DataBuffer> buf, ToneMap::Operator tonemap, TaskDispatch* td = nullptr );
 std::unique_ptr<Bitmap> LoadImage( const char* filename );
 std::unique_ptr<VectorImage> LoadVectorImage( const char* filename );
+std::unique_ptr<VectorImage> LoadVectorImage( std::shared_ptr<DataBuffer> buf );
+
+std::shared_ptr<DataBuffer> OpenImageData( const char* filename );
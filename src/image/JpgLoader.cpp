@@ -2,25 +2,34 @@
 #include <jpeglib.h>
 #include <lcms2.h>
 #include <libexif/exif-data.h>
+#include <memory>
 #include <setjmp.h>
 #include <stdint.h>
 #include <string.h>
+#include <string>
+#include <utility>
 
 #include "JpgLoader.hpp"
 #include "util/Bitmap.hpp"
+#include "util/ColorTransform.hpp"
 #include "util/EmbedData.hpp"
 #include "util/FileBuffer.hpp"
 #include "util/FileWrapper.hpp"
+#include "util/Logs.hpp"
 #include "util/Panic.hpp"
 
 #include "data/CmykIcm.hpp"
 
-JpgLoader::JpgLoader( std::shared_ptr<FileWrapper> file )
-    : m_file( std::move( file ) )
+JpgLoader::JpgLoader( const std::shared_ptr<FileWrapper>& file )
+    : JpgLoader( std::make_shared<FileBuffer>( file ) )
 {
-    fseek( *m_file, 0, SEEK_SET );
-    uint8_t hdr[2];
-    m_valid = fread( hdr, 1, 2, *m_file ) == 2 && hdr[0] == 0xFF && hdr[1] == 0xD8;
+}
+
+JpgLoader::JpgLoader( std::shared_ptr<DataBuffer> buf )
+    : m_buf( std::move( buf ) )
+{
+    const auto hdr = (const uint8_t*)m_buf->data();
+    m_valid = m_buf->size() >= 2 && hdr[0] == 0xFF && hdr[1] == 0xD8;
 }
 
 bool JpgLoader::IsValid() const
@@ -62,12 +71,24 @@ bool HasColorspaceExtensions()
     return false;
 #endif
 }
+
+// Photos from the same camera carry the same color profile, so the transforms
+// are shared between images
+std::shared_ptr<void> GetTransform( const void* icc, size_t size, bool cmyk )
+{
+    std::string key( "srgb\n" );
+    key.append( (const char*)icc, size );
+
+    return GetColorTransform( key, cmyk ? TYPE_CMYK_8_REV : TYPE_RGBA_8, TYPE_RGBA_8, 0, [icc, size] {
+        return std::make_pair( cmsOpenProfileFromMem( icc, size ), cmsCreate_sRGBProfile() );
+    } );
+}
 }
 
 std::unique_ptr<Bitmap> JpgLoader::Load()
 {
     CheckPanic( m_valid, "Invalid JPEG file" );
-    fseek( *m_file, 0, SEEK_SET );
+    m_buf->Advise( DataBuffer::Access::Sequential );
 
     const auto orientation = LoadOrientation();
     JOCTET* icc = nullptr;
@@ -87,10 +108,19 @@ std::unique_ptr<Bitmap> JpgLoader::Load()
     }
 
     jpeg_create_decompress( &cinfo );
-    jpeg_stdio_src( &cinfo, *m_file );
+    jpeg_mem_src( &cinfo, (const unsigned char*)m_buf->data(), m_buf->size() );
     jpeg_save_markers( &cinfo, JPEG_APP0 + 2, 0xFFFF );
     jpeg_read_header( &cinfo, TRUE );
     const bool cmyk = cinfo.jpeg_color_space == JCS_CMYK || cinfo.jpeg_color_space == JCS_YCCK;
+
+    // The IDCT can produce the image at 1/2, 1/4 or 1/8 scale at a fraction of the cost
+    const auto reduction = GetReduction( cinfo.image_width, cinfo.image_height, 8 );
+    if( reduction > 1 )
+    {
+        mclog( LogLevel::Info, "JPEG decoded at 1/%u scale", reduction );
+        cinfo.scale_num = 1;
+        cinfo.scale_denom = reduction;
+    }
 #ifdef JCS_EXTENSIONS
     if( extensions && !cmyk ) cinfo.out_color_space = JCS_EXT_RGBX;
 #endif
@@ -130,48 +160,28 @@ std::unique_ptr<Bitmap> JpgLoader::Load()
 
     if( cmyk )
     {
-        cmsHPROFILE profileIn;
+        std::shared_ptr<void> transform;
 
         if( icc )
         {
             mclog( LogLevel::Info, "ICC profile size: %u", iccSz );
-            profileIn = cmsOpenProfileFromMem( icc, iccSz );
+            transform = GetTransform( icc, iccSz, true );
         }
         else
         {
             mclog( LogLevel::Info, "No ICC profile found, using default" );
             Unembed( CmykIcm );
-            profileIn = cmsOpenProfileFromMem( CmykIcm->data(), CmykIcm->size() );
-        }
-
-        auto profileOut = cmsCreate_sRGBProfile();
-        auto transform = cmsCreateTransform( profileIn, TYPE_CMYK_8_REV, profileOut, TYPE_RGBA_8, INTENT_PERCEPTUAL, 0 );
-
-        if( transform )
-        {
-            cmsDoTransform( transform, bmp->Data(), bmp->Data(), bmp->Width() * bmp->Height() );
-            cmsDeleteTransform( transform );
+            transform = GetTransform( CmykIcm->data(), CmykIcm->size(), true );
         }
 
-        cmsCloseProfile( profileOut );
-        cmsCloseProfile( profileIn );
+        if( transform ) cmsDoTransform( transform.get(), bmp->Data(), bmp->Data(), bmp->Width() * bmp->Height() );
     }
     else if( icc )
     {
         mclog( LogLevel::Info, "ICC profile size: %u", iccSz );
 
-        auto profileIn = cmsOpenProfileFromMem( icc, iccSz );
-        auto profileOut = cmsCreate_sRGBProfile();
-        auto transform = cmsCreateTransform( profileIn, TYPE_RGBA_8, profileOut, TYPE_RGBA_8, INTENT_PERCEPTUAL, 0 );
-
-        if( transform )
-        {
-            cmsDoTransform( transform, bmp->Data(), bmp->Data(), bmp->Width() * bmp->Height() );
-            cmsDeleteTransform( transform );
-        }
-
-        cmsCloseProfile( profileOut );
-        cmsCloseProfile( profileIn );
+        auto transform = GetTransform( icc, iccSz, false );
+        if( transform ) cmsDoTransform( transform.get(), bmp->Data(), bmp->Data(), bmp->Width() * bmp->Height() );
     }
 
     free( icc );
@@ -186,8 +196,7 @@ int JpgLoader::LoadOrientation()
 {
     int orientation = 0;
 
-    FileBuffer buf( m_file );
-    auto exif = exif_data_new_from_data( (const unsigned char*)buf.data(), buf.size() );
+    auto exif = exif_data_new_from_data( (const unsigned char*)m_buf->data(), m_buf->size() );
 
     if( exif )
     {
@@ -6,12 +6,14 @@
 #include "util/NoCopy.hpp"
 
 class Bitmap;
+class DataBuffer;
 class FileWrapper;
 
 class JpgLoader : public ImageLoader
 {
 public:
-    explicit JpgLoader( std::shared_ptr<FileWrapper> file );
+    explicit JpgLoader( const std::shared_ptr<FileWrapper>& file );
+    explicit JpgLoader( std::shared_ptr<DataBuffer> buf );
 
     NoCopy( JpgLoader );
 
@@ -22,5 +24,5 @@ private:
     int LoadOrientation();
 
     bool m_valid;
-    std::shared_ptr<FileWrapper> m_file;
+    std::shared_ptr<DataBuffer> m_buf;
 };
@@ -1,12 +1,16 @@
+#include <algorithm>
 #include <jxl/cms_interface.h>
 #include <jxl/color_encoding.h>
 #include <jxl/decode.h>
 #include <jxl/resizable_parallel_runner.h>
 #include <lcms2.h>
+#include <string>
+#include <utility>
 
 #include "JxlLoader.hpp"
 #include "util/Bitmap.hpp"
 #include "util/BitmapHdr.hpp"
+#include "util/ColorTransform.hpp"
 #include "util/FileBuffer.hpp"
 #include "util/FileWrapper.hpp"
 #include "util/Panic.hpp"
@@ -42,9 +46,15 @@ void* CmsInit( void* data, size_t num_threads, size_t pixels_per_thread, const J
         cms->dstBuf[i] = new float[pixels_per_thread * 3];
     }
 
-    cms->profileIn = cmsOpenProfileFromMem( input_profile->icc.data, input_profile->icc.size );
-    cms->profileOut = cmsOpenProfileFromMem( output_profile->icc.data, output_profile->icc.size );
-    cms->transform = cmsCreateTransform( cms->profileIn, TYPE_RGB_FLT, cms->profileOut, TYPE_RGB_FLT, INTENT_PERCEPTUAL, 0 );
+    // The output profile has no fixed length, so its size goes first to make the key unambiguous
+    auto key = std::to_string( output_profile->icc.size ) + "\n";
+    key.append( (const char*)output_profile->icc.data, output_profile->icc.size );
+    key.append( (const char*)input_profile->icc.data, input_profile->icc.size );
+    cms->transform = GetColorTransform( key, TYPE_RGB_FLT, TYPE_RGB_FLT, 0, [input_profile, output_profile] {
+        return std::make_pair(
+            cmsOpenProfileFromMem( input_profile->icc.data, input_profile->icc.size ),
+            cmsOpenProfileFromMem( output_profile->icc.data, output_profile->icc.size ) );
+    } );
 
     return cms;
 }
@@ -64,7 +74,8 @@ float* CmsGetDstBuffer( void* data, size_t thread )
 JXL_BOOL CmsRun( void* data, size_t thread, const float* input, float* output, size_t num_pixels )
 {
     auto cms = (JxlLoader::CmsData*)data;
-    cmsDoTransform( cms->transform, input, output, num_pixels );
+    if( !cms->transform ) return false;
+    cmsDoTransform( cms->transform.get(), input, output, num_pixels );
     return true;
 }
 
@@ -72,24 +83,24 @@ void CmsDestroy( void* data )
 {
     auto cms = (JxlLoader::CmsData*)data;
 
-    cmsDeleteTransform( cms->transform );
-    cmsCloseProfile( cms->profileOut );
-    cmsCloseProfile( cms->profileIn );
+    cms->transform.reset();
 
     for( auto& buf : cms->srcBuf ) delete[] buf;
     for( auto& buf : cms->dstBuf ) delete[] buf;
 }
 }
 
-JxlLoader::JxlLoader( std::shared_ptr<FileWrapper> file )
-    : m_file( std::move( file ) )
+JxlLoader::JxlLoader( const std::shared_ptr<FileWrapper>& file )
+    : JxlLoader( std::make_shared<FileBuffer>( file ) )
+{
+}
+
+JxlLoader::JxlLoader( std::shared_ptr<DataBuffer> buf )
+    : m_buf( std::move( buf ) )
     , m_runner( nullptr )
     , m_dec( nullptr )
 {
-    fseek( *m_file, 0, SEEK_SET );
-    uint8_t hdr[12];
-    const auto read = fread( hdr, 1, 12, *m_file );
-    const auto res = JxlSignatureCheck( hdr, read );
+    const auto res = JxlSignatureCheck( (const uint8_t*)m_buf->data(), std::min<size_t>( m_buf->size(), 12 ) );
     m_valid = res == JXL_SIG_CODESTREAM || res == JXL_SIG_CONTAINER;
 }
 
@@ -164,9 +175,9 @@ std::unique_ptr<BitmapHdr> JxlLoader::LoadHdr()
 bool JxlLoader::Open()
 {
     CheckPanic( m_valid, "Invalid JPEG XL file" );
-    CheckPanic( !m_buf && !m_runner && !m_dec, "Already opened" );
+    CheckPanic( !m_runner && !m_dec, "Already opened" );
+    m_buf->Advise( DataBuffer::Access::Sequential );
 
-    m_buf = std::make_unique<FileBuffer>( m_file );
     m_runner = JxlResizableParallelRunnerCreate( nullptr );
 
     m_dec = JxlDecoderCreate( nullptr );
@@ -9,11 +9,9 @@
 
 class Bitmap;
 class BitmapHdr;
-class FileBuffer;
+class DataBuffer;
 class FileWrapper;
 typedef struct JxlDecoderStruct JxlDecoder;
-typedef void* cmsHPROFILE;
-typedef void* cmsHTRANSFORM;
 
 class JxlLoader : public ImageLoader
 {
@@ -23,12 +21,11 @@ public:
         std::vector<float*> srcBuf;
         std::vector<float*> dstBuf;
 
-        cmsHPROFILE profileIn;
-        cmsHPROFILE profileOut;
-        cmsHTRANSFORM transform;
+        std::shared_ptr<void> transform;
     };
 
-    explicit JxlLoader( std::shared_ptr<FileWrapper> file );
+    explicit JxlLoader( const std::shared_ptr<FileWrapper>& file );
+    explicit JxlLoader( std::shared_ptr<DataBuffer> buf );
     ~JxlLoader() override;
 
     NoCopy( JxlLoader );
@@ -44,8 +41,7 @@ private:
     bool Open();
 
     bool m_valid;
-    std::shared_ptr<FileWrapper> m_file;
-    std::unique_ptr<FileBuffer> m_buf;
+    std::shared_ptr<DataBuffer> m_buf;
 
     void* m_runner;
     JxlDecoder* m_dec;
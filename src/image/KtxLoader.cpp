@@ -0,0 +1,594 @@
+#include <algorithm>
+#include <string.h>
+#include <zlib.h>
+#include <zstd.h>
+
+#include "BcDecode.hpp"
+#include "BlockDecode.hpp"
+#include "EtcDecode.hpp"
+#include "KtxLoader.hpp"
+#include "util/Bitmap.hpp"
+#include "util/BitmapHdr.hpp"
+#include "util/FileBuffer.hpp"
+#include "util/FileWrapper.hpp"
+#include "util/Logs.hpp"
+#include "util/Panic.hpp"
+
+static constexpr uint8_t Ktx1Magic[12] = { 0xAB, 0x4B, 0x54, 0x58, 0x20, 0x31, 0x31, 0xBB, 0x0D, 0x0A, 0x1A, 0x0A };
+static constexpr uint8_t Ktx2Magic[12] = { 0xAB, 0x4B, 0x54, 0x58, 0x20, 0x32, 0x30, 0xBB, 0x0D, 0x0A, 0x1A, 0x0A };
+
+KtxLoader::KtxLoader( const std::shared_ptr<FileWrapper>& file, ToneMap::Operator tonemap, TaskDispatch* td )
+    : KtxLoader( std::make_shared<FileBuffer>( file ), tonemap, td )
+{
+}
+
+KtxLoader::KtxLoader( std::shared_ptr<DataBuffer> buf, ToneMap::Operator tonemap, TaskDispatch* td )
+    : m_tonemap( tonemap )
+    , m_buf( std::move( buf ) )
+    , m_td( td )
+{
+    m_valid = m_buf->size() >= 12;
+    if( !m_valid ) return;
+
+    if( memcmp( m_buf->data(), Ktx1Magic, 12 ) == 0 )
+    {
+        m_valid = ParseKtx1();
+    }
+    else if( memcmp( m_buf->data(), Ktx2Magic, 12 ) == 0 )
+    {
+        m_valid = ParseKtx2();
+    }
+    else
+    {
+        m_valid = false;
+    }
+}
+
+KtxLoader::~KtxLoader() = default;
+
+bool KtxLoader::ParseKtx1()
+{
+    if( m_buf->size() < 64 ) return false;
+
+    uint32_t hdr[13];
+    memcpy( hdr, m_buf->data() + 12, 52 );
+
+    // Only files with native byte order are supported
+    if( hdr[0] != 0x04030201 ) return false;
+    if( !SetGlFormat( hdr[4], hdr[3], hdr[1] ) )
+    {
+        mclog( LogLevel::Info, "KTX: unsupported format 0x%x", hdr[4] );
+        return false;
+    }
+
+    m_width = hdr[6];
+    m_height = std::max( 1u, hdr[7] );
+    m_rowAlign = 4;
+    m_supercompression = Supercompression::None;
+    if( m_width == 0 ) return false;
+
+    // Non-array cube maps store the size of a single face, and each face is
+    // padded to 4 bytes. The first face or array slice comes first either way.
+    const bool cubeFaces = hdr[10] == 6 && hdr[9] == 0;
+    const auto levels = std::clamp( hdr[11], 1u, 32u );
+
+    size_t pos = 64 + size_t( hdr[12] );
+    uint32_t w = m_width;
+    uint32_t h = m_height;
+    for( uint32_t i=0; i<levels; i++ )
+    {
+        if( pos + 4 > m_buf->size() ) break;
+        uint32_t imageSize;
+        memcpy( &imageSize, m_buf->data() + pos, 4 );
+        pos += 4;
+
+        const auto slice = SliceSize( w, h );
+        if( imageSize < slice || pos + slice > m_buf->size() ) break;
+        m_levels.emplace_back( Level { pos, slice, slice } );
+
+        const auto levelSize = cubeFaces ? ( ( size_t( imageSize ) + 3 ) & ~3 ) * 6 : size_t( imageSize );
+        pos += ( levelSize + 3 ) & ~3;
+        w = std::max( 1u, w / 2 );
+        h = std::max( 1u, h / 2 );
+    }
+    return !m_levels.empty();
+}
+
+bool KtxLoader::ParseKtx2()
+{
+    if( m_buf->size() < 80 ) return false;
+
+    uint32_t hdr[9];
+    memcpy( hdr, m_buf->data() + 12, 36 );
+
+    if( !SetVkFormat( hdr[0] ) )
+    {
+        mclog( LogLevel::Info, "KTX2: unsupported format %u", hdr[0] );
+        return false;
+    }
+
+    switch( hdr[8] )
+    {
+    case 0:
+        m_supercompression = Supercompression::None;
+        break;
+    case 2:
+        m_supercompression = Supercompression::Zstd;
+        break;
+    case 3:
+        m_supercompression = Supercompression::Zlib;
+        break;
+    default:
+        mclog( LogLevel::Info, "KTX2: unsupported supercompression scheme %u", hdr[8] );
+        return false;
+    }
+
+    m_width = hdr[2];
+    m_height = std::max( 1u, hdr[3] );
+    m_rowAlign = 1;
+    if( m_width == 0 ) return false;
+
+    const auto levels = std::clamp( hdr[7], 1u, 32u );
+    if( 80 + levels * 24 > m_buf->size() ) return false;
+
+    const auto depth = std::max( 1u, hdr[4] );
+    const auto layers = std::max( 1u, hdr[5] );
+    const auto faces = std::max( 1u, hdr[6] );
+
+    // Levels are indexed from the largest, and each one starts with its first
+    // array layer, face and depth slice
+    uint32_t w = m_width;
+    uint32_t h = m_height;
+    for( uint32_t i=0; i<levels; i++ )
+    {
+        uint64_t index[3];
+        memcpy( index, m_buf->data() + 80 + i * 24, 24 );
+        if( index[0] > m_buf->size() || index[1] > m_buf->size() - index[0] ) break;
+
+        const auto slice = SliceSize( w, h );
+        if( m_supercompression == Supercompression::None )
+        {
+            if( index[1] < slice ) break;
+        }
+        else
+        {
+            // The inflated level is allocated up front, so its size must be
+            // exactly what the format and dimensions imply
+            uint64_t expected = uint64_t( std::max( 1u, depth >> i ) ) * layers;
+            if( __builtin_mul_overflow( expected, faces, &expected ) || __builtin_mul_overflow( expected, slice, &expected ) || index[2] != expected )
+            {
+                mclog( LogLevel::Error, "KTX2: level %u has invalid uncompressed size %llu", i, (unsigned long long)index[2] );
+                return false;
+            }
+        }
+        m_levels.emplace_back( Level { index[0], index[1], index[2] } );
+
+        w = std::max( 1u, w / 2 );
+        h = std::max( 1u, h / 2 );
+    }
+    return !m_levels.empty();
+}
+
+bool KtxLoader::SetGlFormat( uint32_t internalFormat, uint32_t format, uint32_t type )
+{
+    if( type == 0 )
+    {
+        switch( internalFormat )
+        {
+        case 0x83F0:    // COMPRESSED_RGB_S3TC_DXT1
+        case 0x83F1:    // COMPRESSED_RGBA_S3TC_DXT1
+        case 0x8C4C:    // COMPRESSED_SRGB_S3TC_DXT1
+        case 0x8C4D:    // COMPRESSED_SRGB_ALPHA_S3TC_DXT1
+            m_format = Format::Bc1;
+            return true;
+        case 0x83F2:    // COMPRESSED_RGBA_S3TC_DXT3
+        case 0x8C4E:    // COMPRESSED_SRGB_ALPHA_S3TC_DXT3
+            m_format = Format::Bc2;
+            return true;
+        case 0x83F3:    // COMPRESSED_RGBA_S3TC_DXT5
+        case 0x8C4F:    // COMPRESSED_SRGB_ALPHA_S3TC_DXT5
+            m_format = Format::Bc3;
+            return true;
+        case 0x8DBB:    // COMPRESSED_RED_RGTC1
+            m_format = Format::Bc4;
+            return true;
+        case 0x8DBD:    // COMPRESSED_RG_RGTC2
+            m_format = Format::Bc5;
+            return true;
+        case 0x8E8C:    // COMPRESSED_RGBA_BPTC_UNORM
+        case 0x8E8D:    // COMPRESSED_SRGB_ALPHA_BPTC_UNORM
+            m_format = Format::Bc7;
+            return true;
+        case 0x8E8E:    // COMPRESSED_RGB_BPTC_SIGNED_FLOAT
+            m_format = Format::Bc6hSigned;
+            return true;
+        case 0x8E8F:    // COMPRESSED_RGB_BPTC_UNSIGNED_FLOAT
+            m_format = Format::Bc6h;
+            return true;
+        case 0x8D64:    // ETC1_RGB8_OES
+        case 0x9274:    // COMPRESSED_RGB8_ETC2
+        case 0x9275:    // COMPRESSED_SRGB8_ETC2
+            m_format = Format::Etc2Rgb;
+            return true;
+        case 0x9278:    // COMPRESSED_RGBA8_ETC2_EAC
+        case 0x9279:    // COMPRESSED_SRGB8_ALPHA8_ETC2_EAC
+            m_format = Format::Etc2Rgba;
+            return true;
+        case 0x9270:    // COMPRESSED_R11_EAC
+            m_format = Format::EacR;
+            return true;
+        case 0x9272:    // COMPRESSED_RG11_EAC
+            m_format = Format::EacRg;
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    switch( type )
+    {
+    case 0x1401:        // UNSIGNED_BYTE
+        switch( format )
+        {
+        case 0x1908:    // RGBA
+            m_format = Format::Rgba8;
+            return true;
+        case 0x80E1:    // BGRA
+            m_format = Format::Bgra8;
+            return true;
+        case 0x1907:    // RGB
+            m_format = Format::Rgb8;
+            return true;
+        case 0x8227:    // RG
+            m_format = Format::Rg8;
+            return true;
+        case 0x1903:    // RED
+            m_format = Format::R8;
+            return true;
+        case 0x1909:    // LUMINANCE
+            m_format = Format::L8;
+            return true;
+        default:
+            return false;
+        }
+    case 0x140B:        // HALF_FLOAT
+        if( format != 0x1908 ) return false;
+        m_format = Format::Half;
+        return true;
+    case 0x1406:        // FLOAT
+        if( format != 0x1908 ) return false;
+        m_format = Format::Float;
+        return true;
+    default:
+        return false;
+    }
+}
+
+bool KtxLoader::SetVkFormat( uint32_t format )
+{
+    switch( format )
+    {
+    case 9:             // R8_UNORM
+    case 15:            // R8_SRGB
+        m_format = Format::R8;
+        return true;
+    case 16:            // R8G8_UNORM
+    case 22:            // R8G8_SRGB
+        m_format = Format::Rg8;
+        return true;
+    case 23:            // R8G8B8_UNORM
+    case 29:            // R8G8B8_SRGB
+        m_format = Format::Rgb8;
+        return true;
+    case 37:            // R8G8B8A8_UNORM
+    case 43:            // R8G8B8A8_SRGB
+        m_format = Format::Rgba8;
+        return true;
+    case 44:            // B8G8R8A8_UNORM
+    case 50:            // B8G8R8A8_SRGB
+        m_format = Format::Bgra8;
+        return true;
+    case 97:            // R16G16B16A16_SFLOAT
+        m_format = Format::Half;
+        return true;
+    case 109:           // R32G32B32A32_SFLOAT
+        m_format = Format::Float;
+        return true;
+    case 131:           // BC1_RGB
+    case 132:
+    case 133:           // BC1_RGBA
+    case 134:
+        m_format = Format::Bc1;
+        return true;
+    case 135:           // BC2
+    case 136:
+        m_format = Format::Bc2;
+        return true;
+    case 137:           // BC3
+    case 138:
+        m_format = Format::Bc3;
+        return true;
+    case 139:           // BC4_UNORM
+        m_format = Format::Bc4;
+        return true;
+    case 141:           // BC5_UNORM
+        m_format = Format::Bc5;
+        return true;
+    case 143:           // BC6H_UFLOAT
+        m_format = Format::Bc6h;
+        return true;
+    case 144:           // BC6H_SFLOAT
+        m_format = Format::Bc6hSigned;
+        return true;
+    case 145:           // BC7
+    case 146:
+        m_format = Format::Bc7;
+        return true;
+    case 147:           // ETC2_R8G8B8
+    case 148:
+        m_format = Format::Etc2Rgb;
+        return true;
+    case 151:           // ETC2_R8G8B8A8
+    case 152:
+        m_format = Format::Etc2Rgba;
+        return true;
+    case 153:           // EAC_R11_UNORM
+        m_format = Format::EacR;
+        return true;
+    case 155:           // EAC_R11G11_UNORM
+        m_format = Format::EacRg;
+        return true;
+    default:
+        return false;
+    }
+}
+
+size_t KtxLoader::RowPitch( uint32_t width ) const
+{
+    size_t bytes;
+    switch( m_format )
+    {
+    case Format::Rgba8:
+    case Format::Bgra8:
+        bytes = 4;
+        break;
+    case Format::Rgb8:
+        bytes = 3;
+        break;
+    case Format::Rg8:
+        bytes = 2;
+        break;
+    case Format::R8:
+    case Format::L8:
+        bytes = 1;
+        break;
+    case Format::Half:
+        bytes = 8;
+        break;
+    case Format::Float:
+        bytes = 16;
+        break;
+    default:
+        CheckPanic( false, "Not an uncompressed KTX format" );
+        return 0;
+    }
+    return ( width * bytes + m_rowAlign - 1 ) / m_rowAlign * m_rowAlign;
+}
+
+size_t KtxLoader::SliceSize( uint32_t width, uint32_t height ) const
+{
+    const auto blocks = size_t( ( width + 3 ) / 4 ) * ( ( height + 3 ) / 4 );
+    switch( m_format )
+    {
+    case Format::Bc1:
+    case Format::Bc4:
+    case Format::Etc2Rgb:
+    case Format::EacR:
+        return blocks * 8;
+    case Format::Bc2:
+    case Format::Bc3:
+    case Format::Bc5:
+    case Format::Bc6h:
+    case Format::Bc6hSigned:
+    case Format::Bc7:
+    case Format::Etc2Rgba:
+    case Format::EacRg:
+        return blocks * 16;
+    default:
+        return RowPitch( width ) * height;
+    }
+}
+
+const char* KtxLoader::SelectLevel( uint32_t& width, uint32_t& height )
+{
+    const auto reduction = GetReduction( m_width, m_height, 1u << ( m_levels.size() - 1 ) );
+    const auto idx = __builtin_ctz( reduction );
+    const auto& level = m_levels[idx];
+
+    width = std::max( 1u, m_width >> idx );
+    height = std::max( 1u, m_height >> idx );
+    if( idx > 0 ) mclog( LogLevel::Info, "KTX: using mip level %ux%u", width, height );
+
+    m_buf->Advise( DataBuffer::Access::Random );
+    m_buf->Prefetch( level.offset, level.size );
+
+    const auto src = m_buf->data() + level.offset;
+    switch( m_supercompression )
+    {
+    case Supercompression::None:
+        return src;
+    case Supercompression::Zstd:
+    {
+        m_inflated = std::make_unique<char[]>( level.uncompressedSize );
+        const auto ret = ZSTD_decompress( m_inflated.get(), level.uncompressedSize, src, level.size );
+        if( ZSTD_isError( ret ) || ret != level.uncompressedSize )
+        {
+            mclog( LogLevel::Error, "KTX2: zstd decompression failed" );
+            return nullptr;
+        }
+        return m_inflated.get();
+    }
+    case Supercompression::Zlib:
+    {
+        m_inflated = std::make_unique<char[]>( level.uncompressedSize );
+        uLongf size = level.uncompressedSize;
+        if( uncompress( (Bytef*)m_inflated.get(), &size, (const Bytef*)src, level.size ) != Z_OK || size != level.uncompressedSize )
+        {
+            mclog( LogLevel::Error, "KTX2: zlib decompression failed" );
+            return nullptr;
+        }
+        return m_inflated.get();
+    }
+    default:
+        return nullptr;
+    }
+}
+
+void KtxLoader::ConvertRows( uint32_t* dst, const char* src, uint32_t width, uint32_t height ) const
+{
+    const auto pitch = RowPitch( width );
+    for( uint32_t y=0; y<height; y++ )
+    {
+        auto in = (const uint8_t*)src;
+        switch( m_format )
+        {
+        case Format::Rgba8:
+            memcpy( dst, in, width * 4 );
+            break;
+        case Format::Bgra8:
+            for( uint32_t x=0; x<width; x++ )
+            {
+                dst[x] = in[2] | ( in[1] << 8 ) | ( in[0] << 16 ) | ( in[3] << 24 );
+                in += 4;
+            }
+            break;
+        case Format::Rgb8:
+            for( uint32_t x=0; x<width; x++ )
+            {
+                dst[x] = in[0] | ( in[1] << 8 ) | ( in[2] << 16 ) | 0xFF000000;
+                in += 3;
+            }
+            break;
+        case Format::Rg8:
+            for( uint32_t x=0; x<width; x++ )
+            {
+                dst[x] = in[0] | ( in[1] << 8 ) | 0xFF000000;
+                in += 2;
+            }
+            break;
+        case Format::R8:
+            for( uint32_t x=0; x<width; x++ ) dst[x] = in[x] | 0xFF000000;
+            break;
+        case Format::L8:
+            for( uint32_t x=0; x<width; x++ ) dst[x] = in[x] * 0x010101 | 0xFF000000;
+            break;
+        default:
+            CheckPanic( false, "Not an 8-bit KTX format" );
+        }
+        dst += width;
+        src += pitch;
+    }
+}
+
+bool KtxLoader::IsValid() const
+{
+    return m_valid;
+}
+
+bool KtxLoader::IsHdr()
+{
+    return m_format == Format::Bc6h || m_format == Format::Bc6hSigned || m_format == Format::Half || m_format == Format::Float;
+}
+
+std::unique_ptr<Bitmap> KtxLoader::Load()
+{
+    CheckPanic( m_valid, "Invalid KTX file" );
+
+    if( IsHdr() )
+    {
+        auto hdr = LoadHdr();
+        if( !hdr ) return nullptr;
+        return hdr->Tonemap( m_tonemap, m_td );
+    }
+
+    uint32_t width, height;
+    const auto src = SelectLevel( width, height );
+    if( !src ) return nullptr;
+
+    auto bmp = std::make_unique<Bitmap>( width, height );
+    auto dst = (uint32_t*)bmp->Data();
+
+    switch( m_format )
+    {
+    case Format::Bc1:
+        DecodeLevel( DecodeBc1, dst, src, width, height, 1, m_td );
+        break;
+    case Format::Bc2:
+        DecodeLevel( DecodeBc2, dst, src, width, height, 2, m_td );
+        break;
+    case Format::Bc3:
+        DecodeLevel( DecodeBc3, dst, src, width, height, 2, m_td );
+        break;
+    case Format::Bc4:
+        DecodeLevel( DecodeBc4, dst, src, width, height, 1, m_td );
+        break;
+    case Format::Bc5:
+        DecodeLevel( DecodeBc5, dst, src, width, height, 2, m_td );
+        break;
+    case Format::Bc7:
+        DecodeLevel( DecodeBc7, dst, src, width, height, 2, m_td );
+        break;
+    case Format::Etc2Rgb:
+        DecodeLevel( DecodeEtc2Rgb, dst, src, width, height, 1, m_td );
+        break;
+    case Format::Etc2Rgba:
+        DecodeLevel( DecodeEtc2Rgba, dst, src, width, height, 2, m_td );
+        break;
+    case Format::EacR:
+        DecodeLevel( DecodeEacR, dst, src, width, height, 1, m_td );
+        break;
+    case Format::EacRg:
+        DecodeLevel( DecodeEacRg, dst, src, width, height, 2, m_td );
+        break;
+    default:
+        ConvertRows( dst, src, width, height );
+        break;
+    }
+
+    return bmp;
+}
+
+std::unique_ptr<BitmapHdr> KtxLoader::LoadHdr()
+{
+    CheckPanic( m_valid, "Invalid KTX file" );
+    if( !IsHdr() ) return nullptr;
+
+    uint32_t width, height;
+    const auto src = SelectLevel( width, height );
+    if( !src ) return nullptr;
+
+    std::unique_ptr<BitmapHdr> hdr;
+    switch( m_format )
+    {
+    case Format::Bc6h:
+        hdr = std::make_unique<BitmapHdr>( width, height, BitmapHdr::Format::Half );
+        DecodeLevel( DecodeBc6h, (uint64_t*)hdr->DataHalf(), src, width, height, 2, m_td );
+        break;
+    case Format::Bc6hSigned:
+        hdr = std::make_unique<BitmapHdr>( width, height, BitmapHdr::Format::Half );
+        DecodeLevel( DecodeBc6hSigned, (uint64_t*)hdr->DataHalf(), src, width, height, 2, m_td );
+        break;
+    case Format::Half:
+        hdr = std::make_unique<BitmapHdr>( width, height, BitmapHdr::Format::Half );
+        memcpy( hdr->DataHalf(), src, size_t( width ) * height * 8 );
+        break;
+    case Format::Float:
+        hdr = std::make_unique<BitmapHdr>( width, height );
+        memcpy( hdr->Data(), src, size_t( width ) * height * 16 );
+        break;
+    default:
+        break;
+    }
+
+    return hdr;
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <memory>
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#include "ImageLoader.hpp"
+#include "util/NoCopy.hpp"
+
+class Bitmap;
+class BitmapHdr;
+class DataBuffer;
+class FileWrapper;
+class TaskDispatch;
+
+class KtxLoader : public ImageLoader
+{
+    enum class Format
+    {
+        Bc1,
+        Bc2,
+        Bc3,
+        Bc4,
+        Bc5,
+        Bc6h,
+        Bc6hSigned,
+        Bc7,
+        Etc2Rgb,
+        Etc2Rgba,
+        EacR,
+        EacRg,
+        Rgba8,
+        Bgra8,
+        Rgb8,
+        Rg8,
+        R8,
+        L8,
+        Half,
+        Float
+    };
+
+    enum class Supercompression
+    {
+        None,
+        Zstd,
+        Zlib
+    };
+
+    struct Level
+    {
+        size_t offset;
+        size_t size;
+        size_t uncompressedSize;
+    };
+
+public:
+    explicit KtxLoader( const std::shared_ptr<FileWrapper>& file, ToneMap::Operator tonemap, TaskDispatch* td );
+    explicit KtxLoader( std::shared_ptr<DataBuffer> buf, ToneMap::Operator tonemap, TaskDispatch* td );
+    ~KtxLoader() override;
+
+    NoCopy( KtxLoader );
+
+    [[nodiscard]] bool IsValid() const override;
+    [[nodiscard]] bool IsHdr() override;
+    [[nodiscard]] bool PreferHdr() override { return true; }
+
+    [[nodiscard]] std::unique_ptr<Bitmap> Load() override;
+    [[nodiscard]] std::unique_ptr<BitmapHdr> LoadHdr() override;
+
+private:
+    [[nodiscard]] bool ParseKtx1();
+    [[nodiscard]] bool ParseKtx2();
+    [[nodiscard]] bool SetGlFormat( uint32_t internalFormat, uint32_t format, uint32_t type );
+    [[nodiscard]] bool SetVkFormat( uint32_t format );
+
+    [[nodiscard]] size_t RowPitch( uint32_t width ) const;
+    [[nodiscard]] size_t SliceSize( uint32_t width, uint32_t height ) const;
+    [[nodiscard]] const char* SelectLevel( uint32_t& width, uint32_t& height );
+
+    void ConvertRows( uint32_t* dst, const char* src, uint32_t width, uint32_t height ) const;
+
+    bool m_valid;
+    ToneMap::Operator m_tonemap;
+    std::shared_ptr<DataBuffer> m_buf;
+    TaskDispatch* m_td;
+
+    Format m_format;
+    Supercompression m_supercompression;
+    uint32_t m_width, m_height;
+    uint32_t m_rowAlign;
+    std::vector<Level> m_levels;
+
+    std::unique_ptr<char[]> m_inflated;
+};
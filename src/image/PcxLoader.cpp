@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <string.h>
 
 #define DR_PCX_IMPLEMENTATION
@@ -6,15 +7,19 @@
 
 #include "PcxLoader.hpp"
 #include "util/Bitmap.hpp"
+#include "util/FileBuffer.hpp"
 #include "util/FileWrapper.hpp"
 #include "util/Panic.hpp"
 
-PcxLoader::PcxLoader( std::shared_ptr<FileWrapper> file )
-    : m_valid( false )
-    , m_file( std::move( file ) )
+PcxLoader::PcxLoader( const std::shared_ptr<FileWrapper>& file )
+    : PcxLoader( std::make_shared<FileBuffer>( file ) )
 {
-    fseek( *m_file, 0, SEEK_SET );
+}
 
+PcxLoader::PcxLoader( std::shared_ptr<DataBuffer> buf )
+    : m_valid( false )
+    , m_buf( std::move( buf ) )
+{
     struct {
         uint8_t magic;
         uint8_t version;
@@ -22,7 +27,8 @@ PcxLoader::PcxLoader( std::shared_ptr<FileWrapper> file )
         uint8_t bpp;
     } header;
 
-    if( fread( &header, 1, sizeof( header ), *m_file ) != sizeof( header ) ) return;
+    if( m_buf->size() < sizeof( header ) ) return;
+    memcpy( &header, m_buf->data(), sizeof( header ) );
     if( header.magic != 0x0A ) return;
     if( header.version == 1 || header.version > 5 ) return;
     if( header.encoding != 1 ) return;
@@ -39,11 +45,23 @@ bool PcxLoader::IsValid() const
 std::unique_ptr<Bitmap> PcxLoader::Load()
 {
     CheckPanic( m_valid, "Invalid PCX file" );
+    m_buf->Advise( DataBuffer::Access::Sequential );
 
-    fseek( *m_file, 0, SEEK_SET );
+    struct
+    {
+        const char* ptr;
+        size_t left;
+    } stream = { m_buf->data(), m_buf->size() };
 
     int w, h, comp;
-    auto data = drpcx_load( []( void* f, void* out, size_t sz ) { return fread( out, 1, sz, (FILE*)f ); }, (FILE*)*m_file, false, &w, &h, &comp, 4 );
+    auto data = drpcx_load( []( void* user, void* out, size_t sz ) {
+        auto s = (decltype(stream)*)user;
+        sz = std::min( sz, s->left );
+        memcpy( out, s->ptr, sz );
+        s->ptr += sz;
+        s->left -= sz;
+        return sz;
+    }, &stream, false, &w, &h, &comp, 4 );
     if( data == nullptr ) return nullptr;
 
     auto bmp = std::make_unique<Bitmap>( w, h );
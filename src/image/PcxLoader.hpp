@@ -6,12 +6,14 @@
 #include "util/NoCopy.hpp"
 
 class Bitmap;
+class DataBuffer;
 class FileWrapper;
 
 class PcxLoader : public ImageLoader
 {
 public:
-    explicit PcxLoader( std::shared_ptr<FileWrapper> file );
+    explicit PcxLoader( const std::shared_ptr<FileWrapper>& file );
+    explicit PcxLoader( std::shared_ptr<DataBuffer> buf );
 
     NoCopy( PcxLoader );
 
@@ -20,5 +22,5 @@ public:
 
 private:
     bool m_valid;
-    std::shared_ptr<FileWrapper> m_file;
+    std::shared_ptr<DataBuffer> m_buf;
 };
@@ -29,6 +29,7 @@ bool PngLoader::IsValid() const
 std::unique_ptr<Bitmap> PngLoader::Load()
 {
     CheckPanic( m_buf, "Invalid PNG file" );
+    m_buf->Advise( DataBuffer::Access::Sequential );
 
     auto png = png_create_read_struct( PNG_LIBPNG_VER_STRING, nullptr, nullptr, nullptr );
     if( !png ) return nullptr;
@@ -7,12 +7,15 @@
 #include "util/NoCopy.hpp"
 
 class Bitmap;
+class DataBuffer;
 class FileWrapper;
+class TaskDispatch;
 
 class PvrLoader : public ImageLoader
 {
 public:
-    explicit PvrLoader( std::shared_ptr<FileWrapper> file );
+    explicit PvrLoader( const std::shared_ptr<FileWrapper>& file, TaskDispatch* td );
+    explicit PvrLoader( std::shared_ptr<DataBuffer> buf, TaskDispatch* td );
 
     NoCopy( PvrLoader );
 
@@ -21,7 +24,8 @@ public:
 
 private:
     bool m_valid;
-    std::shared_ptr<FileWrapper> m_file;
+    std::shared_ptr<DataBuffer> m_buf;
+    TaskDispatch* m_td;
 
     uint32_t m_format;
 };
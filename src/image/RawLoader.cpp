@@ -1,15 +1,47 @@
+#include <algorithm>
 #include <libraw.h>
 #include <string.h>
 
+#include "JpgLoader.hpp"
 #include "RawLoader.hpp"
 #include "util/Bitmap.hpp"
+#include "util/DataBuffer.hpp"
 #include "util/FileBuffer.hpp"
+#include "util/Logs.hpp"
 #include "util/Panic.hpp"
 
+namespace
+{
+class RawThumbBuffer : public DataBuffer
+{
+public:
+    explicit RawThumbBuffer( libraw_processed_image_t* img )
+        : DataBuffer( (const char*)img->data, img->data_size )
+        , m_img( img )
+    {
+    }
+
+    ~RawThumbBuffer() override
+    {
+        LibRaw::dcraw_clear_mem( m_img );
+    }
+
+    NoCopy( RawThumbBuffer );
+
+private:
+    libraw_processed_image_t* m_img;
+};
+}
+
 RawLoader::RawLoader( const std::shared_ptr<FileWrapper>& file )
+    : RawLoader( std::make_shared<FileBuffer>( file ) )
+{
+}
+
+RawLoader::RawLoader( std::shared_ptr<DataBuffer> buf )
     : m_raw( std::make_unique<LibRaw>() )
+    , m_buf( std::move( buf ) )
 {
-    m_buf = std::make_unique<FileBuffer>( file );
     m_valid = m_raw->open_buffer( m_buf->data(), m_buf->size() ) == 0;
 }
 
@@ -26,6 +58,20 @@ std::unique_ptr<Bitmap> RawLoader::Load()
 {
     CheckPanic( m_valid, "Invalid RAW file" );
 
+    if( m_targetWidth != 0 && m_targetHeight != 0 )
+    {
+        if( auto preview = LoadPreview() ) return preview;
+
+        // Half size output skips demosaicing, as each 2x2 Bayer block becomes one pixel
+        if( GetReduction( m_raw->imgdata.sizes.width, m_raw->imgdata.sizes.height, 2 ) > 1 )
+        {
+            mclog( LogLevel::Info, "RAW decoded at half size" );
+            m_raw->imgdata.params.half_size = 1;
+        }
+    }
+
+    m_buf->Advise( DataBuffer::Access::Sequential );
+
     m_raw->unpack();
     m_raw->dcraw_process();
     auto img = m_raw->dcraw_make_mem_image();
@@ -73,3 +119,53 @@ std::unique_ptr<Bitmap> RawLoader::Load()
     m_raw->dcraw_clear_mem( img );
     return bmp;
 }
+
+// Cameras embed a JPEG preview in the RAW file, which is often large enough for
+// display and much cheaper to decode than the sensor data.
+std::unique_ptr<Bitmap> RawLoader::LoadPreview()
+{
+    const auto& thumb = m_raw->imgdata.thumbnail;
+    if( thumb.tformat != LIBRAW_THUMBNAIL_JPEG || thumb.twidth == 0 || thumb.theight == 0 ) return nullptr;
+
+    const auto ratio = std::max(
+        std::min( float( m_targetWidth ) / thumb.twidth, float( m_targetHeight ) / thumb.theight ),
+        std::min( float( m_targetWidth ) / thumb.theight, float( m_targetHeight ) / thumb.twidth ) );
+    if( ratio > 1.f ) return nullptr;
+
+    if( m_raw->unpack_thumb() != LIBRAW_SUCCESS ) return nullptr;
+    auto img = m_raw->dcraw_make_mem_thumb();
+    if( !img ) return nullptr;
+    if( img->type != LIBRAW_IMAGE_JPEG )
+    {
+        LibRaw::dcraw_clear_mem( img );
+        return nullptr;
+    }
+
+    JpgLoader loader( std::make_shared<RawThumbBuffer>( img ) );
+    if( !loader.IsValid() ) return nullptr;
+    loader.SetTargetSize( m_targetWidth, m_targetHeight );
+    auto bmp = loader.Load();
+    if( !bmp ) return nullptr;
+
+    mclog( LogLevel::Info, "Using embedded RAW preview: %ux%u", bmp->Width(), bmp->Height() );
+
+    // The preview usually has no orientation of its own, so the one from the RAW file is applied
+    if( bmp->Orientation() <= 1 )
+    {
+        switch( m_raw->imgdata.sizes.flip )
+        {
+        case 3:
+            bmp->Rotate180();
+            break;
+        case 5:
+            bmp->Rotate270();
+            break;
+        case 6:
+            bmp->Rotate90();
+            break;
+        default:
+            break;
+        }
+    }
+    return bmp;
+}
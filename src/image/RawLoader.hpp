@@ -6,7 +6,7 @@
 #include "util/NoCopy.hpp"
 
 class Bitmap;
-class FileBuffer;
+class DataBuffer;
 class FileWrapper;
 class LibRaw;
 
@@ -14,6 +14,7 @@ class RawLoader : public ImageLoader
 {
 public:
     explicit RawLoader( const std::shared_ptr<FileWrapper>& file );
+    explicit RawLoader( std::shared_ptr<DataBuffer> buf );
     ~RawLoader() override;
 
     NoCopy( RawLoader );
@@ -22,8 +23,10 @@ public:
     [[nodiscard]] std::unique_ptr<Bitmap> Load() override;
 
 private:
+    [[nodiscard]] std::unique_ptr<Bitmap> LoadPreview();
+
     std::unique_ptr<LibRaw> m_raw;
-    std::unique_ptr<FileBuffer> m_buf;
+    std::shared_ptr<DataBuffer> m_buf;
 
     bool m_valid;
 };
@@ -1,3 +1,4 @@
+#include <limits.h>
 #include <string.h>
 
 #define STB_IMAGE_IMPLEMENTATION
@@ -8,16 +9,25 @@
 #include "StbImageLoader.hpp"
 #include "util/Bitmap.hpp"
 #include "util/BitmapHdr.hpp"
+#include "util/FileBuffer.hpp"
 #include "util/FileWrapper.hpp"
 #include "util/Panic.hpp"
 
-StbImageLoader::StbImageLoader( std::shared_ptr<FileWrapper> file )
-    : m_file( std::move( file ) )
+StbImageLoader::StbImageLoader( const std::shared_ptr<FileWrapper>& file )
+    : StbImageLoader( std::make_shared<FileBuffer>( file ) )
 {
-    fseek( *m_file, 0, SEEK_SET );
+}
+
+StbImageLoader::StbImageLoader( std::shared_ptr<DataBuffer> buf )
+    : m_valid( false )
+    , m_hdr( false )
+    , m_buf( std::move( buf ) )
+{
+    if( m_buf->size() > INT_MAX ) return;
+
     int w, h, comp;
-    m_valid = stbi_info_from_file( *m_file, &w, &h, &comp ) == 1;
-    m_hdr = stbi_is_hdr_from_file( *m_file );
+    m_valid = stbi_info_from_memory( (const stbi_uc*)m_buf->data(), m_buf->size(), &w, &h, &comp ) == 1;
+    m_hdr = stbi_is_hdr_from_memory( (const stbi_uc*)m_buf->data(), m_buf->size() );
 }
 
 bool StbImageLoader::IsValid() const
@@ -38,11 +48,10 @@ bool StbImageLoader::PreferHdr()
 std::unique_ptr<Bitmap> StbImageLoader::Load()
 {
     CheckPanic( m_valid, "Invalid stb_image file" );
-
-    fseek( *m_file, 0, SEEK_SET );
+    m_buf->Advise( DataBuffer::Access::Sequential );
 
     int w, h, comp;
-    auto data = stbi_load_from_file( *m_file, &w, &h, &comp, 4 );
+    auto data = stbi_load_from_memory( (const stbi_uc*)m_buf->data(), m_buf->size(), &w, &h, &comp, 4 );
     if( data == nullptr ) return nullptr;
 
     auto bmp = std::make_unique<Bitmap>( w, h );
@@ -55,12 +64,11 @@ std::unique_ptr<Bitmap> StbImageLoader::Load()
 std::unique_ptr<BitmapHdr> StbImageLoader::LoadHdr()
 {
     CheckPanic( m_valid, "Invalid stb_image file" );
+    m_buf->Advise( DataBuffer::Access::Sequential );
     if( !m_hdr ) return nullptr;
 
-    fseek( *m_file, 0, SEEK_SET );
-
     int w, h, comp;
-    auto data = stbi_loadf_from_file( *m_file, &w, &h, &comp, 4 );
+    auto data = stbi_loadf_from_memory( (const stbi_uc*)m_buf->data(), m_buf->size(), &w, &h, &comp, 4 );
     if( data == nullptr ) return nullptr;
 
     auto hdr = std::make_unique<BitmapHdr>( w, h );
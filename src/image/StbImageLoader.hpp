@@ -6,12 +6,14 @@
 #include "util/NoCopy.hpp"
 
 class Bitmap;
+class DataBuffer;
 class FileWrapper;
 
 class StbImageLoader : public ImageLoader
 {
 public:
-    explicit StbImageLoader( std::shared_ptr<FileWrapper> file );
+    explicit StbImageLoader( const std::shared_ptr<FileWrapper>& file );
+    explicit StbImageLoader( std::shared_ptr<DataBuffer> buf );
 
     NoCopy( StbImageLoader );
 
@@ -26,5 +28,5 @@ private:
     bool m_valid;
     bool m_hdr;
 
-    std::shared_ptr<FileWrapper> m_file;
+    std::shared_ptr<DataBuffer> m_buf;
 };
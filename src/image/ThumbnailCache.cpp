@@ -0,0 +1,252 @@
+#include <algorithm>
+#include <filesystem>
+#include <iterator>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "PngLoader.hpp"
+#include "ThumbnailCache.hpp"
+#include "util/Bitmap.hpp"
+#include "util/FileBuffer.hpp"
+#include "util/FileWrapper.hpp"
+#include "util/Home.hpp"
+#include "util/Logs.hpp"
+#include "util/Md5.hpp"
+
+namespace
+{
+struct Flavor
+{
+    const char* dir;
+    uint32_t size;
+};
+
+constexpr Flavor Flavors[] = {
+    { "normal", 128 },
+    { "large", 256 },
+    { "x-large", 512 },
+    { "xx-large", 1024 }
+};
+
+// Same set of characters that GLib leaves unescaped in file URIs, so that the
+// names match the thumbnails made by file managers.
+std::string EscapePath( const std::string& path )
+{
+    static constexpr char Hex[] = "0123456789ABCDEF";
+
+    std::string ret;
+    ret.reserve( path.size() );
+    for( auto c : path )
+    {
+        if( ( c >= 'a' && c <= 'z' ) || ( c >= 'A' && c <= 'Z' ) || ( c >= '0' && c <= '9' ) || strchr( "-._~!$&'()*+,;=:@/", c ) )
+        {
+            ret += c;
+        }
+        else
+        {
+            ret += '%';
+            ret += Hex[(uint8_t)c >> 4];
+            ret += Hex[c & 0xF];
+        }
+    }
+    return ret;
+}
+
+uint32_t ReadBe32( const char* ptr )
+{
+    auto p = (const uint8_t*)ptr;
+    return ( p[0] << 24 ) | ( p[1] << 16 ) | ( p[2] << 8 ) | p[3];
+}
+
+// Walks the PNG chunks and compares the thumbnail attributes stored in tEXt
+// chunks with the original file.
+bool IsValidThumbnail( const DataBuffer& buf, const std::string& uri, const std::string& mtime, const std::string& size )
+{
+    auto data = buf.data();
+    const auto end = buf.size();
+
+    bool uriOk = false;
+    bool mtimeOk = false;
+    size_t pos = 8;
+    while( pos + 12 <= end )
+    {
+        const auto len = ReadBe32( data + pos );
+        if( len > end - pos - 12 ) break;
+
+        auto type = data + pos + 4;
+        if( memcmp( type, "IEND", 4 ) == 0 ) break;
+        if( memcmp( type, "tEXt", 4 ) == 0 )
+        {
+            auto chunk = data + pos + 8;
+            auto sep = (const char*)memchr( chunk, '\0', len );
+            if( sep )
+            {
+                const std::string key( chunk, sep );
+                const std::string value( sep + 1, chunk + len );
+                if( key == "Thumb::URI" )
+                {
+                    if( value != uri ) return false;
+                    uriOk = true;
+                }
+                else if( key == "Thumb::MTime" )
+                {
+                    if( value != mtime ) return false;
+                    mtimeOk = true;
+                }
+                else if( key == "Thumb::Size" )
+                {
+                    if( value != size ) return false;
+                }
+            }
+        }
+        pos += len + 12;
+    }
+
+    return uriOk && mtimeOk;
+}
+}
+
+ThumbnailCache::ThumbnailCache()
+{
+    auto xdg = getenv( "XDG_CACHE_HOME" );
+    if( xdg && xdg[0] == '/' )
+    {
+        m_dir = std::string( xdg ) + "/thumbnails";
+    }
+    else
+    {
+        const auto home = GetHome();
+        if( !home.empty() ) m_dir = home + "/.cache/thumbnails";
+    }
+}
+
+std::unique_ptr<Bitmap> ThumbnailCache::Get( const char* file, uint32_t size, bool fallback ) const
+{
+    FileInfo info;
+    if( !GetFileInfo( file, info ) ) return nullptr;
+
+    auto tryLoad = [this, &info]( const Flavor& flavor ) -> std::unique_ptr<Bitmap> {
+        const auto path = m_dir + "/" + flavor.dir + "/" + info.hash + ".png";
+        auto fw = std::make_shared<FileWrapper>( path.c_str(), "rb" );
+        if( !*fw ) return nullptr;
+
+        auto buf = std::make_shared<FileBuffer>( fw );
+        PngLoader loader( buf );
+        if( !loader.IsValid() || !IsValidThumbnail( *buf, info.uri, info.mtime, info.size ) )
+        {
+            mclog( LogLevel::Debug, "Stale thumbnail %s", path.c_str() );
+            return nullptr;
+        }
+
+        auto bitmap = loader.Load();
+        if( bitmap ) mclog( LogLevel::Info, "Thumbnail found: %s (%ux%u)", path.c_str(), bitmap->Width(), bitmap->Height() );
+        return bitmap;
+    };
+
+    for( auto& flavor : Flavors )
+    {
+        if( flavor.size < size ) continue;
+        if( auto bitmap = tryLoad( flavor ) ) return bitmap;
+    }
+    if( fallback )
+    {
+        for( auto it = std::rbegin( Flavors ); it != std::rend( Flavors ); ++it )
+        {
+            if( it->size >= size ) continue;
+            if( auto bitmap = tryLoad( *it ) ) return bitmap;
+        }
+    }
+    return nullptr;
+}
+
+bool ThumbnailCache::Contains( const char* file, uint32_t size, bool fallback ) const
+{
+    FileInfo info;
+    if( !GetFileInfo( file, info ) ) return false;
+
+    struct stat st;
+    for( auto& flavor : Flavors )
+    {
+        if( flavor.size < size && !fallback ) continue;
+        const auto path = m_dir + "/" + flavor.dir + "/" + info.hash + ".png";
+        if( stat( path.c_str(), &st ) == 0 ) return true;
+    }
+    return false;
+}
+
+void ThumbnailCache::Put( const char* file, const Bitmap& bitmap, uint32_t size ) const
+{
+    const Flavor* flavor = nullptr;
+    for( auto& f : Flavors )
+    {
+        if( f.size == size ) flavor = &f;
+    }
+    if( !flavor ) return;
+
+    FileInfo info;
+    if( !GetFileInfo( file, info ) ) return;
+
+    const auto dir = m_dir + "/" + flavor->dir;
+    std::error_code ec;
+    if( !std::filesystem::is_directory( dir, ec ) )
+    {
+        if( !std::filesystem::create_directories( dir, ec ) ) return;
+        std::filesystem::permissions( m_dir, std::filesystem::perms::owner_all, ec );
+        std::filesystem::permissions( dir, std::filesystem::perms::owner_all, ec );
+    }
+
+    // Thumbnails are only scaled down, smaller images are stored in their original size
+    const auto w = bitmap.Width();
+    const auto h = bitmap.Height();
+    const auto ratio = std::min( 1.f, float( size ) / std::max( w, h ) );
+    auto thumb = bitmap.ResizeNew( std::max( 1u, uint32_t( w * ratio ) ), std::max( 1u, uint32_t( h * ratio ) ) );
+
+    // The standard requires the thumbnail to be written to a temporary file, which is then renamed
+    const auto path = dir + "/" + info.hash + ".png";
+    auto tmp = path + ".XXXXXX";
+    int fd = mkstemp( tmp.data() );
+    if( fd < 0 ) return;
+    fchmod( fd, 0600 );
+    close( fd );
+
+    thumb->SavePng( tmp.c_str(), {
+        { "Thumb::URI", info.uri },
+        { "Thumb::MTime", info.mtime },
+        { "Thumb::Size", info.size },
+        { "Software", "vv" }
+    } );
+
+    if( rename( tmp.c_str(), path.c_str() ) != 0 ) unlink( tmp.c_str() );
+}
+
+uint32_t ThumbnailCache::GetSize( uint32_t size )
+{
+    for( auto& flavor : Flavors )
+    {
+        if( flavor.size >= size ) return flavor.size;
+    }
+    return std::rbegin( Flavors )->size;
+}
+
+bool ThumbnailCache::GetFileInfo( const char* file, FileInfo& info ) const
+{
+    if( m_dir.empty() || strcmp( file, "-" ) == 0 ) return false;
+
+    struct stat st;
+    if( stat( file, &st ) != 0 || !S_ISREG( st.st_mode ) ) return false;
+
+    std::error_code ec;
+    const auto path = std::filesystem::canonical( file, ec ).string();
+    if( ec ) return false;
+
+    // Thumbnails of the thumbnails are not made
+    if( path.starts_with( m_dir + "/" ) ) return false;
+
+    info.uri = "file://" + EscapePath( path );
+    info.hash = Md5Hex( info.uri );
+    info.mtime = std::to_string( st.st_mtim.tv_sec );
+    info.size = std::to_string( st.st_size );
+    return true;
+}
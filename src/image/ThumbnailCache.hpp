@@ -0,0 +1,50 @@
+#pragma once
+
+#include <memory>
+#include <stdint.h>
+#include <string>
+
+#include "util/NoCopy.hpp"
+
+class Bitmap;
+
+// Shared thumbnail cache of desktop file managers, as described in the
+// freedesktop.org thumbnail managing standard. Thumbnails are stored as PNG
+// files named after the MD5 of the file URI, in directories for the 128, 256,
+// 512 and 1024 pixel sizes. A thumbnail is valid only if the URI and the
+// modification time stored in it match the original file.
+class ThumbnailCache
+{
+public:
+    ThumbnailCache();
+
+    NoCopy( ThumbnailCache );
+
+    // Returns a valid thumbnail of at least the given size. With fallback the
+    // largest smaller thumbnail is returned if there is no large enough one.
+    [[nodiscard]] std::unique_ptr<Bitmap> Get( const char* file, uint32_t size, bool fallback ) const;
+
+    // Checks if Get() would find a thumbnail file, without reading it. The
+    // thumbnail is not validated, so Get() may still fail.
+    [[nodiscard]] bool Contains( const char* file, uint32_t size, bool fallback ) const;
+
+    // Stores a thumbnail of the given size, made from a bitmap of the file.
+    void Put( const char* file, const Bitmap& bitmap, uint32_t size ) const;
+
+    // Returns the smallest thumbnail size that covers the given size, or the
+    // largest thumbnail size if there is none.
+    [[nodiscard]] static uint32_t GetSize( uint32_t size );
+
+private:
+    struct FileInfo
+    {
+        std::string uri;
+        std::string hash;
+        std::string mtime;
+        std::string size;
+    };
+
+    [[nodiscard]] bool GetFileInfo( const char* file, FileInfo& info ) const;
+
+    std::string m_dir;
+};
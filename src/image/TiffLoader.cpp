@@ -1,22 +1,57 @@
+#include <algorithm>
+#include <stdio.h>
 #include <string.h>
 #include <tiffio.h>
 
 #include "TiffLoader.hpp"
 #include "util/Bitmap.hpp"
+#include "util/FileBuffer.hpp"
 #include "util/FileWrapper.hpp"
 
-TiffLoader::TiffLoader( std::shared_ptr<FileWrapper> file )
-    : m_file( std::move( file ) )
+TiffLoader::TiffLoader( const std::shared_ptr<FileWrapper>& file )
+    : TiffLoader( std::make_shared<FileBuffer>( file ) )
+{
+}
+
+TiffLoader::TiffLoader( std::shared_ptr<DataBuffer> buf )
+    : m_buf( std::move( buf ) )
+    , m_pos( 0 )
     , m_tiff( nullptr )
 {
-    fseek( *m_file, 0, SEEK_SET );
-    uint8_t hdr[4];
-    if( fread( hdr, 1, 4, *m_file ) == 4 && ( memcmp( hdr, "II*\0", 4 ) == 0 || memcmp( hdr, "MM\0*", 4 ) == 0 ) )
-    {
-        fseek( *m_file, 0, SEEK_SET );
-        fflush( *m_file );
-        m_tiff = TIFFFdOpen( fileno( *m_file ), "<unknown>", "r" );
-    }
+    const auto hdr = m_buf->data();
+    if( m_buf->size() < 4 || ( memcmp( hdr, "II*\0", 4 ) != 0 && memcmp( hdr, "MM\0*", 4 ) != 0 ) ) return;
+
+    // The buffer is also exposed as a memory mapping, so strips are read without copying
+    m_tiff = TIFFClientOpen( "<memory>", "r", this,
+        []( thandle_t h, void* ptr, tmsize_t size ) -> tmsize_t {
+            auto self = (TiffLoader*)h;
+            if( self->m_pos >= self->m_buf->size() ) return 0;
+            const auto sz = std::min<uint64_t>( size, self->m_buf->size() - self->m_pos );
+            memcpy( ptr, self->m_buf->data() + self->m_pos, sz );
+            self->m_pos += sz;
+            return sz;
+        },
+        []( thandle_t, void*, tmsize_t ) -> tmsize_t { return 0; },
+        []( thandle_t h, toff_t off, int whence ) -> toff_t {
+            auto self = (TiffLoader*)h;
+            switch( whence )
+            {
+            case SEEK_SET: self->m_pos = off; break;
+            case SEEK_CUR: self->m_pos += off; break;
+            case SEEK_END: self->m_pos = self->m_buf->size() + off; break;
+            default: break;
+            }
+            return self->m_pos;
+        },
+        []( thandle_t ) { return 0; },
+        []( thandle_t h ) -> toff_t { return ((TiffLoader*)h)->m_buf->size(); },
+        []( thandle_t h, void** base, toff_t* size ) {
+            auto self = (TiffLoader*)h;
+            *base = (void*)self->m_buf->data();
+            *size = self->m_buf->size();
+            return 1;
+        },
+        []( thandle_t, void*, toff_t ) {} );
 }
 
 TiffLoader::~TiffLoader()
@@ -31,6 +66,8 @@ bool TiffLoader::IsValid() const
 
 std::unique_ptr<Bitmap> TiffLoader::Load()
 {
+    m_buf->Advise( DataBuffer::Access::Sequential );
+
     uint32_t width, height;
     TIFFGetField( m_tiff, TIFFTAG_IMAGEWIDTH, &width );
     TIFFGetField( m_tiff, TIFFTAG_IMAGELENGTH, &height );
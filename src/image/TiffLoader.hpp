@@ -1,18 +1,21 @@
 #pragma once
 
 #include <memory>
+#include <stdint.h>
 
 #include "ImageLoader.hpp"
 #include "util/NoCopy.hpp"
 
 class Bitmap;
+class DataBuffer;
 class FileWrapper;
 struct tiff;
 
 class TiffLoader : public ImageLoader
 {
 public:
-    explicit TiffLoader( std::shared_ptr<FileWrapper> file );
+    explicit TiffLoader( const std::shared_ptr<FileWrapper>& file );
+    explicit TiffLoader( std::shared_ptr<DataBuffer> buf );
     ~TiffLoader() override;
 
     NoCopy( TiffLoader );
@@ -21,6 +24,7 @@ public:
     [[nodiscard]] std::unique_ptr<Bitmap> Load() override;
 
 private:
-    std::shared_ptr<FileWrapper> m_file;
+    std::shared_ptr<DataBuffer> m_buf;
+    uint64_t m_pos;
     struct tiff* m_tiff;
 };
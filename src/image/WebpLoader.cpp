@@ -8,13 +8,17 @@
 #include "util/FileWrapper.hpp"
 #include "util/Panic.hpp"
 
-WebpLoader::WebpLoader( std::shared_ptr<FileWrapper> file )
-    : m_file( std::move( file ) )
+WebpLoader::WebpLoader( const std::shared_ptr<FileWrapper>& file )
+    : WebpLoader( std::make_shared<FileBuffer>( file ) )
+{
+}
+
+WebpLoader::WebpLoader( std::shared_ptr<DataBuffer> buf )
+    : m_buf( std::move( buf ) )
     , m_dec( nullptr )
 {
-    fseek( *m_file, 0, SEEK_SET );
-    uint8_t hdr[12];
-    m_valid = fread( hdr, 1, 12, *m_file ) == 12 && memcmp( hdr, "RIFF", 4 ) == 0 && memcmp( hdr + 8, "WEBP", 4 ) == 0;
+    const auto hdr = m_buf->data();
+    m_valid = m_buf->size() >= 12 && memcmp( hdr, "RIFF", 4 ) == 0 && memcmp( hdr + 8, "WEBP", 4 ) == 0;
 }
 
 WebpLoader::~WebpLoader()
@@ -83,9 +87,8 @@ std::unique_ptr<BitmapAnim> WebpLoader::LoadAnim()
 bool WebpLoader::Open()
 {
     CheckPanic( m_valid, "Invalid WebP file" );
-    CheckPanic( !m_buf && !m_dec, "Already opened" );
-
-    m_buf = std::make_unique<FileBuffer>( m_file );
+    CheckPanic( !m_dec, "Already opened" );
+    m_buf->Advise( DataBuffer::Access::Sequential );
 
     WebPData data = {
         .bytes = (const uint8_t*)m_buf->data(),
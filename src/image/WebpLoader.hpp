@@ -7,7 +7,7 @@
 #include "util/NoCopy.hpp"
 
 class Bitmap;
-class FileBuffer;
+class DataBuffer;
 class FileWrapper;
 
 typedef struct WebPAnimDecoder WebPAnimDecoder;
@@ -15,7 +15,8 @@ typedef struct WebPAnimDecoder WebPAnimDecoder;
 class WebpLoader : public ImageLoader
 {
 public:
-    explicit WebpLoader( std::shared_ptr<FileWrapper> file );
+    explicit WebpLoader( const std::shared_ptr<FileWrapper>& file );
+    explicit WebpLoader( std::shared_ptr<DataBuffer> buf );
     ~WebpLoader() override;
 
     NoCopy( WebpLoader );
@@ -31,7 +32,6 @@ private:
 
     bool m_valid;
 
-    std::shared_ptr<FileWrapper> m_file;
-    std::unique_ptr<FileBuffer> m_buf;
+    std::shared_ptr<DataBuffer> m_buf;
     WebPAnimDecoder* m_dec;
 };
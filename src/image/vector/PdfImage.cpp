@@ -1,19 +1,23 @@
 #include <cairo.h>
 #include <dlfcn.h>
 #include <glib-object.h>
+#include <limits.h>
 #include <stdint.h>
 #include <string.h>
 
 #include "PdfImage.hpp"
 #include "util/Bitmap.hpp"
+#include "util/DataBuffer.hpp"
 #include "util/Panic.hpp"
 
 typedef void*(*LoadPdf_t)( int, const char*, GError** );
+typedef void*(*LoadPdfData_t)( char*, int, const char*, GError** );
 typedef void*(*GetPage_t)( void*, int );
 typedef void(*GetPageSize_t)( void*, double*, double* );
 typedef void(*RenderPage_t)( void*, cairo_t* );
 
 LoadPdf_t LoadPdf = nullptr;
+LoadPdfData_t LoadPdfData = nullptr;
 GetPage_t GetPage = nullptr;
 GetPageSize_t GetPageSize = nullptr;
 RenderPage_t RenderPage = nullptr;
@@ -26,13 +30,15 @@ struct PdfLibraryLoader
         if( lib )
         {
             auto LoadPdf_f = (LoadPdf_t)dlsym( lib, "poppler_document_new_from_fd" );
+            auto LoadPdfData_f = (LoadPdfData_t)dlsym( lib, "poppler_document_new_from_data" );
             auto GetPage_f = (GetPage_t)dlsym( lib, "poppler_document_get_page" );
             auto GetPageSize_f = (GetPageSize_t)dlsym( lib, "poppler_page_get_size" );
             auto RenderPage_f = (RenderPage_t)dlsym( lib, "poppler_page_render_for_printing" );
 
-            if( LoadPdf_f && GetPage_f && GetPageSize_f && RenderPage_f )
+            if( LoadPdf_f && LoadPdfData_f && GetPage_f && GetPageSize_f && RenderPage_f )
             {
                 LoadPdf = LoadPdf_f;
+                LoadPdfData = LoadPdfData_f;
                 GetPage = GetPage_f;
                 GetPageSize = GetPageSize_f;
                 RenderPage = RenderPage_f;
@@ -60,20 +66,41 @@ PdfImage::PdfImage( FileWrapper& file )
             if( m_pdf )
             {
                 file.Release();
-
-                m_page = GetPage( m_pdf, 0 );
-                CheckPanic( m_page, "Failed to load PDF page" );
-
-                double w, h;
-                GetPageSize( m_page, &w, &h );
-
-                m_width = w;
-                m_height = h;
+                Open();
             }
         }
     }
 }
 
+PdfImage::PdfImage( std::shared_ptr<DataBuffer> buf )
+    : m_buf( std::move( buf ) )
+    , m_pdf( nullptr )
+    , m_page( nullptr )
+{
+    if( m_buf->size() >= 5 && m_buf->size() <= INT_MAX && memcmp( m_buf->data(), "%PDF-", 5 ) == 0 )
+    {
+        static PdfLibraryLoader loader;
+        if( LoadPdfData )
+        {
+            // Poppler doesn't copy the data, so the buffer is kept alive for the lifetime of the document
+            m_pdf = LoadPdfData( (char*)m_buf->data(), int( m_buf->size() ), nullptr, nullptr );
+            if( m_pdf ) Open();
+        }
+    }
+}
+
+void PdfImage::Open()
+{
+    m_page = GetPage( m_pdf, 0 );
+    CheckPanic( m_page, "Failed to load PDF page" );
+
+    double w, h;
+    GetPageSize( m_page, &w, &h );
+
+    m_width = w;
+    m_height = h;
+}
+
 PdfImage::~PdfImage()
 {
     if( m_page ) g_object_unref( m_page );
@@ -1,12 +1,17 @@
 #pragma once
 
+#include <memory>
+
 #include "util/FileWrapper.hpp"
 #include "util/VectorImage.hpp"
 
+class DataBuffer;
+
 class PdfImage : public VectorImage
 {
 public:
     explicit PdfImage( FileWrapper& file );
+    explicit PdfImage( std::shared_ptr<DataBuffer> buf );
     ~PdfImage() override;
 
     NoCopy( PdfImage );
@@ -19,6 +24,10 @@ public:
     [[nodiscard]] std::unique_ptr<Bitmap> Rasterize( int width, int height ) const override;
 
 private:
+    void Open();
+
+    std::shared_ptr<DataBuffer> m_buf;
+
     void* m_pdf;
     void* m_page;
 
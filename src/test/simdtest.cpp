@@ -0,0 +1,315 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <memory>
+#include <random>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <ImfCompression.h>
+#include <ImfHeader.h>
+#include <ImfRgbaFile.h>
+#include <ImfStdIO.h>
+#include <ImfThreading.h>
+
+#include "image/BcDecode.hpp"
+#include "image/BlockDecode.hpp"
+#include "image/EtcDecode.hpp"
+#include "image/ExrLoader.hpp"
+#include "util/BitmapHdr.hpp"
+#include "util/DataBuffer.hpp"
+#include "util/Logs.hpp"
+#include "util/TaskDispatch.hpp"
+#include "util/Tonemapper.hpp"
+
+// Builds of the same sources without SIMD extensions, see CMakeLists.txt
+void ScalarDecodeBc1( uint32_t* dst, const uint64_t* src, uint32_t width, uint32_t height );
+void ScalarDecodeBc3( uint32_t* dst, const uint64_t* src, uint32_t width, uint32_t height );
+void ScalarDecodeBc4( uint32_t* dst, const uint64_t* src, uint32_t width, uint32_t height );
+void ScalarDecodeBc5( uint32_t* dst, const uint64_t* src, uint32_t width, uint32_t height );
+void ScalarDecodeEtc2Rgb( uint32_t* dst, const uint64_t* src, uint32_t width, uint32_t height );
+void ScalarDecodeEtc2Rgba( uint32_t* dst, const uint64_t* src, uint32_t width, uint32_t height );
+void ScalarDecodeEacR( uint32_t* dst, const uint64_t* src, uint32_t width, uint32_t height );
+void ScalarDecodeEacRg( uint32_t* dst, const uint64_t* src, uint32_t width, uint32_t height );
+
+namespace ToneMap
+{
+void ScalarAgX( uint32_t* dst, float* src, size_t sz );
+void ScalarAgXGolden( uint32_t* dst, float* src, size_t sz );
+void ScalarAgXPunchy( uint32_t* dst, float* src, size_t sz );
+void ScalarPbrNeutral( uint32_t* dst, float* src, size_t sz );
+}
+
+namespace {
+using DecodeFn = void(*)( uint32_t*, const uint64_t*, uint32_t, uint32_t );
+
+struct Decoder
+{
+    const char* name;
+    DecodeFn simd;
+    DecodeFn scalar;
+    uint32_t blockSize;
+};
+
+// The width covers the 8-block, 4-block and single block loops of the decoders
+constexpr uint32_t Width = 4 * 31;
+constexpr uint32_t Height = 4 * 16;
+constexpr int Iterations = 64;
+
+bool TestDecoder( const Decoder& dec, std::mt19937_64& rng )
+{
+    const auto blocks = Width / 4 * Height / 4 * dec.blockSize;
+    std::vector<uint64_t> src( blocks );
+    std::vector<uint32_t> simd( Width * Height );
+    std::vector<uint32_t> scalar( Width * Height );
+
+    for( int i=0; i<Iterations; i++ )
+    {
+        for( auto& v : src ) v = rng();
+
+        dec.simd( simd.data(), src.data(), Width, Height );
+        dec.scalar( scalar.data(), src.data(), Width, Height );
+
+        for( uint32_t j=0; j<Width*Height; j++ )
+        {
+            if( simd[j] != scalar[j] )
+            {
+                const auto x = j % Width;
+                const auto y = j / Width;
+                const auto block = ( y / 4 * ( Width / 4 ) + x / 4 ) * dec.blockSize;
+                printf( "%s: mismatch at %u, %u: %08x != %08x (block", dec.name, x, y, simd[j], scalar[j] );
+                for( uint32_t k=0; k<dec.blockSize; k++ ) printf( " %016llx", (unsigned long long)src[block+k] );
+                printf( ")\n" );
+                return false;
+            }
+        }
+    }
+
+    printf( "%s: ok\n", dec.name );
+    return true;
+}
+
+using ToneMapFn = void(*)( uint32_t*, float*, size_t );
+
+struct ToneMapper
+{
+    const char* name;
+    ToneMapFn simd;
+    ToneMapFn scalar;
+};
+
+// The SIMD paths use polynomial approximations of log and pow, and round alpha
+// instead of truncating it, so the 8-bit results may differ from the scalar
+// reference by one step.
+constexpr int MaxToneMapError = 1;
+
+// Exposures from deep shadows to well above the white point, with some zero,
+// negative and out of range values mixed in.
+std::vector<float> GetHdrPixels( size_t count, std::mt19937_64& rng )
+{
+    std::uniform_real_distribution<float> ev( -16.f, 8.f );
+    std::uniform_real_distribution<float> alpha( -0.1f, 1.1f );
+    std::uniform_int_distribution<int> special( 0, 63 );
+
+    std::vector<float> ret( count * 4 );
+    for( size_t i=0; i<count; i++ )
+    {
+        for( int c=0; c<3; c++ )
+        {
+            switch( special( rng ) )
+            {
+            case 0: ret[i*4+c] = 0; break;
+            case 1: ret[i*4+c] = -std::exp2( ev( rng ) ); break;
+            default: ret[i*4+c] = std::exp2( ev( rng ) ); break;
+            }
+        }
+        ret[i*4+3] = alpha( rng );
+    }
+    return ret;
+}
+
+bool TestToneMapper( const ToneMapper& tm, std::mt19937_64& rng )
+{
+    // Odd count to go through the remainder loops
+    constexpr size_t Count = 256 * 1024 + 7;
+
+    auto src = GetHdrPixels( Count, rng );
+    std::vector<uint32_t> simd( Count );
+    std::vector<uint32_t> scalar( Count );
+
+    tm.simd( simd.data(), src.data(), Count );
+    tm.scalar( scalar.data(), src.data(), Count );
+
+    int maxError = 0;
+    size_t errors = 0;
+    for( size_t i=0; i<Count; i++ )
+    {
+        if( simd[i] == scalar[i] ) continue;
+        errors++;
+        for( int c=0; c<4; c++ )
+        {
+            const int a = ( simd[i] >> ( c * 8 ) ) & 0xFF;
+            const int b = ( scalar[i] >> ( c * 8 ) ) & 0xFF;
+            const auto err = std::abs( a - b );
+            if( err > maxError )
+            {
+                maxError = err;
+                if( err > MaxToneMapError )
+                {
+                    printf( "%s: mismatch at %zu: %08x != %08x (input %g %g %g %g)\n", tm.name, i, simd[i], scalar[i], src[i*4], src[i*4+1], src[i*4+2], src[i*4+3] );
+                }
+            }
+        }
+    }
+
+    printf( "%s: %s, %zu of %zu pixels differ, max error %d\n", tm.name, maxError > MaxToneMapError ? "failed" : "ok", errors, Count, maxError );
+    return maxError <= MaxToneMapError;
+}
+
+// Best of several runs of fn, which processes count pixels, in Mpix/s
+template<typename F>
+double Measure( size_t count, F&& fn )
+{
+    constexpr int Runs = 5;
+
+    double best = 0;
+    for( int i=0; i<Runs; i++ )
+    {
+        const auto t0 = std::chrono::steady_clock::now();
+        fn();
+        const auto t1 = std::chrono::steady_clock::now();
+        const auto mpix = count / std::chrono::duration<double, std::micro>( t1 - t0 ).count();
+        best = std::max( best, mpix );
+    }
+    return best;
+}
+
+void Benchmark( const ToneMapper& tm, std::mt19937_64& rng )
+{
+    constexpr size_t Count = 4 * 1024 * 1024;
+
+    auto src = GetHdrPixels( Count, rng );
+    std::vector<uint32_t> dst( Count );
+
+    const auto simd = Measure( Count, [&] { tm.simd( dst.data(), src.data(), Count ); } );
+    const auto scalar = Measure( Count, [&] { tm.scalar( dst.data(), src.data(), Count ); } );
+    printf( "%-12s SIMD %8.1f Mpix/s, scalar %8.1f Mpix/s, %.1fx\n", tm.name, simd, scalar, simd / scalar );
+}
+
+// Whole textures are decoded through DecodeBlocks, as in the DDS, KTX and PVR
+// loaders, on a single thread and on the worker pool.
+void BenchmarkTexture( const Decoder& dec, uint32_t size, TaskDispatch& td, std::mt19937_64& rng )
+{
+    const auto count = size_t( size ) * size;
+
+    std::vector<uint64_t> src( count / 16 * dec.blockSize );
+    for( auto& v : src ) v = rng();
+    std::vector<uint32_t> dst( count );
+
+    const auto single = Measure( count, [&] { DecodeBlocks( dec.simd, dst.data(), src.data(), size, size, dec.blockSize, nullptr ); } );
+    const auto parallel = Measure( count, [&] { DecodeBlocks( dec.simd, dst.data(), src.data(), size, size, dec.blockSize, &td ); } );
+    printf( "%-12s %uK  1 thread %8.1f Mpix/s, %zu threads %8.1f Mpix/s, %.1fx\n", dec.name, size / 1024, single, td.NumWorkers() + 1, parallel, parallel / single );
+}
+
+// Smooth gradients with some noise, which compress roughly like rendered images
+std::string MakeExr( Imf::Compression compression, int width, int height, std::mt19937_64& rng )
+{
+    std::normal_distribution<float> noise( 0.f, 0.02f );
+
+    std::vector<Imf::Rgba> pixels( size_t( width ) * height );
+    for( int y=0; y<height; y++ )
+    {
+        for( int x=0; x<width; x++ )
+        {
+            const auto u = float( x ) / width;
+            const auto v = float( y ) / height;
+            auto& px = pixels[size_t( y ) * width + x];
+            px.r = std::max( 0.f, 4.f * u * v + noise( rng ) );
+            px.g = std::max( 0.f, 2.f * ( 1.f - u ) * v + noise( rng ) );
+            px.b = std::max( 0.f, 0.5f + 0.5f * std::sin( u * 20.f ) * std::cos( v * 12.f ) + noise( rng ) );
+            px.a = 1.f;
+        }
+    }
+
+    Imf::Header header( width, height );
+    header.compression() = compression;
+
+    Imf::StdOSStream stream;
+    Imf::RgbaOutputFile file( stream, header, Imf::WRITE_RGBA );
+    file.setFrameBuffer( pixels.data(), 1, width );
+    file.writePixels( height );
+    return stream.str();
+}
+
+// Full EXR loads through ExrLoader, with OpenEXR decompressing on the calling
+// thread only, and on a thread pool sized to the TaskDispatch workers.
+void BenchmarkExr( const char* name, Imf::Compression compression, TaskDispatch& td, std::mt19937_64& rng )
+{
+    constexpr int Width = 3840;
+    constexpr int Height = 2160;
+    constexpr size_t Count = size_t( Width ) * Height;
+
+    const auto data = MakeExr( compression, Width, Height, rng );
+    auto buf = std::make_shared<DataBuffer>( data.data(), data.size() );
+
+    auto load = [&buf]( TaskDispatch* td ) {
+        ExrLoader loader( buf, ToneMap::Operator::PbrNeutral, td );
+        if( !loader.IsValid() || !loader.LoadHdr() ) abort();
+    };
+
+    Imf::setGlobalThreadCount( 0 );
+    const auto single = Measure( Count, [&] { load( nullptr ); } );
+    const auto parallel = Measure( Count, [&] { load( &td ); } );
+    printf( "EXR %-8s %5.1f MB  1 thread %8.1f Mpix/s, %zu threads %8.1f Mpix/s, %.1fx\n", name, data.size() / ( 1024. * 1024. ), single, td.NumWorkers(), parallel, parallel / single );
+}
+}
+
+int main( int argc, char** argv )
+{
+    static constexpr ToneMapper toneMappers[] = {
+        { "AgX", ToneMap::AgX, ToneMap::ScalarAgX },
+        { "AgX Golden", ToneMap::AgXGolden, ToneMap::ScalarAgXGolden },
+        { "AgX Punchy", ToneMap::AgXPunchy, ToneMap::ScalarAgXPunchy },
+        { "PBR Neutral", ToneMap::PbrNeutral, ToneMap::ScalarPbrNeutral },
+    };
+
+    static constexpr Decoder decoders[] = {
+        { "BC1", DecodeBc1, ScalarDecodeBc1, 1 },
+        { "BC3", DecodeBc3, ScalarDecodeBc3, 2 },
+        { "BC4", DecodeBc4, ScalarDecodeBc4, 1 },
+        { "BC5", DecodeBc5, ScalarDecodeBc5, 2 },
+        { "ETC2 RGB", DecodeEtc2Rgb, ScalarDecodeEtc2Rgb, 1 },
+        { "ETC2 RGBA", DecodeEtc2Rgba, ScalarDecodeEtc2Rgba, 2 },
+        { "EAC R", DecodeEacR, ScalarDecodeEacR, 1 },
+        { "EAC RG", DecodeEacRg, ScalarDecodeEacRg, 2 },
+    };
+
+    std::mt19937_64 rng( 0x5EED );
+
+    if( argc > 1 && strcmp( argv[1], "--bench" ) == 0 )
+    {
+        for( auto& tm : toneMappers ) Benchmark( tm, rng );
+
+        SetLogLevel( LogLevel::Error );
+        TaskDispatch td( std::max( 1u, std::thread::hardware_concurrency() - 1 ), "Worker" );
+        for( auto size : { 4096u, 8192u } )
+        {
+            for( auto& dec : decoders ) BenchmarkTexture( dec, size, td, rng );
+        }
+
+        BenchmarkExr( "ZIP", Imf::ZIP_COMPRESSION, td, rng );
+        BenchmarkExr( "PIZ", Imf::PIZ_COMPRESSION, td, rng );
+        BenchmarkExr( "DWAA", Imf::DWAA_COMPRESSION, td, rng );
+        return 0;
+    }
+
+    bool ok = true;
+    for( auto& dec : decoders ) ok &= TestDecoder( dec, rng );
+    for( auto& tm : toneMappers ) ok &= TestToneMapper( tm, rng );
+    return ok ? 0 : 1;
+}
@@ -1,24 +1,36 @@
 #include <algorithm>
+#include <condition_variable>
+#include <filesystem>
 #include <libbase64.h>
+#include <math.h>
 #include <format>
+#include <functional>
 #include <getopt.h>
 #include <memory>
+#include <mutex>
+#include <string>
 #include <thread>
 #include <sixel.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/ioctl.h>
+#include <sys/stat.h>
 #include <unistd.h>
+#include <unordered_set>
 #include <vector>
 #include <zlib.h>
 
 #include "Terminal.hpp"
 #include "image/ImageLoader.hpp"
+#include "image/ThumbnailCache.hpp"
 #include "util/Bitmap.hpp"
 #include "util/BitmapAnim.hpp"
+#include "util/BitmapCache.hpp"
 #include "util/BitmapHdr.hpp"
 #include "util/Callstack.hpp"
+#include "util/DataBuffer.hpp"
+#include "util/FilePrefetcher.hpp"
 #include "util/Logs.hpp"
 #include "util/Panic.hpp"
 #include "util/TaskDispatch.hpp"
@@ -28,7 +40,8 @@
 namespace {
 void PrintHelp()
 {
-    printf( "Usage: vv [options] <image>\n" );
+    printf( "Usage: vv [options] <image> [image...]\n" );
+    printf( "Use - as the image name to read from standard input.\n\n" );
     printf( "Options:\n" );
     printf( "  -b, --block                  Use text-only block mode\n" );
     printf( "  -6, --sixel                  Use sixel graphics mode\n" );
@@ -37,8 +50,12 @@ void PrintHelp()
     printf( "  -G, --background [color]     Set background color to RRGGBB in hex\n" );
     printf( "  -g, --checkerboard           Use checkerboard background\n" );
     printf( "  -A, --noanim                 Disable animation\n" );
-    printf( "  -w, --write [file.png]       Write output to file\n" );
+    printf( "  -w, --write [file.png]       Write output to file, or to a directory for many images\n" );
     printf( "  -t, --tonemap [operator]     Choose HDR tone mapping operator\n" );
+    printf( "  --grid                       Show all images as a thumbnail grid\n" );
+    printf( "  --nocache                    Do not use the display cache\n" );
+    printf( "  --fast                       Show cached thumbnails instead of decoding images\n" );
+    printf( "  --savethumb                  With --fast or --grid, store new thumbnails\n" );
     printf( "  --help                       Print this help\n" );
     printf( "\nTone mapping operators:\n" );
     printf( "  pbr (default)\n" );
@@ -54,7 +71,7 @@ enum class ScaleMode
     Scale2x,
 };
 
-void AdjustBitmap( std::unique_ptr<Bitmap>& bitmap, std::unique_ptr<BitmapAnim>& anim, const std::unique_ptr<VectorImage>& vector, uint32_t col, uint32_t row, ScaleMode scale )
+void AdjustBitmap( std::unique_ptr<Bitmap>& bitmap, std::unique_ptr<BitmapAnim>& anim, std::unique_ptr<BitmapHdr>& hdr, const std::unique_ptr<VectorImage>& vector, uint32_t col, uint32_t row, ScaleMode scale, ToneMap::Operator tonemap, TaskDispatch* td )
 {
     if( anim )
     {
@@ -76,6 +93,27 @@ void AdjustBitmap( std::unique_ptr<Bitmap>& bitmap, std::unique_ptr<BitmapAnim>&
             mclog( LogLevel::Info, "Animation upscaled: %ux%u", w * 2, h * 2 );
         }
     }
+    else if( hdr )
+    {
+        const auto w = hdr->Width();
+        const auto h = hdr->Height();
+
+        // Resample in linear light and tone map only the pixels that will be displayed
+        if( scale == ScaleMode::Fit || w > col || h > row )
+        {
+            const auto ratio = std::min( float( col ) / w, float( row ) / h );
+            hdr = hdr->ResizeNew( std::max( 1u, uint32_t( w * ratio ) ), std::max( 1u, uint32_t( h * ratio ) ) );
+            mclog( LogLevel::Info, "HDR image resized: %ux%u", hdr->Width(), hdr->Height() );
+        }
+        else if( scale == ScaleMode::Scale2x && w * 2 <= col && h * 2 <= row )
+        {
+            hdr = hdr->ResizeNew( w * 2, h * 2 );
+            mclog( LogLevel::Info, "HDR image upscaled: %ux%u", hdr->Width(), hdr->Height() );
+        }
+
+        bitmap = hdr->Tonemap( tonemap, td );
+        hdr.reset();
+    }
     else if( bitmap )
     {
         bitmap->NormalizeOrientation();
@@ -337,189 +375,107 @@ bool UploadKittyImage( Bitmap& bitmap, const char* queryPart, bool anim = false
 
     return true;
 }
-}
 
-int main( int argc, char** argv )
+enum class GfxMode
 {
-#ifdef NDEBUG
-    SetLogLevel( LogLevel::Error );
-#endif
-
-    enum { OptHelp };
+    Kitty,
+    Sixel,
+    Block,
+    WriteFile
+};
 
-    struct option longOptions[] = {
-        { "debug", no_argument, nullptr, 'd' },
-        { "external", no_argument, nullptr, 'e' },
-        { "block", no_argument, nullptr, 'b' },
-        { "scale", no_argument, nullptr, 's' },
-        { "fit", no_argument, nullptr, 'f' },
-        { "sixel", no_argument, nullptr, '6' },
-        { "background", required_argument, nullptr, 'G' },
-        { "checkerboard", no_argument, nullptr, 'g' },
-        { "noanim", no_argument, nullptr, 'A' },
-        { "write", required_argument, nullptr, 'w' },
-        { "tonemap", required_argument, nullptr, 't' },
-        { "help", no_argument, nullptr, OptHelp },
-        {}
-    };
+struct Image
+{
+    std::unique_ptr<Bitmap> bitmap;
+    std::unique_ptr<BitmapAnim> anim;
+    std::unique_ptr<BitmapHdr> hdr;
+    std::unique_ptr<VectorImage> vectorImage;
+    bool thumbnail = false;
 
-    enum class GfxMode
-    {
-        Kitty,
-        Sixel,
-        Block,
-        WriteFile
-    };
+    [[nodiscard]] bool IsValid() const { return bitmap || anim || hdr || vectorImage; }
+};
 
-    GfxMode gfxMode = GfxMode::Kitty;
-    ScaleMode scale = ScaleMode::None;
-    int bg = -2;
-    bool disableAnimation = false;
-    const char* writeFn = nullptr;
-    ToneMap::Operator tonemap = ToneMap::Operator::PbrNeutral;
+// Without a target size, as when writing to a file, the full image is needed
+uint32_t GetThumbnailSize( const ThumbnailCache* thumbs, uint32_t targetWidth, uint32_t targetHeight )
+{
+    return thumbs && ( targetWidth != 0 || targetHeight != 0 ) ? ThumbnailCache::GetSize( std::max( targetWidth, targetHeight ) ) : 0;
+}
 
-    int opt;
-    while( ( opt = getopt_long( argc, argv, "debsf6G:gAw:t:", longOptions, nullptr ) ) != -1 )
+// If the thumbnail cache is given, a valid thumbnail of the file is used
+// instead of the image. Otherwise the image is decoded at no less than the
+// thumbnail size, so that a new thumbnail can be stored, if requested.
+void LoadImageFile( Image& img, const char* imageFile, std::shared_ptr<DataBuffer> buf, bool disableAnimation, ToneMap::Operator tonemap, uint32_t targetWidth, uint32_t targetHeight, const ThumbnailCache* thumbs, bool saveThumbs, TaskDispatch* td )
+{
+    const auto thumbSize = GetThumbnailSize( thumbs, targetWidth, targetHeight );
+    if( thumbSize != 0 )
     {
-        switch (opt)
+        img.bitmap = thumbs->Get( imageFile, thumbSize, true );
+        if( img.bitmap )
         {
-        case 'd':
-            SetLogLevel( LogLevel::Callstack );
-            break;
-        case 'e':
-            ShowExternalCallstacks( true );
-            break;
-        case 'b':
-            gfxMode = GfxMode::Block;
-            break;
-        case 's':
-            scale = ScaleMode::Scale2x;
-            break;
-        case 'f':
-            scale = ScaleMode::Fit;
-            break;
-        case '6':
-            gfxMode = GfxMode::Sixel;
-            break;
-        case 'G':
-            bg = strtol( optarg, nullptr, 16 );
-            bg = ( bg & 0xFF ) << 16 | ( bg & 0xFF00 ) | ( bg >> 16 );
-            break;
-        case 'g':
-            bg = -1;
-            break;
-        case 'A':
-            disableAnimation = true;
-            break;
-        case 'w':
-            writeFn = optarg;
-            gfxMode = GfxMode::WriteFile;
-            break;
-        case 't':
-            if( strcmp( optarg, "pbr" ) == 0 )
-            {
-                tonemap = ToneMap::Operator::PbrNeutral;
-            }
-            else if( strcmp( optarg, "agx" ) == 0 )
-            {
-                tonemap = ToneMap::Operator::AgX;
-            }
-            else if( strcmp( optarg, "agx-golden" ) == 0 )
-            {
-                tonemap = ToneMap::Operator::AgXGolden;
-            }
-            else if( strcmp( optarg, "agx-punchy" ) == 0 )
-            {
-                tonemap = ToneMap::Operator::AgXPunchy;
-            }
-            else
-            {
-                mclog( LogLevel::Error, "Unknown tone mapping operator" );
-                return 1;
-            }
-            break;
-        default:
-            printf( "\n" );
-            [[fallthrough]];
-        case OptHelp:
-            PrintHelp();
-            return 0;
+            img.thumbnail = true;
+            return;
+        }
+        if( saveThumbs )
+        {
+            targetWidth = std::max( targetWidth, thumbSize );
+            targetHeight = std::max( targetHeight, thumbSize );
         }
     }
-    if (optind == argc)
-    {
-        PrintHelp();
-        printf( "\n" );
-        mclog( LogLevel::Error, "Image file name must be provided" );
-        return 1;
-    }
+    saveThumbs = saveThumbs && thumbSize != 0;
 
-    const auto workerThreads = std::max( 1u, std::thread::hardware_concurrency() - 1 );
-    TaskDispatch td( workerThreads, "Worker" );
+    mclog( LogLevel::Info, "Loading image %s", imageFile );
 
-    const char* imageFile = argv[optind];
-    std::unique_ptr<Bitmap> bitmap;
-    std::unique_ptr<BitmapAnim> anim;
-    std::unique_ptr<VectorImage> vectorImage;
+    // Standard input and pipes can be read only once, so the same buffer is shared by all loaders
+    if( !buf ) buf = OpenImageData( imageFile );
+    if( !buf ) return;
 
-    auto imageThread = std::thread( [&bitmap, &anim, &vectorImage, imageFile, disableAnimation, &td, tonemap] {
-        mclog( LogLevel::Info, "Loading image %s", imageFile );
-        auto loader = GetImageLoader( imageFile, tonemap, &td );
-        if( loader )
+    auto loader = GetImageLoader( buf, tonemap, td );
+    if( loader )
+    {
+        loader->SetTargetSize( targetWidth, targetHeight );
+        if( !disableAnimation && loader->IsAnimated() )
         {
-            if( !disableAnimation && loader->IsAnimated() )
-            {
-                anim = loader->LoadAnim();
-            }
-            else if( loader->IsHdr() && loader->PreferHdr() )
-            {
-                auto hdr = loader->LoadHdr();
-                bitmap = std::make_unique<Bitmap>( hdr->Width(), hdr->Height() );
-
-                auto src = hdr->Data();
-                auto dst = bitmap->Data();
-                size_t sz = hdr->Width() * hdr->Height();
-                while( sz > 0 )
-                {
-                    const auto chunk = std::min( sz, size_t( 16 * 1024 ) );
-                    td.Queue( [src, dst, chunk, tonemap] {
-                        ToneMap::Process( tonemap, (uint32_t*)dst, src, chunk );
-                    } );
-                    src += chunk * 4;
-                    dst += chunk * 4;
-                    sz -= chunk;
-                }
-                td.Sync();
-            }
-            else
-            {
-                bitmap = loader->Load();
-            }
+            img.anim = loader->LoadAnim();
         }
-        if( anim )
+        else if( loader->IsHdr() && loader->PreferHdr() )
         {
-            mclog( LogLevel::Info, "Animated image with %zu frames", anim->FrameCount() );
-            anim->NormalizeSize();
+            img.hdr = loader->LoadHdr();
         }
-        else if( bitmap )
+        else
         {
-            mclog( LogLevel::Info, "Image loaded: %ux%u", bitmap->Width(), bitmap->Height() );
+            img.bitmap = loader->Load();
         }
-        else
+    }
+    if( img.anim )
+    {
+        mclog( LogLevel::Info, "Animated image with %zu frames", img.anim->FrameCount() );
+        img.anim->NormalizeSize();
+    }
+    else if( img.bitmap )
+    {
+        mclog( LogLevel::Info, "Image loaded: %ux%u", img.bitmap->Width(), img.bitmap->Height() );
+        if( saveThumbs )
         {
-            vectorImage = LoadVectorImage( imageFile );
-            if( vectorImage )
-            {
-                mclog( LogLevel::Info, "Vector image loaded: %ix%i", vectorImage->Width(), vectorImage->Height() );
-            }
+            img.bitmap->NormalizeOrientation();
+            thumbs->Put( imageFile, *img.bitmap, thumbSize );
         }
-    } );
-
-    struct winsize ws;
-    ioctl( 0, TIOCGWINSZ, &ws );
-    mclog( LogLevel::Info, "Terminal size: %dx%d", ws.ws_col, ws.ws_row );
+    }
+    else if( img.hdr )
+    {
+        mclog( LogLevel::Info, "HDR image loaded: %ux%u", img.hdr->Width(), img.hdr->Height() );
+    }
+    else
+    {
+        img.vectorImage = LoadVectorImage( std::move( buf ) );
+        if( img.vectorImage )
+        {
+            mclog( LogLevel::Info, "Vector image loaded: %ix%i", img.vectorImage->Width(), img.vectorImage->Height() );
+        }
+    }
+}
 
-    int cw, ch;
+GfxMode ProbeTerminal( GfxMode gfxMode, int& cw, int& ch )
+{
     if( gfxMode != GfxMode::Block && gfxMode != GfxMode::WriteFile )
     {
         if( !OpenTerminal() )
@@ -577,43 +533,58 @@ int main( int argc, char** argv )
         }
     }
 
-    imageThread.join();
-    if( !bitmap && !anim && !vectorImage )
-    {
-        mclog( LogLevel::Error, "Failed to load image %s", imageFile );
-        return 1;
-    }
+    return gfxMode;
+}
 
-    if( gfxMode == GfxMode::Block )
+// Scales the image to the available space and fills the background. After this
+// the image holds either an animation or a bitmap.
+void PrepareImage( Image& img, GfxMode gfxMode, uint32_t col, uint32_t row, ScaleMode scale, ToneMap::Operator tonemap, int bg, TaskDispatch* td )
+{
+    if( gfxMode == GfxMode::WriteFile )
     {
-        if( bg == -2 ) bg = -1;
-
-        uint32_t col = ws.ws_col;
-        uint32_t row = std::max<uint16_t>( 1, ws.ws_row - 1 ) * 2;
-
-        mclog( LogLevel::Info, "Virtual pixels: %ux%u", col, row );
-        AdjustBitmap( bitmap, anim, vectorImage, col, row, scale );
-
-        if( anim )
+        if( img.hdr && !img.anim && !img.bitmap )
         {
-            if( bg >= 0 ) FillBackground( *anim, bg );
-            else if( bg == -1 ) FillCheckerboard( *anim, 1 );
+            img.bitmap = img.hdr->Tonemap( tonemap, td );
         }
-        else
+        else if( img.vectorImage && !img.anim && !img.bitmap )
         {
-            if( bg >= 0 ) FillBackground( *bitmap, bg );
-            else if( bg == -1 ) FillCheckerboard( *bitmap, 1 );
+            img.bitmap = img.vectorImage->Rasterize( img.vectorImage->Width(), img.vectorImage->Height() );
         }
+        img.hdr.reset();
+    }
+    else
+    {
+        mclog( LogLevel::Info, "%s: %ux%u", gfxMode == GfxMode::Block ? "Virtual pixels" : "Pixels available", col, row );
+        AdjustBitmap( img.bitmap, img.anim, img.hdr, img.vectorImage, col, row, scale, tonemap, td );
+    }
+
+    if( bg == -2 && ( gfxMode == GfxMode::Block || gfxMode == GfxMode::Sixel ) ) bg = -1;
+    const auto shift = gfxMode == GfxMode::Block ? 1 : 3;
+    if( img.anim )
+    {
+        if( bg >= 0 ) FillBackground( *img.anim, bg );
+        else if( bg == -1 ) FillCheckerboard( *img.anim, shift );
+    }
+    else
+    {
+        if( bg >= 0 ) FillBackground( *img.bitmap, bg );
+        else if( bg == -1 ) FillCheckerboard( *img.bitmap, shift );
+    }
+}
 
-        if( anim )
+bool OutputImage( Image& img, GfxMode gfxMode, uint32_t col, const char* writeFn )
+{
+    if( gfxMode == GfxMode::Block )
+    {
+        if( img.anim )
         {
             printf( "\033c" );
             for(;;)
             {
-                for( size_t i=0; i<anim->FrameCount(); i++ )
+                for( size_t i=0; i<img.anim->FrameCount(); i++ )
                 {
                     printf( "\033[s" );
-                    const auto& frame = anim->GetFrame( i );
+                    const auto& frame = img.anim->GetFrame( i );
                     PrintBitmapBlock( *frame.bmp );
                     usleep( frame.delay_us );
                     printf( "\033[u" );
@@ -622,79 +593,55 @@ int main( int argc, char** argv )
         }
         else
         {
-            PrintBitmapBlock( *bitmap );
+            PrintBitmapBlock( *img.bitmap );
         }
     }
     else if( gfxMode == GfxMode::Sixel )
     {
-        if( anim )
+        if( img.anim )
         {
             mclog( LogLevel::Error, "Animation is not supported in sixel graphics mode" );
-            return 1;
+            return false;
         }
 
-        if( bg == -2 ) bg = -1;
-
-        uint32_t col = ws.ws_col * cw;
-        uint32_t row = std::max<uint16_t>( 1, ws.ws_row - 1 ) * ch;
-
-        mclog( LogLevel::Info, "Pixels available: %ux%u", col, row );
-        AdjustBitmap( bitmap, anim, vectorImage, col, row, scale );
-
-        if( bg >= 0 ) FillBackground( *bitmap, bg );
-        else if( bg == -1 ) FillCheckerboard( *bitmap );
+        auto& bitmap = *img.bitmap;
 
         sixel_dither_t* dither;
         sixel_dither_new( &dither, -1, nullptr );
-        sixel_dither_initialize( dither, bitmap->Data(), bitmap->Width(), bitmap->Height(), SIXEL_PIXELFORMAT_RGBA8888, SIXEL_LARGE_AUTO, SIXEL_REP_AUTO, SIXEL_QUALITY_FULL );
+        sixel_dither_initialize( dither, bitmap.Data(), bitmap.Width(), bitmap.Height(), SIXEL_PIXELFORMAT_RGBA8888, SIXEL_LARGE_AUTO, SIXEL_REP_AUTO, SIXEL_QUALITY_FULL );
 
         sixel_output_t* output;
         sixel_output_new( &output, []( char* data, int size, void* ) -> int {
             return write( STDOUT_FILENO, data, size );
         }, nullptr, nullptr );
 
-        sixel_encode( bitmap->Data(), bitmap->Width(), bitmap->Height(), -1, dither, output );
+        sixel_encode( bitmap.Data(), bitmap.Width(), bitmap.Height(), -1, dither, output );
 
         sixel_output_destroy( output );
         sixel_dither_destroy( dither );
     }
     else if( gfxMode == GfxMode::Kitty )
     {
-        uint32_t col = ws.ws_col * cw;
-        uint32_t row = std::max<uint16_t>( 1, ws.ws_row - 1 ) * ch;
-
-        mclog( LogLevel::Info, "Pixels available: %ux%u", col, row );
-        AdjustBitmap( bitmap, anim, vectorImage, col, row, scale );
-
-        if( anim )
+        if( img.anim )
         {
-            if( bg >= 0 ) FillBackground( *anim, bg );
-            else if( bg == -1 ) FillCheckerboard( *anim );
-        }
-        else
-        {
-            if( bg >= 0 ) FillBackground( *bitmap, bg );
-            else if( bg == -1 ) FillCheckerboard( *bitmap );
-        }
+            auto& anim = *img.anim;
 
-        if( anim )
-        {
             int id = -1;
-            for( size_t i=0; i<anim->FrameCount(); i++ )
+            for( size_t i=0; i<anim.FrameCount(); i++ )
             {
-                const auto& frame = anim->GetFrame( i );
+                const auto& frame = anim.GetFrame( i );
                 const auto delay_ms = std::max<uint32_t>( frame.delay_us / 1000, 1 );
                 std::string query;
                 if( i == 0 )
                 {
                     query = std::format( "I=1,z={}", delay_ms );
-                    if( !UploadKittyImage( *anim->GetFrame( i ).bmp, query.c_str() ) ) return 1;
+                    if( !UploadKittyImage( *anim.GetFrame( i ).bmp, query.c_str() ) ) return false;
 
                     auto res = QueryTerminal();
                     if( !res.ends_with( ";OK\033\\" ) )
                     {
                         mclog( LogLevel::Error, "Failed to upload image: %s", res.c_str() + 1 );
-                        return 1;
+                        return false;
                     }
 
                     sscanf( res.c_str(), "\033_Gi=%i;OK\033\\", &id );
@@ -703,47 +650,547 @@ int main( int argc, char** argv )
                 else
                 {
                     query = std::format( "a=f,i={},z={}", id, delay_ms );
-                    if( !UploadKittyImage( *anim->GetFrame( i ).bmp, query.c_str(), true ) ) return 1;
+                    if( !UploadKittyImage( *anim.GetFrame( i ).bmp, query.c_str(), true ) ) return false;
                 }
             }
 
             auto query = std::format( "\033_Ga=p,i={},q=1\033\\\033_Ga=a,i={},s=3,v=1,q=1\033\\", id, id );
             write( STDOUT_FILENO, query.c_str(), query.size() );
 
-            if( anim->GetFrame( 0 ).bmp->Width() < col ) printf( "\n" );
+            if( anim.GetFrame( 0 ).bmp->Width() < col ) printf( "\n" );
         }
         else
         {
-            if( !UploadKittyImage( *bitmap, "a=T" ) ) return 1;
-            if( bitmap->Width() < col ) printf( "\n" );
+            if( !UploadKittyImage( *img.bitmap, "a=T" ) ) return false;
+            if( img.bitmap->Width() < col ) printf( "\n" );
         }
     }
     else if( gfxMode == GfxMode::WriteFile )
     {
-        std::shared_ptr<Bitmap> img;
-        if( anim )
+        auto& bitmap = img.anim ? *img.anim->GetFrame( 0 ).bmp : *img.bitmap;
+        bitmap.SavePng( writeFn );
+    }
+    else
+    {
+        CheckPanic( false, "Invalid graphics mode" );
+    }
+
+    return true;
+}
+
+// Decodes the images of a batch on the worker pool, a few files ahead of the
+// one being output. Images are handed out in the order of the file list. Files
+// for which the cached function returns true are not prefetched, as the load
+// function will not read them.
+class BatchLoader
+{
+public:
+    using LoadFn = std::function<void( Image&, const char*, std::shared_ptr<DataBuffer> )>;
+    using CachedFn = std::function<bool( const char* )>;
+
+    BatchLoader( const std::vector<const char*>& files, TaskDispatch& td, LoadFn load, CachedFn cached )
+        : m_files( files )
+        , m_td( td )
+        , m_load( std::move( load ) )
+        , m_window( td.NumWorkers() * 2 )
+        , m_prefetch( std::vector<std::string>( files.begin(), files.end() ), [cached = std::move( cached )]( const std::string& file ) { return !cached( file.c_str() ); } )
+        , m_slots( files.size() )
+        , m_next( 0 )
+        , m_queued( 0 )
+        , m_running( 0 )
+    {
+        Fill();
+    }
+
+    ~BatchLoader()
+    {
+        std::unique_lock lock( m_lock );
+        m_cv.wait( lock, [this] { return m_running == 0; } );
+    }
+
+    NoCopy( BatchLoader );
+
+    [[nodiscard]] Image Next()
+    {
+        std::unique_lock lock( m_lock );
+        m_cv.wait( lock, [this] { return m_slots[m_next].done; } );
+        auto img = std::move( m_slots[m_next++].img );
+        lock.unlock();
+
+        Fill();
+        return img;
+    }
+
+private:
+    struct Slot
+    {
+        Image img;
+        bool done = false;
+    };
+
+    void Fill()
+    {
+        while( m_queued < m_files.size() && m_queued < m_next + m_window )
         {
-            img = anim->GetFrame( 0 ).bmp;
+            const auto idx = m_queued++;
+            auto buf = m_prefetch.Next();
+
+            std::lock_guard lock( m_lock );
+            m_running++;
+            m_td.Queue( [this, idx, buf = std::move( buf )] () mutable {
+                Image img;
+                m_load( img, m_files[idx], std::move( buf ) );
+
+                std::lock_guard lock( m_lock );
+                m_slots[idx].img = std::move( img );
+                m_slots[idx].done = true;
+                m_running--;
+                m_cv.notify_all();
+            } );
         }
-        else if( bitmap )
+    }
+
+    const std::vector<const char*>& m_files;
+    TaskDispatch& m_td;
+    LoadFn m_load;
+    size_t m_window;
+    FilePrefetcher m_prefetch;
+
+    std::vector<Slot> m_slots;
+    size_t m_next;
+    size_t m_queued;
+    size_t m_running;
+
+    std::mutex m_lock;
+    std::condition_variable m_cv;
+};
+
+struct GridLayout
+{
+    uint32_t columns;
+    uint32_t rows;
+    uint32_t tile;
+};
+
+// The contact sheet is a single bitmap, which must stay allocatable
+constexpr uint64_t MaxSheetPixels = 256 * 1024 * 1024;
+
+// Picks the number of columns that gives the largest square tiles in the
+// available space. Tiles are never smaller than minTile pixels; with many
+// images the grid then extends past the bottom of the terminal, unless the
+// sheet would get too large, in which case the tiles are made smaller. If
+// even single pixel tiles don't fit, the returned tile size is zero.
+GridLayout GetGridLayout( size_t count, uint32_t width, uint32_t height, uint32_t minTile )
+{
+    GridLayout best = { 1, uint32_t( count ), 0 };
+    for( uint32_t c=1; c<=count; c++ )
+    {
+        const auto r = uint32_t( ( count + c - 1 ) / c );
+        const auto tile = std::min( width / c, height / r );
+        if( tile > best.tile ) best = { c, r, tile };
+    }
+    if( best.tile < minTile )
+    {
+        best.tile = std::max( 1u, std::min( minTile, width ) );
+        best.columns = std::max( 1u, width / best.tile );
+        best.rows = uint32_t( ( count + best.columns - 1 ) / best.columns );
+    }
+    while( best.tile > 0 && uint64_t( best.columns ) * best.rows * best.tile * best.tile > MaxSheetPixels )
+    {
+        best.tile = std::min( best.tile - 1, uint32_t( sqrt( double( MaxSheetPixels ) / count ) ) );
+        if( best.tile == 0 ) break;
+        best.columns = uint32_t( std::clamp<size_t>( width / best.tile, 1, count ) );
+        best.rows = uint32_t( ( count + best.columns - 1 ) / best.columns );
+    }
+    return best;
+}
+
+// The cache key covers the file identity and all options that change the
+// displayed bitmap. Images written to files are not cached, and neither are
+// streams, which have no identity.
+std::string GetCacheKey( const char* imageFile, GfxMode gfxMode, uint32_t col, uint32_t row, ScaleMode scale, ToneMap::Operator tonemap, int bg, bool still )
+{
+    if( gfxMode == GfxMode::WriteFile || strcmp( imageFile, "-" ) == 0 ) return {};
+
+    struct stat st;
+    if( stat( imageFile, &st ) != 0 || !S_ISREG( st.st_mode ) ) return {};
+
+    std::error_code ec;
+    const auto path = std::filesystem::canonical( imageFile, ec );
+    if( ec ) return {};
+
+    return std::format( "{}\n{} {}.{:09}\n{} {}x{} {} {} {} {}", path.string(), st.st_size, st.st_mtim.tv_sec, st.st_mtim.tv_nsec, int( gfxMode ), col, row, int( scale ), int( tonemap ), bg, still ? 1 : 0 );
+}
+
+// Loads the image and prepares it for display, using the cache if available.
+// Animations are not cached.
+void LoadDisplayImage( Image& img, const char* imageFile, std::shared_ptr<DataBuffer> buf, BitmapCache* cache, bool disableAnimation, GfxMode gfxMode, uint32_t col, uint32_t row, ScaleMode scale, ToneMap::Operator tonemap, int bg, uint32_t targetWidth, uint32_t targetHeight, const ThumbnailCache* thumbs, bool saveThumbs, TaskDispatch* td )
+{
+    const auto key = cache ? GetCacheKey( imageFile, gfxMode, col, row, scale, tonemap, bg, disableAnimation ) : std::string();
+    if( !key.empty() )
+    {
+        img.bitmap = cache->Get( key );
+        if( img.bitmap ) return;
+    }
+
+    LoadImageFile( img, imageFile, std::move( buf ), disableAnimation, tonemap, targetWidth, targetHeight, thumbs, saveThumbs, td );
+    if( !img.IsValid() ) return;
+    PrepareImage( img, gfxMode, col, row, scale, tonemap, bg, td );
+
+    // Images made from thumbnails have lower quality than the key implies
+    if( !key.empty() && img.bitmap && !img.thumbnail ) cache->Put( key, *img.bitmap );
+}
+
+// Checks if LoadDisplayImage() with the same arguments would find the image in
+// one of the caches, without reading the file.
+bool IsDisplayImageCached( const char* imageFile, const BitmapCache* cache, bool disableAnimation, GfxMode gfxMode, uint32_t col, uint32_t row, ScaleMode scale, ToneMap::Operator tonemap, int bg, uint32_t targetWidth, uint32_t targetHeight, const ThumbnailCache* thumbs )
+{
+    if( cache )
+    {
+        const auto key = GetCacheKey( imageFile, gfxMode, col, row, scale, tonemap, bg, disableAnimation );
+        if( !key.empty() && cache->Contains( key ) ) return true;
+    }
+    const auto thumbSize = GetThumbnailSize( thumbs, targetWidth, targetHeight );
+    return thumbSize != 0 && thumbs->Contains( imageFile, thumbSize, true );
+}
+
+// Output files are named after the input files. Inputs with the same name in
+// different directories, or with different extensions, get a numeric suffix,
+// so that no output overwrites another.
+std::vector<std::string> GetOutputNames( const char* dir, const std::vector<const char*>& files )
+{
+    std::vector<std::string> ret;
+    std::unordered_set<std::string> used;
+    ret.reserve( files.size() );
+    for( auto imageFile : files )
+    {
+        auto stem = std::filesystem::path( imageFile ).stem().string();
+        if( stem.empty() || strcmp( imageFile, "-" ) == 0 ) stem = "stdin";
+
+        auto name = stem;
+        for( int i=2; !used.emplace( name ).second; i++ ) name = std::format( "{}-{}", stem, i );
+        if( name != stem ) mclog( LogLevel::Warning, "Output name %s.png is already used, writing %s as %s.png", stem.c_str(), imageFile, name.c_str() );
+
+        ret.emplace_back( ( std::filesystem::path( dir ) / name ).string() + ".png" );
+    }
+    return ret;
+}
+}
+
+int main( int argc, char** argv )
+{
+#ifdef NDEBUG
+    SetLogLevel( LogLevel::Error );
+#endif
+
+    enum { OptHelp, OptGrid, OptNoCache, OptFast, OptSaveThumb };
+
+    struct option longOptions[] = {
+        { "debug", no_argument, nullptr, 'd' },
+        { "external", no_argument, nullptr, 'e' },
+        { "block", no_argument, nullptr, 'b' },
+        { "scale", no_argument, nullptr, 's' },
+        { "fit", no_argument, nullptr, 'f' },
+        { "sixel", no_argument, nullptr, '6' },
+        { "background", required_argument, nullptr, 'G' },
+        { "checkerboard", no_argument, nullptr, 'g' },
+        { "noanim", no_argument, nullptr, 'A' },
+        { "write", required_argument, nullptr, 'w' },
+        { "tonemap", required_argument, nullptr, 't' },
+        { "grid", no_argument, nullptr, OptGrid },
+        { "nocache", no_argument, nullptr, OptNoCache },
+        { "fast", no_argument, nullptr, OptFast },
+        { "savethumb", no_argument, nullptr, OptSaveThumb },
+        { "help", no_argument, nullptr, OptHelp },
+        {}
+    };
+
+    GfxMode gfxMode = GfxMode::Kitty;
+    ScaleMode scale = ScaleMode::None;
+    int bg = -2;
+    bool disableAnimation = false;
+    bool grid = false;
+    bool useCache = true;
+    bool fast = false;
+    bool saveThumbs = false;
+    const char* writeFn = nullptr;
+    ToneMap::Operator tonemap = ToneMap::Operator::PbrNeutral;
+
+    int opt;
+    while( ( opt = getopt_long( argc, argv, "debsf6G:gAw:t:", longOptions, nullptr ) ) != -1 )
+    {
+        switch (opt)
         {
-            img.reset( bitmap.release() );
+        case 'd':
+            SetLogLevel( LogLevel::Callstack );
+            break;
+        case 'e':
+            ShowExternalCallstacks( true );
+            break;
+        case 'b':
+            gfxMode = GfxMode::Block;
+            break;
+        case 's':
+            scale = ScaleMode::Scale2x;
+            break;
+        case 'f':
+            scale = ScaleMode::Fit;
+            break;
+        case '6':
+            gfxMode = GfxMode::Sixel;
+            break;
+        case 'G':
+            bg = strtol( optarg, nullptr, 16 );
+            bg = ( bg & 0xFF ) << 16 | ( bg & 0xFF00 ) | ( bg >> 16 );
+            break;
+        case 'g':
+            bg = -1;
+            break;
+        case 'A':
+            disableAnimation = true;
+            break;
+        case 'w':
+            writeFn = optarg;
+            gfxMode = GfxMode::WriteFile;
+            break;
+        case 't':
+            if( strcmp( optarg, "pbr" ) == 0 )
+            {
+                tonemap = ToneMap::Operator::PbrNeutral;
+            }
+            else if( strcmp( optarg, "agx" ) == 0 )
+            {
+                tonemap = ToneMap::Operator::AgX;
+            }
+            else if( strcmp( optarg, "agx-golden" ) == 0 )
+            {
+                tonemap = ToneMap::Operator::AgXGolden;
+            }
+            else if( strcmp( optarg, "agx-punchy" ) == 0 )
+            {
+                tonemap = ToneMap::Operator::AgXPunchy;
+            }
+            else
+            {
+                mclog( LogLevel::Error, "Unknown tone mapping operator" );
+                return 1;
+            }
+            break;
+        default:
+            printf( "\n" );
+            [[fallthrough]];
+        case OptHelp:
+            PrintHelp();
+            return 0;
+        case OptGrid:
+            grid = true;
+            break;
+        case OptNoCache:
+            useCache = false;
+            break;
+        case OptFast:
+            fast = true;
+            break;
+        case OptSaveThumb:
+            saveThumbs = true;
+            break;
         }
-        else
+    }
+    if (optind == argc)
+    {
+        PrintHelp();
+        printf( "\n" );
+        mclog( LogLevel::Error, "Image file name must be provided" );
+        return 1;
+    }
+
+    const auto workerThreads = std::max( 1u, std::thread::hardware_concurrency() - 1 );
+    TaskDispatch td( workerThreads, "Worker" );
+
+    const std::vector<const char*> files( argv + optind, argv + argc );
+    const bool batch = files.size() > 1 || grid;
+
+    // With more than one image, or when the target is a directory, each image is written to its own file
+    std::error_code ec;
+    const bool writeDir = writeFn && !grid && ( batch || std::filesystem::is_directory( writeFn, ec ) );
+    if( writeDir && !std::filesystem::is_directory( writeFn, ec ) && !std::filesystem::create_directories( writeFn, ec ) )
+    {
+        mclog( LogLevel::Error, "Failed to create output directory %s", writeFn );
+        return 1;
+    }
+
+    struct winsize ws;
+    ioctl( 0, TIOCGWINSZ, &ws );
+    mclog( LogLevel::Info, "Terminal size: %dx%d", ws.ws_col, ws.ws_row );
+
+    uint32_t targetWidth = 0;
+    uint32_t targetHeight = 0;
+    if( gfxMode == GfxMode::Block )
+    {
+        targetWidth = ws.ws_col;
+        targetHeight = std::max<uint16_t>( 1, ws.ws_row - 1 ) * 2;
+    }
+    else if( gfxMode != GfxMode::WriteFile && ws.ws_xpixel != 0 && ws.ws_ypixel != 0 )
+    {
+        targetWidth = ws.ws_xpixel;
+        targetHeight = ws.ws_ypixel;
+    }
+
+    auto getOutputSize = [&ws]( GfxMode gfxMode, int cw, int ch, uint32_t& col, uint32_t& row ) {
+        if( gfxMode == GfxMode::Block )
+        {
+            col = ws.ws_col;
+            row = std::max<uint16_t>( 1, ws.ws_row - 1 ) * 2;
+        }
+        else if( gfxMode != GfxMode::WriteFile )
         {
-            CheckPanic( vectorImage, "No image data" );
-            img = vectorImage->Rasterize( vectorImage->Width(), vectorImage->Height() );
+            col = ws.ws_col * cw;
+            row = std::max<uint16_t>( 1, ws.ws_row - 1 ) * ch;
         }
+    };
+
+    int cw = 0, ch = 0;
+    uint32_t col = 0, row = 0;
+
+    std::unique_ptr<BitmapCache> cache;
+    if( useCache && ( gfxMode != GfxMode::WriteFile || grid ) ) cache = std::make_unique<BitmapCache>();
 
-        if( bg >= 0 ) FillBackground( *img, bg );
-        else if( bg == -1 ) FillCheckerboard( *img );
+    std::unique_ptr<ThumbnailCache> thumbs;
+    if( fast || grid ) thumbs = std::make_unique<ThumbnailCache>();
+
+    if( !batch )
+    {
+        const char* imageFile = files[0];
+
+        // The image is loaded while the terminal is being queried. The cache is
+        // keyed by the output size, which is not known before the query, so the
+        // lookup uses the size guessed from the window size in pixels.
+        Image img;
+        std::string cachedKey;
+        auto imageThread = std::thread( [&img, &cachedKey, imageFile, disableAnimation, &td, gfxMode, scale, tonemap, bg, targetWidth, targetHeight, &ws, &getOutputSize, &cache, &thumbs, saveThumbs] {
+            if( cache && ws.ws_col != 0 && ws.ws_row != 0 && ( gfxMode == GfxMode::Block || ws.ws_xpixel != 0 ) )
+            {
+                uint32_t col = 0, row = 0;
+                getOutputSize( gfxMode, ws.ws_xpixel / ws.ws_col, ws.ws_ypixel / ws.ws_row, col, row );
+                auto key = GetCacheKey( imageFile, gfxMode, col, row, scale, tonemap, bg, disableAnimation );
+                if( !key.empty() && ( img.bitmap = cache->Get( key ) ) )
+                {
+                    cachedKey = std::move( key );
+                    return;
+                }
+            }
+            LoadImageFile( img, imageFile, nullptr, disableAnimation, tonemap, targetWidth, targetHeight, thumbs.get(), saveThumbs, &td );
+        } );
+
+        gfxMode = ProbeTerminal( gfxMode, cw, ch );
+
+        imageThread.join();
+        getOutputSize( gfxMode, cw, ch, col, row );
+        const auto key = cache ? GetCacheKey( imageFile, gfxMode, col, row, scale, tonemap, bg, disableAnimation ) : std::string();
+        if( !cachedKey.empty() && cachedKey != key )
+        {
+            // The guess was wrong, e.g. the terminal has no graphics support
+            mclog( LogLevel::Info, "Cached bitmap does not match the terminal" );
+            img = Image();
+            LoadDisplayImage( img, imageFile, nullptr, cache.get(), disableAnimation, gfxMode, col, row, scale, tonemap, bg, targetWidth, targetHeight, thumbs.get(), saveThumbs, &td );
+        }
+        else if( cachedKey.empty() && img.IsValid() )
+        {
+            PrepareImage( img, gfxMode, col, row, scale, tonemap, bg, &td );
+
+            // Images made from thumbnails have lower quality than the key implies
+            if( !key.empty() && img.bitmap && !img.thumbnail ) cache->Put( key, *img.bitmap );
+        }
+        if( !img.IsValid() )
+        {
+            mclog( LogLevel::Error, "Failed to load image %s", imageFile );
+            return 1;
+        }
 
-        img->SavePng( writeFn );
+        const auto outName = writeDir ? GetOutputNames( writeFn, files )[0] : std::string();
+        return OutputImage( img, gfxMode, col, writeDir ? outName.c_str() : writeFn ) ? 0 : 1;
     }
-    else
+
+    // Images in a batch are decoded and scaled on the worker pool, one image per
+    // job, while the main thread outputs them in order. The terminal has to be
+    // queried first, as the output size depends on it. Animations are shown as
+    // still images, so that the output can proceed to the next file.
+    gfxMode = ProbeTerminal( gfxMode, cw, ch );
+    getOutputSize( gfxMode, cw, ch, col, row );
+
+    if( grid )
     {
-        CheckPanic( false, "Invalid graphics mode" );
+        // Without a terminal the contact sheet is made of 256 pixel tiles in a square-ish layout
+        if( gfxMode == GfxMode::WriteFile )
+        {
+            col = row = 256 * uint32_t( ceil( sqrt( double( files.size() ) ) ) );
+        }
+
+        const auto layout = GetGridLayout( files.size(), col, row, gfxMode == GfxMode::Block ? 8 : 64 );
+        if( layout.tile == 0 )
+        {
+            mclog( LogLevel::Error, "Too many images for a contact sheet" );
+            return 1;
+        }
+        // Tiles too small to be padded, as in a very narrow terminal, are used whole
+        const auto pad = layout.tile > 2 ? std::max( 1u, layout.tile / 32 ) : 0;
+        const auto inner = layout.tile - pad * 2;
+        mclog( LogLevel::Info, "Grid: %ux%u tiles of %u pixels", layout.columns, layout.rows, layout.tile );
+
+        // Thumbnails are scaled like images shown in a terminal, also when the sheet is written to a file
+        const auto tileMode = gfxMode == GfxMode::WriteFile ? GfxMode::Kitty : gfxMode;
+        BatchLoader loader( files, td, [=, &cache, &thumbs]( Image& img, const char* imageFile, std::shared_ptr<DataBuffer> buf ) {
+            LoadDisplayImage( img, imageFile, std::move( buf ), cache.get(), true, tileMode, inner, inner, scale, tonemap, bg, inner, inner, thumbs.get(), saveThumbs, nullptr );
+        }, [=, &cache, &thumbs]( const char* imageFile ) {
+            return IsDisplayImageCached( imageFile, cache.get(), true, tileMode, inner, inner, scale, tonemap, bg, inner, inner, thumbs.get() );
+        } );
+
+        Image sheet;
+        sheet.bitmap = std::make_unique<Bitmap>( layout.columns * layout.tile, layout.rows * layout.tile );
+        memset( sheet.bitmap->Data(), 0, size_t( sheet.bitmap->Width() ) * sheet.bitmap->Height() * 4 );
+
+        int ret = 0;
+        for( size_t i=0; i<files.size(); i++ )
+        {
+            auto img = loader.Next();
+            if( !img.IsValid() )
+            {
+                mclog( LogLevel::Error, "Failed to load image %s", files[i] );
+                ret = 1;
+                continue;
+            }
+
+            const auto& bmp = *img.bitmap;
+            const auto x = uint32_t( i % layout.columns ) * layout.tile + ( layout.tile - std::min( bmp.Width(), layout.tile ) ) / 2;
+            const auto y = uint32_t( i / layout.columns ) * layout.tile + ( layout.tile - std::min( bmp.Height(), layout.tile ) ) / 2;
+            sheet.bitmap->Blit( bmp, x, y );
+        }
+
+        // The whole sheet is sent to the terminal as a single image
+        if( !OutputImage( sheet, gfxMode, col, writeFn ) ) ret = 1;
+        return ret;
     }
 
-    return 0;
+    BatchLoader loader( files, td, [=, &cache, &thumbs]( Image& img, const char* imageFile, std::shared_ptr<DataBuffer> buf ) {
+        LoadDisplayImage( img, imageFile, std::move( buf ), cache.get(), true, gfxMode, col, row, scale, tonemap, bg, targetWidth, targetHeight, thumbs.get(), saveThumbs, nullptr );
+    }, [=, &cache, &thumbs]( const char* imageFile ) {
+        return IsDisplayImageCached( imageFile, cache.get(), true, gfxMode, col, row, scale, tonemap, bg, targetWidth, targetHeight, thumbs.get() );
+    } );
+
+    const auto outNames = writeDir ? GetOutputNames( writeFn, files ) : std::vector<std::string>();
+
+    int ret = 0;
+    for( size_t i=0; i<files.size(); i++ )
+    {
+        auto img = loader.Next();
+        if( !img.IsValid() )
+        {
+            mclog( LogLevel::Error, "Failed to load image %s", files[i] );
+            ret = 1;
+            continue;
+        }
+
+        if( !OutputImage( img, gfxMode, col, writeDir ? outNames[i].c_str() : writeFn ) ) ret = 1;
+    }
+    return ret;
 }
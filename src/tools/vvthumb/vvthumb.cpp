@@ -0,0 +1,279 @@
+#include <algorithm>
+#include <condition_variable>
+#include <ctype.h>
+#include <deque>
+#include <getopt.h>
+#include <memory>
+#include <mutex>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "image/ImageLoader.hpp"
+#include "util/Bitmap.hpp"
+#include "util/BitmapHdr.hpp"
+#include "util/Callstack.hpp"
+#include "util/DataBuffer.hpp"
+#include "util/Logs.hpp"
+#include "util/TaskDispatch.hpp"
+#include "util/Tonemapper.hpp"
+#include "util/VectorImage.hpp"
+
+namespace {
+void PrintHelp()
+{
+    printf( "Usage: vvthumb [options] <input> <output.png>\n" );
+    printf( "       vvthumb [options] --daemon\n\n" );
+    printf( "Options:\n" );
+    printf( "  -s, --size [pixels]          Maximum thumbnail size (default 256)\n" );
+    printf( "  --daemon                     Process requests from standard input\n" );
+    printf( "  --help                       Print this help\n" );
+    printf( "\nIn daemon mode each line of input is a request in the form of\n" );
+    printf( "<size><tab><input><tab><output>. For each finished request a line\n" );
+    printf( "with OK or FAIL, a tab, and the output file name is printed.\n" );
+}
+
+// Thumbnailers may be given file URIs instead of paths
+std::string GetPath( const char* input )
+{
+    if( strncmp( input, "file://", 7 ) != 0 ) return input;
+
+    std::string ret;
+    for( auto ptr = input + 7; *ptr; ptr++ )
+    {
+        if( ptr[0] == '%' && isxdigit( ptr[1] ) && isxdigit( ptr[2] ) )
+        {
+            const char hex[3] = { ptr[1], ptr[2], 0 };
+            ret += (char)strtol( hex, nullptr, 16 );
+            ptr += 2;
+        }
+        else
+        {
+            ret += *ptr;
+        }
+    }
+    return ret;
+}
+
+// Images are decoded at reduced resolution where the format allows it, as
+// close to the thumbnail size as possible, and then scaled down to fit.
+bool MakeThumbnail( const char* input, const char* output, uint32_t size, TaskDispatch* td )
+{
+    const auto path = GetPath( input );
+    mclog( LogLevel::Info, "Thumbnail of %s, %u pixels", path.c_str(), size );
+
+    auto buf = OpenImageData( path.c_str() );
+    if( !buf ) return false;
+
+    std::unique_ptr<Bitmap> bitmap;
+    auto loader = GetImageLoader( buf, ToneMap::Operator::PbrNeutral, td );
+    if( loader )
+    {
+        loader->SetTargetSize( size, size );
+        if( loader->IsHdr() && loader->PreferHdr() )
+        {
+            // Resample in linear light and tone map only the thumbnail pixels
+            auto hdr = loader->LoadHdr();
+            if( hdr )
+            {
+                const auto ratio = std::min( { 1.f, float( size ) / hdr->Width(), float( size ) / hdr->Height() } );
+                if( ratio < 1 ) hdr = hdr->ResizeNew( std::max( 1u, uint32_t( hdr->Width() * ratio ) ), std::max( 1u, uint32_t( hdr->Height() * ratio ) ) );
+                bitmap = hdr->Tonemap( ToneMap::Operator::PbrNeutral, td );
+            }
+        }
+        else
+        {
+            bitmap = loader->Load();
+        }
+    }
+    else
+    {
+        auto vector = LoadVectorImage( std::move( buf ) );
+        if( vector )
+        {
+            auto w = vector->Width();
+            auto h = vector->Height();
+            if( w <= 0 || h <= 0 ) w = h = size;
+            const auto ratio = std::min( float( size ) / w, float( size ) / h );
+            bitmap = vector->Rasterize( std::max( 1, int( w * ratio ) ), std::max( 1, int( h * ratio ) ) );
+        }
+    }
+    if( !bitmap )
+    {
+        mclog( LogLevel::Error, "Failed to load image %s", path.c_str() );
+        return false;
+    }
+
+    bitmap->NormalizeOrientation();
+
+    const auto w = bitmap->Width();
+    const auto h = bitmap->Height();
+    if( w > size || h > size )
+    {
+        const auto ratio = std::min( float( size ) / w, float( size ) / h );
+        bitmap->Resize( std::max( 1u, uint32_t( w * ratio ) ), std::max( 1u, uint32_t( h * ratio ) ) );
+    }
+
+    // Saving does not report errors, so check that the output can be written
+    auto f = fopen( output, "wb" );
+    if( !f )
+    {
+        mclog( LogLevel::Error, "Failed to open %s for writing", output );
+        return false;
+    }
+    fclose( f );
+
+    // Thumbnails are small and short-lived, so fast compression is preferred over size
+    bitmap->SavePng( output, { { "Software", "vvthumb" } }, 1 );
+    return true;
+}
+
+struct Request
+{
+    std::string input;
+    std::string output;
+    uint32_t size;
+};
+
+// Requests are processed in parallel, one per worker, and the results are
+// reported in the order of completion. Workers take requests in the order they
+// were received, so that thumbnails requested first, e.g. for the visible part
+// of a file manager window, are also made first. Loaders run without the task
+// dispatcher, as there are no idle workers to help them. Results are printed
+// within log blocks, so that they are not mixed with log messages.
+int RunDaemon( size_t workerThreads )
+{
+    SetLogSynchronized( true );
+
+    std::deque<Request> queue;
+    std::mutex lock;
+    std::condition_variable cv;
+    bool done = false;
+
+    std::vector<std::thread> workers;
+    workers.reserve( workerThreads );
+    for( size_t i=0; i<workerThreads; i++ )
+    {
+        workers.emplace_back( [&queue, &lock, &cv, &done] {
+            std::unique_lock guard( lock );
+            for(;;)
+            {
+                cv.wait( guard, [&queue, &done] { return !queue.empty() || done; } );
+                if( queue.empty() ) return;
+                auto req = std::move( queue.front() );
+                queue.pop_front();
+                guard.unlock();
+
+                const auto ok = MakeThumbnail( req.input.c_str(), req.output.c_str(), req.size, nullptr );
+                LogBlockBegin();
+                printf( "%s\t%s\n", ok ? "OK" : "FAIL", req.output.c_str() );
+                fflush( stdout );
+                LogBlockEnd();
+
+                guard.lock();
+            }
+        } );
+    }
+
+    char* line = nullptr;
+    size_t lineSize = 0;
+    ssize_t len;
+    while( ( len = getline( &line, &lineSize, stdin ) ) != -1 )
+    {
+        while( len > 0 && ( line[len-1] == '\n' || line[len-1] == '\r' ) ) line[--len] = '\0';
+        if( len == 0 ) continue;
+
+        auto in = strchr( line, '\t' );
+        auto out = in ? strchr( in + 1, '\t' ) : nullptr;
+        const auto size = atoi( line );
+        if( !out || size <= 0 )
+        {
+            mclog( LogLevel::Error, "Invalid request: %s", line );
+            continue;
+        }
+
+        std::lock_guard guard( lock );
+        queue.emplace_back( Request { std::string( in + 1, out ), std::string( out + 1 ), uint32_t( size ) } );
+        cv.notify_one();
+    }
+    free( line );
+
+    {
+        std::lock_guard guard( lock );
+        done = true;
+        cv.notify_all();
+    }
+    for( auto& worker : workers ) worker.join();
+    return 0;
+}
+}
+
+int main( int argc, char** argv )
+{
+#ifdef NDEBUG
+    SetLogLevel( LogLevel::Error );
+#endif
+
+    enum { OptHelp, OptDaemon };
+
+    struct option longOptions[] = {
+        { "debug", no_argument, nullptr, 'd' },
+        { "external", no_argument, nullptr, 'e' },
+        { "size", required_argument, nullptr, 's' },
+        { "daemon", no_argument, nullptr, OptDaemon },
+        { "help", no_argument, nullptr, OptHelp },
+        {}
+    };
+
+    int size = 256;
+    bool daemon = false;
+
+    int opt;
+    while( ( opt = getopt_long( argc, argv, "des:", longOptions, nullptr ) ) != -1 )
+    {
+        switch (opt)
+        {
+        case 'd':
+            SetLogLevel( LogLevel::Callstack );
+            break;
+        case 'e':
+            ShowExternalCallstacks( true );
+            break;
+        case 's':
+            size = atoi( optarg );
+            if( size <= 0 )
+            {
+                mclog( LogLevel::Error, "Invalid thumbnail size: %s", optarg );
+                return 1;
+            }
+            break;
+        case OptDaemon:
+            daemon = true;
+            break;
+        default:
+            printf( "\n" );
+            [[fallthrough]];
+        case OptHelp:
+            PrintHelp();
+            return 0;
+        }
+    }
+
+    const auto workerThreads = std::max( 1u, std::thread::hardware_concurrency() - 1 );
+    if( daemon ) return RunDaemon( workerThreads );
+
+    TaskDispatch td( workerThreads, "Worker" );
+
+    if( argc - optind != 2 )
+    {
+        PrintHelp();
+        printf( "\n" );
+        mclog( LogLevel::Error, "Input and output file names must be provided" );
+        return 1;
+    }
+
+    return MakeThumbnail( argv[optind], argv[optind+1], size, &td ) ? 0 : 1;
+}
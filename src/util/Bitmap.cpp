@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <string.h>
 #include <utility>
 
@@ -15,7 +16,7 @@
 Bitmap::Bitmap( uint32_t width, uint32_t height, int orientation )
     : m_width( width )
     , m_height( height )
-    , m_data( new uint8_t[width*height*4] )
+    , m_data( new uint8_t[size_t( width ) * height * 4] )
     , m_orientation( orientation )
 {
 }
@@ -82,6 +83,18 @@ void Bitmap::Extend( uint32_t width, uint32_t height )
     m_data = data;
 }
 
+void Bitmap::Blit( const Bitmap& src, uint32_t x, uint32_t y )
+{
+    if( x >= m_width || y >= m_height ) return;
+
+    const auto w = std::min( src.m_width, m_width - x );
+    const auto h = std::min( src.m_height, m_height - y );
+    for( uint32_t i=0; i<h; i++ )
+    {
+        memcpy( m_data + ( size_t( y + i ) * m_width + x ) * 4, src.m_data + size_t( i ) * src.m_width * 4, w * 4 );
+    }
+}
+
 void Bitmap::FlipVertical()
 {
     auto ptr1 = m_data;
@@ -295,7 +308,7 @@ void Bitmap::NormalizeOrientation()
     m_orientation = 1;
 }
 
-void Bitmap::SavePng( const char* path ) const
+void Bitmap::SavePng( const char* path, const std::vector<std::pair<const char*, std::string>>& text, int level ) const
 {
     FILE* f = fopen( path, "wb" );
     CheckPanic( f, "Failed to open %s for writing", path );
@@ -309,6 +322,27 @@ void Bitmap::SavePng( const char* path ) const
 
     png_set_IHDR( png_ptr, info_ptr, m_width, m_height, 8, PNG_COLOR_TYPE_RGB_ALPHA, PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_BASE, PNG_FILTER_TYPE_BASE );
 
+    // At low levels the time spent on choosing the filter for each row dominates, so a single filter is used
+    if( level >= 0 )
+    {
+        png_set_compression_level( png_ptr, level );
+        if( level <= 2 ) png_set_filter( png_ptr, PNG_FILTER_TYPE_BASE, PNG_FILTER_SUB );
+    }
+
+    if( !text.empty() )
+    {
+        std::vector<png_text> chunks( text.size() );
+        for( size_t i=0; i<text.size(); i++ )
+        {
+            chunks[i] = {};
+            chunks[i].compression = PNG_TEXT_COMPRESSION_NONE;
+            chunks[i].key = (png_charp)text[i].first;
+            chunks[i].text = (png_charp)text[i].second.c_str();
+            chunks[i].text_length = text[i].second.size();
+        }
+        png_set_text( png_ptr, info_ptr, chunks.data(), chunks.size() );
+    }
+
     png_write_info( png_ptr, info_ptr );
 
     auto ptr = (uint32_t*)m_data;
@@ -2,6 +2,9 @@
 
 #include <memory>
 #include <stdint.h>
+#include <string>
+#include <utility>
+#include <vector>
 
 class Bitmap
 {
@@ -17,6 +20,7 @@ public:
     void Resize( uint32_t width, uint32_t height );
     [[nodiscard]] std::unique_ptr<Bitmap> ResizeNew( uint32_t width, uint32_t height ) const;
     void Extend( uint32_t width, uint32_t height );
+    void Blit( const Bitmap& src, uint32_t x, uint32_t y );
     void SetAlpha( uint8_t alpha );
     void NormalizeOrientation();
 
@@ -32,7 +36,9 @@ public:
     [[nodiscard]] const uint8_t* Data() const { return m_data; }
     [[nodiscard]] int Orientation() const { return m_orientation; }
 
-    void SavePng( const char* path ) const;
+    // Text is stored as uncompressed tEXt chunks of key and value pairs. The
+    // zlib compression level is 0-9, or -1 for the default.
+    void SavePng( const char* path, const std::vector<std::pair<const char*, std::string>>& text = {}, int level = -1 ) const;
 
 private:
     uint32_t m_width;
@@ -0,0 +1,272 @@
+#include <algorithm>
+#include <chrono>
+#include <errno.h>
+#include <fcntl.h>
+#include <filesystem>
+#include <format>
+#include <lz4.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+#include "Bitmap.hpp"
+#include "BitmapCache.hpp"
+#include "Home.hpp"
+#include "util/Logs.hpp"
+
+namespace
+{
+constexpr char Magic[4] = { 'v', 'v', 'c', '1' };
+constexpr const char* Extension = ".vvc";
+
+// Temporary files older than this were left behind by a process that exited before renaming them
+constexpr auto StaleTempAge = std::chrono::minutes( 10 );
+
+struct Header
+{
+    char magic[4];
+    uint32_t width;
+    uint32_t height;
+    uint32_t keySize;
+    uint32_t dataSize;
+};
+
+uint64_t Hash( const std::string& str )
+{
+    uint64_t hash = 0xcbf29ce484222325;
+    for( auto c : str )
+    {
+        hash ^= (uint8_t)c;
+        hash *= 0x100000001b3;
+    }
+    return hash;
+}
+
+bool ReadAll( int fd, char* ptr, size_t size )
+{
+    while( size > 0 )
+    {
+        const auto rd = read( fd, ptr, size );
+        if( rd <= 0 )
+        {
+            if( rd < 0 && errno == EINTR ) continue;
+            return false;
+        }
+        ptr += rd;
+        size -= rd;
+    }
+    return true;
+}
+
+bool WriteAll( int fd, const char* ptr, size_t size )
+{
+    while( size > 0 )
+    {
+        const auto wr = write( fd, ptr, size );
+        if( wr <= 0 )
+        {
+            if( wr < 0 && errno == EINTR ) continue;
+            return false;
+        }
+        ptr += wr;
+        size -= wr;
+    }
+    return true;
+}
+}
+
+BitmapCache::BitmapCache( size_t maxSize )
+    : m_maxSize( maxSize )
+    , m_size( 0 )
+    , m_scanned( false )
+{
+    auto xdg = getenv( "XDG_CACHE_HOME" );
+    if( xdg && xdg[0] == '/' )
+    {
+        m_dir = std::string( xdg ) + "/vv";
+    }
+    else
+    {
+        const auto home = GetHome();
+        if( home.empty() ) return;
+        m_dir = home + "/.cache/vv";
+    }
+
+    std::error_code ec;
+    std::filesystem::create_directories( m_dir, ec );
+    if( !std::filesystem::is_directory( m_dir, ec ) )
+    {
+        mclog( LogLevel::Warning, "Failed to create cache directory %s", m_dir.c_str() );
+        m_dir.clear();
+    }
+}
+
+std::unique_ptr<Bitmap> BitmapCache::Get( const std::string& key ) const
+{
+    if( m_dir.empty() ) return nullptr;
+
+    const auto path = GetPath( key );
+    int fd = open( path.c_str(), O_RDONLY | O_CLOEXEC );
+    if( fd < 0 ) return nullptr;
+
+    std::unique_ptr<Bitmap> bitmap;
+    struct stat st;
+    Header hdr;
+    if( fstat( fd, &st ) == 0 && size_t( st.st_size ) > sizeof( Header ) && ReadAll( fd, (char*)&hdr, sizeof( Header ) ) &&
+        memcmp( hdr.magic, Magic, sizeof( Magic ) ) == 0 &&
+        hdr.keySize == key.size() &&
+        sizeof( Header ) + hdr.keySize + hdr.dataSize == size_t( st.st_size ) &&
+        hdr.width > 0 && hdr.height > 0 )
+    {
+        // The key is stored in the file to detect hash collisions
+        std::vector<char> buf( hdr.keySize + hdr.dataSize );
+        if( ReadAll( fd, buf.data(), buf.size() ) && memcmp( buf.data(), key.data(), key.size() ) == 0 )
+        {
+            const auto size = size_t( hdr.width ) * hdr.height * 4;
+            auto bmp = std::make_unique<Bitmap>( hdr.width, hdr.height );
+            if( LZ4_decompress_safe( buf.data() + hdr.keySize, (char*)bmp->Data(), hdr.dataSize, size ) == int( size ) )
+            {
+                bitmap = std::move( bmp );
+            }
+        }
+    }
+    close( fd );
+
+    if( bitmap )
+    {
+        // The modification time is the last use time for eviction, as access time may not be updated by the file system
+        utimensat( AT_FDCWD, path.c_str(), nullptr, 0 );
+        mclog( LogLevel::Info, "Cached bitmap found: %ux%u", bitmap->Width(), bitmap->Height() );
+    }
+    else
+    {
+        mclog( LogLevel::Debug, "Invalid cache entry %s", path.c_str() );
+    }
+    return bitmap;
+}
+
+void BitmapCache::Put( const std::string& key, const Bitmap& bitmap )
+{
+    if( m_dir.empty() ) return;
+
+    const auto size = size_t( bitmap.Width() ) * bitmap.Height() * 4;
+    if( size == 0 || size > LZ4_MAX_INPUT_SIZE ) return;
+
+    const auto offset = sizeof( Header ) + key.size();
+    std::vector<char> buf( offset + LZ4_compressBound( size ) );
+    const auto dataSize = LZ4_compress_default( (const char*)bitmap.Data(), buf.data() + offset, size, buf.size() - offset );
+    if( dataSize <= 0 ) return;
+
+    Header hdr;
+    memcpy( hdr.magic, Magic, sizeof( Magic ) );
+    hdr.width = bitmap.Width();
+    hdr.height = bitmap.Height();
+    hdr.keySize = key.size();
+    hdr.dataSize = dataSize;
+    memcpy( buf.data(), &hdr, sizeof( Header ) );
+    memcpy( buf.data() + sizeof( Header ), key.data(), key.size() );
+    const auto fileSize = offset + dataSize;
+
+    // The entry is written to a temporary file and renamed, so that readers never see a partial file
+    const auto path = GetPath( key );
+    auto tmp = path + ".XXXXXX";
+    int fd = mkstemp( tmp.data() );
+    if( fd < 0 ) return;
+    const auto ok = WriteAll( fd, buf.data(), fileSize );
+    close( fd );
+    if( !ok || rename( tmp.c_str(), path.c_str() ) != 0 )
+    {
+        unlink( tmp.c_str() );
+        return;
+    }
+
+    mclog( LogLevel::Debug, "Cached bitmap %ux%u in %zu bytes", hdr.width, hdr.height, fileSize );
+
+    std::lock_guard lock( m_lock );
+    if( m_scanned )
+    {
+        m_size += fileSize;
+        if( m_size > m_maxSize ) Evict();
+    }
+    else
+    {
+        Evict();
+    }
+}
+
+bool BitmapCache::Contains( const std::string& key ) const
+{
+    if( m_dir.empty() ) return false;
+
+    struct stat st;
+    return stat( GetPath( key ).c_str(), &st ) == 0 && size_t( st.st_size ) > sizeof( Header ) + key.size();
+}
+
+std::string BitmapCache::GetPath( const std::string& key ) const
+{
+    return std::format( "{}/{:016x}{}", m_dir, Hash( key ), Extension );
+}
+
+// Entries are removed oldest first until the cache is 3/4 full, so that
+// eviction does not need to scan the directory after every insertion. Stale
+// temporary files are removed as well.
+void BitmapCache::Evict()
+{
+    struct Entry
+    {
+        std::filesystem::path path;
+        std::filesystem::file_time_type time;
+        size_t size;
+    };
+
+    std::vector<Entry> entries;
+    size_t total = 0;
+    size_t stale = 0;
+
+    const auto staleTime = std::filesystem::file_time_type::clock::now() - StaleTempAge;
+
+    std::error_code ec;
+    for( auto& it : std::filesystem::directory_iterator( m_dir, ec ) )
+    {
+        // Temporary files are named <hash>.vvc.XXXXXX, see Put()
+        if( it.path().stem().extension() == Extension )
+        {
+            const auto time = it.last_write_time( ec );
+            if( !ec && time < staleTime && std::filesystem::remove( it.path(), ec ) ) stale++;
+            continue;
+        }
+        if( it.path().extension() != Extension || !it.is_regular_file( ec ) ) continue;
+        const auto size = it.file_size( ec );
+        if( ec ) continue;
+        const auto time = it.last_write_time( ec );
+        if( ec ) continue;
+        entries.emplace_back( Entry { it.path(), time, size } );
+        total += size;
+    }
+
+    if( stale > 0 ) mclog( LogLevel::Info, "Removed %zu stale temporary cache files", stale );
+
+    m_scanned = true;
+    m_size = total;
+    if( total <= m_maxSize ) return;
+
+    std::sort( entries.begin(), entries.end(), []( const auto& a, const auto& b ) { return a.time < b.time; } );
+
+    const auto limit = m_maxSize / 4 * 3;
+    size_t removed = 0;
+    for( auto& e : entries )
+    {
+        if( total <= limit ) break;
+        if( std::filesystem::remove( e.path, ec ) )
+        {
+            total -= e.size;
+            removed++;
+        }
+    }
+
+    mclog( LogLevel::Info, "Evicted %zu cache entries, %zu bytes left", removed, total );
+    m_size = total;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <stddef.h>
+#include <string>
+
+#include "NoCopy.hpp"
+
+class Bitmap;
+
+// Persistent cache of display-ready bitmaps, stored LZ4 compressed in
+// $XDG_CACHE_HOME/vv. The key must identify both the source file and
+// everything that affects the final bitmap. When the total size of the cache
+// exceeds the limit, the least recently used entries are removed.
+class BitmapCache
+{
+public:
+    explicit BitmapCache( size_t maxSize = 256 * 1024 * 1024 );
+
+    NoCopy( BitmapCache );
+
+    [[nodiscard]] std::unique_ptr<Bitmap> Get( const std::string& key ) const;
+    void Put( const std::string& key, const Bitmap& bitmap );
+
+    // Checks if there is an entry for the key, without reading it. The entry is
+    // not validated, so Get() may still fail.
+    [[nodiscard]] bool Contains( const std::string& key ) const;
+
+private:
+    [[nodiscard]] std::string GetPath( const std::string& key ) const;
+    void Evict();
+
+    std::string m_dir;
+    size_t m_maxSize;
+
+    std::mutex m_lock;
+    size_t m_size;
+    bool m_scanned;
+};
@@ -1,12 +1,18 @@
+#include <algorithm>
 #include <cmath>
 
+#include <stb_image_resize2.h>
+
 #include "Bitmap.hpp"
 #include "BitmapHdr.hpp"
+#include "TaskDispatch.hpp"
 
-BitmapHdr::BitmapHdr( uint32_t width, uint32_t height )
+BitmapHdr::BitmapHdr( uint32_t width, uint32_t height, Format format )
     : m_width( width )
     , m_height( height )
-    , m_data( new float[width*height*4] )
+    , m_format( format )
+    , m_premultiplied( false )
+    , m_data( new uint8_t[width*height*PixelSize()] )
 {
 }
 
@@ -15,9 +21,58 @@ BitmapHdr::~BitmapHdr()
     delete[] m_data;
 }
 
-std::unique_ptr<Bitmap> BitmapHdr::Tonemap( ToneMap::Operator op )
+std::unique_ptr<BitmapHdr> BitmapHdr::ResizeNew( uint32_t width, uint32_t height ) const
+{
+    auto ret = std::make_unique<BitmapHdr>( width, height, m_format );
+    ret->m_premultiplied = m_premultiplied;
+
+    const auto layout = m_premultiplied ? STBIR_RGBA_PM : STBIR_RGBA;
+    if( m_format == Format::Half )
+    {
+        stbir_resize( m_data, m_width, m_height, 0, ret->m_data, width, height, 0, layout, STBIR_TYPE_HALF_FLOAT, STBIR_EDGE_CLAMP, STBIR_FILTER_DEFAULT );
+    }
+    else
+    {
+        stbir_resize_float_linear( (const float*)m_data, m_width, m_height, 0, (float*)ret->m_data, width, height, 0, layout );
+    }
+    return ret;
+}
+
+namespace
+{
+template<typename T>
+void TonemapChunked( ToneMap::Operator op, uint32_t* dst, T* src, size_t sz, TaskDispatch* td )
+{
+    if( !td )
+    {
+        ToneMap::Process( op, dst, src, sz );
+        return;
+    }
+
+    while( sz > 0 )
+    {
+        const auto chunk = std::min( sz, size_t( 16 * 1024 ) );
+        td->Queue( [src, dst, chunk, op] {
+            ToneMap::Process( op, dst, src, chunk );
+        } );
+        src += chunk * 4;
+        dst += chunk;
+        sz -= chunk;
+    }
+    td->Sync();
+}
+}
+
+std::unique_ptr<Bitmap> BitmapHdr::Tonemap( ToneMap::Operator op, TaskDispatch* td )
 {
     auto bmp = std::make_unique<Bitmap>( m_width, m_height );
-    ToneMap::Process( op, (uint32_t*)bmp->Data(), m_data, m_width * m_height );
+    if( m_format == Format::Half )
+    {
+        TonemapChunked( op, (uint32_t*)bmp->Data(), (const uint16_t*)m_data, m_width * m_height, td );
+    }
+    else
+    {
+        TonemapChunked( op, (uint32_t*)bmp->Data(), (float*)m_data, m_width * m_height, td );
+    }
     return bmp;
 }
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <assert.h>
 #include <memory>
 #include <stdint.h>
 
@@ -7,23 +8,43 @@
 #include "Tonemapper.hpp"
 
 class Bitmap;
+class TaskDispatch;
 
 class BitmapHdr
 {
 public:
-    BitmapHdr( uint32_t width, uint32_t height );
+    enum class Format
+    {
+        Float,
+        Half
+    };
+
+    BitmapHdr( uint32_t width, uint32_t height, Format format = Format::Float );
     ~BitmapHdr();
     NoCopy( BitmapHdr );
 
     [[nodiscard]] uint32_t Width() const { return m_width; }
     [[nodiscard]] uint32_t Height() const { return m_height; }
-    [[nodiscard]] float* Data() { return m_data; }
-    [[nodiscard]] const float* Data() const { return m_data; }
+    [[nodiscard]] Format GetFormat() const { return m_format; }
+
+    // Color values with premultiplied alpha, as in EXR files, are resampled as is
+    void SetPremultiplied( bool premultiplied ) { m_premultiplied = premultiplied; }
+    [[nodiscard]] bool IsPremultiplied() const { return m_premultiplied; }
 
-    [[nodiscard]] std::unique_ptr<Bitmap> Tonemap( ToneMap::Operator op );
+    [[nodiscard]] float* Data() { assert( m_format == Format::Float ); return (float*)m_data; }
+    [[nodiscard]] const float* Data() const { assert( m_format == Format::Float ); return (const float*)m_data; }
+    [[nodiscard]] uint16_t* DataHalf() { assert( m_format == Format::Half ); return (uint16_t*)m_data; }
+    [[nodiscard]] const uint16_t* DataHalf() const { assert( m_format == Format::Half ); return (const uint16_t*)m_data; }
+
+    [[nodiscard]] std::unique_ptr<BitmapHdr> ResizeNew( uint32_t width, uint32_t height ) const;
+    [[nodiscard]] std::unique_ptr<Bitmap> Tonemap( ToneMap::Operator op, TaskDispatch* td = nullptr );
 
 private:
+    [[nodiscard]] size_t PixelSize() const { return m_format == Format::Half ? 4 * sizeof( uint16_t ) : 4 * sizeof( float ); }
+
     uint32_t m_width;
     uint32_t m_height;
-    float* m_data;
+    Format m_format;
+    bool m_premultiplied;
+    uint8_t* m_data;
 };
@@ -0,0 +1,32 @@
+#include <format>
+#include <lcms2.h>
+#include <mutex>
+#include <unordered_map>
+
+#include "ColorTransform.hpp"
+
+std::shared_ptr<void> GetColorTransform( const std::string& key, uint32_t typeIn, uint32_t typeOut, uint32_t flags, const std::function<std::pair<void*, void*>()>& createProfiles )
+{
+    constexpr size_t MaxCachedTransforms = 16;
+
+    static std::mutex lock;
+    static std::unordered_map<std::string, std::shared_ptr<void>> cache;
+
+    flags |= cmsFLAGS_NOCACHE;
+    auto fullKey = std::format( "{} {} {}\n", typeIn, typeOut, flags );
+    fullKey.append( key );
+
+    std::lock_guard guard( lock );
+    if( auto it = cache.find( fullKey ); it != cache.end() ) return it->second;
+
+    auto [profileIn, profileOut] = createProfiles();
+    cmsHTRANSFORM transform = nullptr;
+    if( profileIn && profileOut ) transform = cmsCreateTransform( profileIn, typeIn, profileOut, typeOut, INTENT_PERCEPTUAL, flags );
+    if( profileOut ) cmsCloseProfile( profileOut );
+    if( profileIn ) cmsCloseProfile( profileIn );
+    if( !transform ) return nullptr;
+
+    std::shared_ptr<void> ret( transform, cmsDeleteTransform );
+    if( cache.size() < MaxCachedTransforms ) cache.emplace( std::move( fullKey ), ret );
+    return ret;
+}
@@ -0,0 +1,14 @@
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <stdint.h>
+#include <string>
+#include <utility>
+
+// Returns a perceptual intent transform between two color profiles. Images
+// from the same source carry the same profiles, so transforms are shared by
+// key, which must identify both profiles. The input and output profiles are
+// made by the callback only if the transform is not cached. The 1-pixel cache
+// is disabled to make a transform usable from several threads at once.
+std::shared_ptr<void> GetColorTransform( const std::string& key, uint32_t typeIn, uint32_t typeOut, uint32_t flags, const std::function<std::pair<void*, void*>()>& createProfiles );
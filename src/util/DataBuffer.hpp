@@ -5,12 +5,23 @@
 class DataBuffer
 {
 public:
+    enum class Access
+    {
+        Sequential,
+        Random
+    };
+
     DataBuffer( const char* data, size_t size ) : m_data( data ), m_size( size ) {}
     virtual ~DataBuffer() = default;
 
     [[nodiscard]] const char* data() const { return m_data; }
     [[nodiscard]] size_t size() const { return m_size; }
 
+    // Access pattern hints for file backed buffers. Sequential access reads
+    // the whole buffer ahead, random access only the prefetched ranges.
+    virtual void Advise( Access ) const {}
+    virtual void Prefetch( size_t, size_t ) const {}
+
 protected:
     DataBuffer() : m_data( nullptr ), m_size( 0 ) {}
 
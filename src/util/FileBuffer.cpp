@@ -1,5 +1,7 @@
+#include <algorithm>
 #include <format>
 #include <sys/mman.h>
+#include <unistd.h>
 
 #include "FileBuffer.hpp"
 #include "FileWrapper.hpp"
@@ -21,7 +23,7 @@ FileBuffer::FileBuffer( const char* fn )
     m_size = ftell( file );
     fseek( file, 0, SEEK_SET );
 
-    m_data = (const char*)mmap( nullptr, m_size, PROT_READ, MAP_SHARED, fileno( file ), 0 );
+    Map( fileno( file ) );
 }
 
 FileBuffer::FileBuffer( FILE* file )
@@ -32,7 +34,7 @@ FileBuffer::FileBuffer( FILE* file )
     m_size = ftell( file );
     fseek( file, 0, SEEK_SET );
 
-    m_data = (const char*)mmap( nullptr, m_size, PROT_READ, MAP_SHARED, fileno( file ), 0 );
+    Map( fileno( file ) );
 }
 
 FileBuffer::FileBuffer( const std::shared_ptr<FileWrapper>& file )
@@ -40,7 +42,79 @@ FileBuffer::FileBuffer( const std::shared_ptr<FileWrapper>& file )
 {
 }
 
+namespace
+{
+// Below this size a single read is cheaper than setting up and faulting in a mapping
+constexpr size_t SmallFileSize = 128 * 1024;
+}
+
 FileBuffer::~FileBuffer()
 {
-    if( m_data ) munmap( (void*)m_data, m_size );
+    if( m_mapped )
+    {
+        munmap( (void*)m_data, m_size );
+    }
+    else
+    {
+        delete[] m_data;
+    }
+}
+
+void FileBuffer::Advise( Access access ) const
+{
+    if( !m_mapped ) return;
+    if( access == Access::Sequential )
+    {
+        madvise( (void*)m_data, m_size, MADV_SEQUENTIAL );
+        madvise( (void*)m_data, m_size, MADV_WILLNEED );
+    }
+    else
+    {
+        madvise( (void*)m_data, m_size, MADV_RANDOM );
+    }
+}
+
+void FileBuffer::Prefetch( size_t offset, size_t size ) const
+{
+    if( !m_mapped || offset >= m_size ) return;
+    size = std::min( size, m_size - offset );
+
+    const auto page = size_t( sysconf( _SC_PAGESIZE ) );
+    const auto start = offset & ~( page - 1 );
+    madvise( (void*)( m_data + start ), offset + size - start, MADV_WILLNEED );
+}
+
+void FileBuffer::Map( int fd )
+{
+    // Empty files and non-seekable streams can't be mapped; loaders see them as an empty buffer
+    if( m_size == 0 || m_size == size_t( -1 ) )
+    {
+        m_size = 0;
+        return;
+    }
+
+    if( m_size <= SmallFileSize )
+    {
+        auto buf = new char[m_size];
+        size_t done = 0;
+        while( done < m_size )
+        {
+            const auto rd = pread( fd, buf + done, m_size - done, done );
+            if( rd <= 0 ) break;
+            done += rd;
+        }
+        m_data = buf;
+        m_size = done;
+        return;
+    }
+
+    auto ptr = mmap( nullptr, m_size, PROT_READ, MAP_SHARED, fd, 0 );
+    if( ptr == MAP_FAILED )
+    {
+        mclog( LogLevel::Error, "Failed to map file" );
+        m_size = 0;
+        return;
+    }
+    m_data = (const char*)ptr;
+    m_mapped = true;
 }
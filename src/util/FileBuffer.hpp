@@ -21,4 +21,12 @@ public:
     ~FileBuffer() override;
 
     NoCopy( FileBuffer );
+
+    void Advise( Access access ) const override;
+    void Prefetch( size_t offset, size_t size ) const override;
+
+private:
+    void Map( int fd );
+
+    bool m_mapped = false;
 };
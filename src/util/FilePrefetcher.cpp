@@ -0,0 +1,225 @@
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef HAVE_LIBURING
+#  include <liburing.h>
+#endif
+
+#include "DataBuffer.hpp"
+#include "FilePrefetcher.hpp"
+#include "Home.hpp"
+#include "Logs.hpp"
+
+namespace
+{
+constexpr unsigned int RingSize = 64;
+constexpr size_t ChunkSize = 1024 * 1024;
+
+class HeapBuffer : public DataBuffer
+{
+public:
+    explicit HeapBuffer( size_t size ) : DataBuffer( new char[size], size ) {}
+    ~HeapBuffer() override { delete[] m_data; }
+
+    NoCopy( HeapBuffer );
+
+    [[nodiscard]] char* Data() { return (char*)m_data; }
+};
+}
+
+struct FilePrefetcher::Entry
+{
+    struct Read
+    {
+        Entry* entry;
+        size_t offset;
+        size_t size;
+    };
+
+    int fd = -1;
+    size_t size = 0;
+    std::shared_ptr<HeapBuffer> buf;
+    std::vector<Read> reads;
+    std::vector<Read*> unsent;
+    size_t pending = 0;
+    bool failed = false;
+
+    ~Entry()
+    {
+        if( fd >= 0 ) close( fd );
+    }
+};
+
+FilePrefetcher::FilePrefetcher( std::vector<std::string> files, Filter filter, size_t depth, size_t maxBytes )
+    : m_files( std::move( files ) )
+    , m_filter( std::move( filter ) )
+    , m_depth( std::max<size_t>( 1, depth ) )
+    , m_maxBytes( maxBytes )
+    , m_bytes( 0 )
+    , m_next( 0 )
+    , m_queued( 0 )
+    , m_ring( nullptr )
+    , m_inflight( 0 )
+{
+#ifdef HAVE_LIBURING
+    auto ring = new io_uring;
+    const auto ret = io_uring_queue_init( RingSize, ring, 0 );
+    if( ret == 0 )
+    {
+        m_ring = ring;
+        Queue();
+    }
+    else
+    {
+        mclog( LogLevel::Warning, "io_uring is not available (%s), using blocking I/O", strerror( -ret ) );
+        delete ring;
+    }
+#endif
+}
+
+FilePrefetcher::~FilePrefetcher()
+{
+#ifdef HAVE_LIBURING
+    if( m_ring )
+    {
+        // The kernel may still write to the buffers of files that were never requested
+        for( auto& e : m_entries ) e->unsent.clear();
+        while( m_inflight > 0 ) Reap( true );
+        io_uring_queue_exit( m_ring );
+        delete m_ring;
+    }
+#endif
+}
+
+std::shared_ptr<DataBuffer> FilePrefetcher::Next()
+{
+    if( m_next == m_files.size() ) return nullptr;
+    if( !m_ring )
+    {
+        m_next++;
+        return nullptr;
+    }
+
+    auto& entry = *m_entries.front();
+    while( entry.pending > 0 || !entry.unsent.empty() )
+    {
+        if( entry.pending == 0 )
+        {
+            Submit();
+        }
+        else
+        {
+            Reap( true );
+        }
+    }
+
+    std::shared_ptr<DataBuffer> ret;
+    if( !entry.failed && entry.buf ) ret = std::move( entry.buf );
+
+    m_bytes -= entry.size;
+    m_entries.pop_front();
+    m_next++;
+    Queue();
+    return ret;
+}
+
+void FilePrefetcher::Queue()
+{
+#ifdef HAVE_LIBURING
+    // The next file is always read, even if it alone is larger than the budget
+    while( m_queued < m_files.size() && m_queued < m_next + m_depth && ( m_queued == m_next || m_bytes < m_maxBytes ) )
+    {
+        auto& entry = *m_entries.emplace_back( std::make_unique<Entry>() );
+        const auto& fn = m_files[m_queued++];
+        if( fn == "-" || ( m_filter && !m_filter( fn ) ) ) continue;
+
+        const auto path = ExpandHome( fn.c_str() );
+        entry.fd = open( path.c_str(), O_RDONLY | O_CLOEXEC );
+        if( entry.fd < 0 ) continue;
+
+        struct stat st;
+        if( fstat( entry.fd, &st ) != 0 || !S_ISREG( st.st_mode ) || st.st_size == 0 ) continue;
+
+        const size_t size = st.st_size;
+        entry.size = size;
+        m_bytes += size;
+        entry.buf = std::make_shared<HeapBuffer>( size );
+        entry.reads.resize( ( size + ChunkSize - 1 ) / ChunkSize );
+        entry.unsent.reserve( entry.reads.size() );
+        for( size_t i=0; i<entry.reads.size(); i++ )
+        {
+            entry.reads[i] = { &entry, i * ChunkSize, std::min( ChunkSize, size - i * ChunkSize ) };
+        }
+        for( auto it = entry.reads.rbegin(); it != entry.reads.rend(); ++it ) entry.unsent.push_back( &*it );
+    }
+    Submit();
+#endif
+}
+
+void FilePrefetcher::Submit()
+{
+#ifdef HAVE_LIBURING
+    // Files are filled in order, so the one needed next is always at the front of the queue.
+    // The number of reads in flight is limited to the ring size, so completions can't overflow.
+    bool submit = false;
+    for( auto& e : m_entries )
+    {
+        while( !e->unsent.empty() && m_inflight < RingSize )
+        {
+            auto sqe = io_uring_get_sqe( m_ring );
+            if( !sqe ) break;
+
+            auto read = e->unsent.back();
+            e->unsent.pop_back();
+            e->pending++;
+            m_inflight++;
+            io_uring_prep_read( sqe, e->fd, e->buf->Data() + read->offset, read->size, read->offset );
+            io_uring_sqe_set_data( sqe, read );
+            submit = true;
+        }
+        if( !e->unsent.empty() ) break;
+    }
+    if( submit ) io_uring_submit( m_ring );
+#endif
+}
+
+void FilePrefetcher::Reap( [[maybe_unused]] bool wait )
+{
+#ifdef HAVE_LIBURING
+    io_uring_cqe* cqe;
+    int ret = wait ? io_uring_wait_cqe( m_ring, &cqe ) : io_uring_peek_cqe( m_ring, &cqe );
+    while( ret == 0 )
+    {
+        auto read = (Entry::Read*)io_uring_cqe_get_data( cqe );
+        auto& entry = *read->entry;
+        const auto res = cqe->res;
+        io_uring_cqe_seen( m_ring, cqe );
+
+        entry.pending--;
+        m_inflight--;
+        if( res == -EAGAIN || res == -EINTR )
+        {
+            entry.unsent.push_back( read );
+        }
+        else if( res <= 0 )
+        {
+            // Read error, or the file was truncated after it was queued
+            entry.failed = true;
+            entry.unsent.clear();
+        }
+        else if( size_t( res ) < read->size )
+        {
+            read->offset += res;
+            read->size -= res;
+            entry.unsent.push_back( read );
+        }
+
+        ret = io_uring_peek_cqe( m_ring, &cqe );
+    }
+    Submit();
+#endif
+}
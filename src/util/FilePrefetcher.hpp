@@ -0,0 +1,55 @@
+#pragma once
+
+#include <deque>
+#include <functional>
+#include <memory>
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+#include "NoCopy.hpp"
+
+class DataBuffer;
+struct io_uring;
+
+// Reads the files of a batch ahead of their use. With io_uring the contents of
+// the next few files are read asynchronously while the current one is decoded.
+// At most depth files are read ahead, and no new file is started while the
+// data waiting to be taken exceeds maxBytes. The optional filter is called for
+// each file just before it would be read, and may skip files that won't be
+// needed, e.g. because their decoded contents are cached.
+class FilePrefetcher
+{
+    struct Entry;
+
+public:
+    using Filter = std::function<bool( const std::string& )>;
+
+    explicit FilePrefetcher( std::vector<std::string> files, Filter filter = {}, size_t depth = 4, size_t maxBytes = 256 * 1024 * 1024 );
+    ~FilePrefetcher();
+
+    NoCopy( FilePrefetcher );
+
+    // Returns the contents of the next file in the list. If the file was not
+    // prefetched (io_uring is not available, the file is not a regular file, it
+    // can't be read or it was skipped by the filter), nullptr is returned and
+    // the file should be opened with blocking I/O.
+    [[nodiscard]] std::shared_ptr<DataBuffer> Next();
+
+private:
+    void Queue();
+    void Submit();
+    void Reap( bool wait );
+
+    std::vector<std::string> m_files;
+    Filter m_filter;
+    size_t m_depth;
+    size_t m_maxBytes;
+    size_t m_bytes;
+    size_t m_next;
+    size_t m_queued;
+
+    io_uring* m_ring;
+    size_t m_inflight;
+    std::deque<std::unique_ptr<Entry>> m_entries;
+};
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined __F16C__
+#  include <x86intrin.h>
+#endif
+
+static inline float HalfToFloat( uint16_t h )
+{
+    const uint32_t s = uint32_t( h & 0x8000 ) << 16;
+    const uint32_t e = ( h >> 10 ) & 0x1F;
+    const uint32_t m = h & 0x3FF;
+
+    uint32_t f;
+    if( e == 0 )
+    {
+        const float v = m * ( 1.f / 16777216.f );
+        memcpy( &f, &v, sizeof( f ) );
+        f |= s;
+    }
+    else if( e == 31 )
+    {
+        f = s | 0x7F800000 | ( m << 13 );
+    }
+    else
+    {
+        f = s | ( ( e + 112 ) << 23 ) | ( m << 13 );
+    }
+
+    float ret;
+    memcpy( &ret, &f, sizeof( ret ) );
+    return ret;
+}
+
+static inline void HalfToFloat( float* dst, const uint16_t* src, size_t sz )
+{
+#if defined __AVX512F__
+    while( sz >= 16 )
+    {
+        _mm512_storeu_ps( dst, _mm512_cvtph_ps( _mm256_loadu_si256( (const __m256i*)src ) ) );
+        dst += 16;
+        src += 16;
+        sz -= 16;
+    }
+#endif
+#if defined __F16C__
+    while( sz >= 8 )
+    {
+        _mm256_storeu_ps( dst, _mm256_cvtph_ps( _mm_loadu_si128( (const __m128i*)src ) ) );
+        dst += 8;
+        src += 8;
+        sz -= 8;
+    }
+#endif
+    while( sz-- ) *dst++ = HalfToFloat( *src++ );
+}
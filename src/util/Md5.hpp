@@ -0,0 +1,10 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+// MD5 as specified in RFC 1321. Not for security purposes, only to compute
+// names required by external formats.
+void Md5( const void* data, size_t size, uint8_t digest[16] );
+std::string Md5Hex( const std::string& str );
@@ -0,0 +1,66 @@
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "StreamBuffer.hpp"
+#include "util/Logs.hpp"
+
+namespace
+{
+constexpr size_t InitialCapacity = 1024 * 1024;
+constexpr size_t HugePageThreshold = 16 * 1024 * 1024;
+}
+
+StreamBuffer::StreamBuffer( int fd )
+    : m_capacity( 0 )
+{
+    auto ptr = (char*)mmap( nullptr, InitialCapacity, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+    if( ptr == MAP_FAILED )
+    {
+        mclog( LogLevel::Error, "Failed to allocate stream buffer" );
+        return;
+    }
+
+    size_t capacity = InitialCapacity;
+    size_t size = 0;
+    for(;;)
+    {
+        if( size == capacity )
+        {
+            // The mapping grows in place or is moved by the kernel, without copying the data
+            auto grow = (char*)mremap( ptr, capacity, capacity * 2, MREMAP_MAYMOVE );
+            if( grow == MAP_FAILED )
+            {
+                mclog( LogLevel::Error, "Failed to grow stream buffer to %zu bytes", capacity * 2 );
+                break;
+            }
+            ptr = grow;
+            capacity *= 2;
+#ifdef MADV_HUGEPAGE
+            if( capacity >= HugePageThreshold ) madvise( ptr, capacity, MADV_HUGEPAGE );
+#endif
+        }
+
+        const auto rd = read( fd, ptr + size, capacity - size );
+        if( rd == 0 ) break;
+        if( rd < 0 )
+        {
+            if( errno == EINTR ) continue;
+            mclog( LogLevel::Error, "Failed to read stream: %s", strerror( errno ) );
+            break;
+        }
+        size += rd;
+    }
+
+    mclog( LogLevel::Debug, "Buffered %zu bytes from stream", size );
+
+    m_data = ptr;
+    m_size = size;
+    m_capacity = capacity;
+}
+
+StreamBuffer::~StreamBuffer()
+{
+    if( m_data ) munmap( (void*)m_data, m_capacity );
+}
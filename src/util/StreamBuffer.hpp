@@ -0,0 +1,19 @@
+#pragma once
+
+#include <stddef.h>
+
+#include "DataBuffer.hpp"
+#include "NoCopy.hpp"
+
+// Reads a non-seekable file descriptor (stdin, pipe, socket) to its end.
+class StreamBuffer : public DataBuffer
+{
+public:
+    explicit StreamBuffer( int fd );
+    ~StreamBuffer() override;
+
+    NoCopy( StreamBuffer );
+
+private:
+    size_t m_capacity;
+};
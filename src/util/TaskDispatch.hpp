@@ -24,6 +24,8 @@ public:
 
     void Sync();
 
+    [[nodiscard]] size_t NumWorkers() const { return m_numWorkers; }
+
 private:
     void Worker();
     void SetName( const char* name, size_t num );
@@ -33,6 +35,7 @@ private:
     std::condition_variable m_cvWork, m_cvJobs;
     std::atomic<bool> m_exit;
     size_t m_jobs;
+    size_t m_numWorkers;
 
     std::vector<std::thread> m_workers;
 
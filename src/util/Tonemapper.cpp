@@ -1,11 +1,29 @@
+#include <algorithm>
 #include <assert.h>
 #include <cmath>
 
+#include "Half.hpp"
 #include "Tonemapper.hpp"
+#include "TonemapperSrgb.hpp"
 
 namespace ToneMap
 {
 
+uint8_t SrgbLut[SrgbLutSize + 3];
+
+// Each entry holds the encoded value at the center of its mantissa bucket
+[[maybe_unused]] static const bool SrgbLutInit = [] {
+    for( uint32_t i=0; i<SrgbLutSize; i++ )
+    {
+        const uint32_t lo = ( i + SrgbLutBase ) << 15;
+        const uint32_t mid = lo | ( 1 << 14 );
+        float x;
+        memcpy( &x, i == SrgbLutSize - 1 ? &lo : &mid, sizeof( x ) );
+        SrgbLut[i] = uint8_t( std::lround( std::clamp( LinearToSrgb( x ), 0.f, 1.f ) * 255.f ) );
+    }
+    return true;
+}();
+
 void Process( Operator op, uint32_t* dst, float* src, size_t sz )
 {
     switch( op )
@@ -27,6 +45,23 @@ void Process( Operator op, uint32_t* dst, float* src, size_t sz )
     }
 }
 
+// Half input is expanded in small blocks that stay in L1 while the operator runs
+void Process( Operator op, uint32_t* dst, const uint16_t* src, size_t sz )
+{
+    constexpr size_t BlockSize = 1024;
+    alignas( 64 ) float tmp[BlockSize * 4];
+
+    while( sz > 0 )
+    {
+        const auto block = std::min( sz, BlockSize );
+        HalfToFloat( tmp, src, block * 4 );
+        Process( op, dst, tmp, block );
+        dst += block;
+        src += block * 4;
+        sz -= block;
+    }
+}
+
 float LinearToSrgb( float x )
 {
     if( x <= 0.0031308f ) return 12.92f * x;
@@ -15,6 +15,7 @@ enum class Operator
 };
 
 void Process( Operator op, uint32_t* dst, float* src, size_t sz );
+void Process( Operator op, uint32_t* dst, const uint16_t* src, size_t sz );
 
 
 struct HdrColor
@@ -2,23 +2,52 @@
 
 #include <algorithm>
 #include <array>
+#include <cfloat>
 #include <cmath>
 
 #include "Tonemapper.hpp"
+#include "TonemapperSrgb.hpp"
 
 namespace ToneMap
 {
 
-float AgxCurve( float x )
+namespace
 {
-    constexpr auto threshold = 0.6060606060606061f;
-    constexpr auto a_up = 69.86278913545539f;
-    constexpr auto a_down = 59.507875f;
-    constexpr auto b_up = 13.0f / 4.0f;
-    constexpr auto b_down = 3.0f;
-    constexpr auto c_up = -4.0f / 13.0f;
-    constexpr auto c_down = -1.0f / 3.0f;
+constexpr auto threshold = 0.6060606060606061f;
+constexpr auto a_up = 69.86278913545539f;
+constexpr auto a_down = 59.507875f;
+constexpr auto b_up = 13.0f / 4.0f;
+constexpr auto b_down = 3.0f;
+constexpr auto c_up = -4.0f / 13.0f;
+constexpr auto c_down = -1.0f / 3.0f;
+
+constexpr auto min_ev = -12.473931188332413f;
+constexpr auto max_ev = 4.026068811667588f;
+constexpr auto range = max_ev - min_ev;
+constexpr auto invrange = 1.f / range;
+
+constexpr std::array agx_mat = {
+    0.8424010709504686f, 0.04240107095046854f, 0.04240107095046854f,
+    0.07843650156180276f, 0.8784365015618028f, 0.07843650156180276f,
+    0.0791624274877287f, 0.0791624274877287f, 0.8791624274877287f
+};
 
+constexpr std::array agx_mat_inv = {
+    1.1969986613119143f, -0.053001338688085674f, -0.053001338688085674f,
+    -0.09804562695225345f, 1.1519543730477466f, -0.09804562695225345f,
+    -0.09895303435966087f, -0.09895303435966087f, 1.151046965640339f
+};
+
+enum class Look
+{
+    None,
+    Golden,
+    Punchy
+};
+}
+
+float AgxCurve( float x )
+{
     const float mask = x < threshold ? 0.f : 1.f;
     const float a = a_up + (a_down - a_up) * mask;
     const float b = b_up + (b_down - b_up) * mask;
@@ -29,17 +58,6 @@ float AgxCurve( float x )
 
 HdrColor AgxTransform( const HdrColor& hdr )
 {
-    constexpr auto min_ev = -12.473931188332413f;
-    constexpr auto max_ev = 4.026068811667588f;
-    constexpr auto range = max_ev - min_ev;
-    constexpr auto invrange = 1.f / range;
-
-    constexpr std::array agx_mat = {
-        0.8424010709504686f, 0.04240107095046854f, 0.04240107095046854f,
-        0.07843650156180276f, 0.8784365015618028f, 0.07843650156180276f,
-        0.0791624274877287f, 0.0791624274877287f, 0.8791624274877287f
-    };
-
     const HdrColor c1 = {
         agx_mat[0] * hdr.r + agx_mat[1] * hdr.g + agx_mat[2] * hdr.b,
         agx_mat[3] * hdr.r + agx_mat[4] * hdr.g + agx_mat[5] * hdr.b,
@@ -94,12 +112,6 @@ HdrColor AgxLookPunchy( const HdrColor& color )
 
 HdrColor AgxEotf( const HdrColor& color )
 {
-    constexpr std::array agx_mat_inv = {
-        1.1969986613119143f, -0.053001338688085674f, -0.053001338688085674f,
-        -0.09804562695225345f, 1.1519543730477466f, -0.09804562695225345f,
-        -0.09895303435966087f, -0.09895303435966087f, 1.151046965640339f
-    };
-
     const HdrColor out = {
         agx_mat_inv[0] * color.r + agx_mat_inv[1] * color.g + agx_mat_inv[2] * color.b,
         agx_mat_inv[3] * color.r + agx_mat_inv[4] * color.g + agx_mat_inv[5] * color.b,
@@ -115,72 +127,391 @@ HdrColor AgxEotf( const HdrColor& color )
     };
 }
 
-void AgX( uint32_t* dst, float* src, size_t sz )
+#if defined __SSE4_1__ && defined __FMA__
+// Exponent is clamped, as _mm_exp_ps() can't produce denormals and log2(0) is -127
+__m128 Pow128( __m128 x, __m128 y )
 {
-    do
-    {
-        auto color = AgxTransform( { src[0], src[1], src[2] } );
-        color = AgxEotf( color );
+    return _mm_exp_ps( _mm_max_ps( _mm_mul_ps( y, _mm_log_ps( x ) ), _mm_set1_ps( -126.f ) ) );
+}
 
-        const auto r = LinearToSrgb( color.r );
-        const auto g = LinearToSrgb( color.g );
-        const auto b = LinearToSrgb( color.b );
-        const auto a = src[3];
+__m128i Quantize128( __m128 x )
+{
+    __m128 v0 = _mm_min_ps( _mm_max_ps( x, _mm_setzero_ps() ), _mm_set1_ps( 1.0f ) );
+    return _mm_cvtps_epi32( _mm_mul_ps( v0, _mm_set1_ps( 255.0f ) ) );
+}
 
-        *dst++ = (uint32_t( std::clamp( a, 0.0f, 1.0f ) * 255.0f ) << 24) |
-                 (uint32_t( std::clamp( b, 0.0f, 1.0f ) * 255.0f ) << 16) |
-                 (uint32_t( std::clamp( g, 0.0f, 1.0f ) * 255.0f ) << 8) |
-                  uint32_t( std::clamp( r, 0.0f, 1.0f ) * 255.0f );
+void AgxCurve128( __m128& x )
+{
+    __m128 mask = _mm_cmpge_ps( x, _mm_set1_ps( threshold ) );
+    __m128 a = _mm_blendv_ps( _mm_set1_ps( a_up ), _mm_set1_ps( a_down ), mask );
+    __m128 b = _mm_blendv_ps( _mm_set1_ps( b_up ), _mm_set1_ps( b_down ), mask );
+    __m128 c = _mm_blendv_ps( _mm_set1_ps( c_up ), _mm_set1_ps( c_down ), mask );
 
-        src += 4;
-    }
-    while( --sz );
+    __m128 t0 = _mm_andnot_ps( _mm_set1_ps( -0.f ), _mm_sub_ps( x, _mm_set1_ps( threshold ) ) );
+    __m128 t1 = Pow128( t0, b );
+    __m128 t2 = _mm_fmadd_ps( a, t1, _mm_set1_ps( 1.f ) );
+    __m128 t3 = Pow128( t2, c );
+    __m128 t4 = _mm_fmsub_ps( x, _mm_set1_ps( 2.f ), _mm_set1_ps( 2.f * threshold ) );
+    x = _mm_fmadd_ps( t4, t3, _mm_set1_ps( 0.5f ) );
 }
 
-void AgXGolden( uint32_t* dst, float* src, size_t sz )
+void AgxLog128( __m128& x )
 {
-    do
-    {
-        auto color = AgxTransform( { src[0], src[1], src[2] } );
-        color = AgxLookGolden( color );
-        color = AgxEotf( color );
+    __m128 t0 = _mm_max_ps( x, _mm_set1_ps( FLT_MIN ) );
+    __m128 t1 = _mm_log_ps( t0 );
+    __m128 t2 = _mm_fmadd_ps( t1, _mm_set1_ps( invrange ), _mm_set1_ps( -min_ev * invrange ) );
+    x = _mm_min_ps( _mm_max_ps( t2, _mm_setzero_ps() ), _mm_set1_ps( 1.f ) );
+}
 
-        const auto r = LinearToSrgb( color.r );
-        const auto g = LinearToSrgb( color.g );
-        const auto b = LinearToSrgb( color.b );
-        const auto a = src[3];
+void AgxTransform128( __m128& r, __m128& g, __m128& b )
+{
+    __m128 r0 = _mm_fmadd_ps( r, _mm_set1_ps( agx_mat[0] ), _mm_fmadd_ps( g, _mm_set1_ps( agx_mat[1] ), _mm_mul_ps( b, _mm_set1_ps( agx_mat[2] ) ) ) );
+    __m128 g0 = _mm_fmadd_ps( r, _mm_set1_ps( agx_mat[3] ), _mm_fmadd_ps( g, _mm_set1_ps( agx_mat[4] ), _mm_mul_ps( b, _mm_set1_ps( agx_mat[5] ) ) ) );
+    __m128 b0 = _mm_fmadd_ps( r, _mm_set1_ps( agx_mat[6] ), _mm_fmadd_ps( g, _mm_set1_ps( agx_mat[7] ), _mm_mul_ps( b, _mm_set1_ps( agx_mat[8] ) ) ) );
 
-        *dst++ = (uint32_t( std::clamp( a, 0.0f, 1.0f ) * 255.0f ) << 24) |
-                 (uint32_t( std::clamp( b, 0.0f, 1.0f ) * 255.0f ) << 16) |
-                 (uint32_t( std::clamp( g, 0.0f, 1.0f ) * 255.0f ) << 8) |
-                  uint32_t( std::clamp( r, 0.0f, 1.0f ) * 255.0f );
+    AgxLog128( r0 );
+    AgxLog128( g0 );
+    AgxLog128( b0 );
 
-        src += 4;
-    }
-    while( --sz );
+    AgxCurve128( r0 );
+    AgxCurve128( g0 );
+    AgxCurve128( b0 );
+
+    r = r0;
+    g = g0;
+    b = b0;
 }
 
-void AgXPunchy( uint32_t* dst, float* src, size_t sz )
+void AgxLook128( __m128& r, __m128& g, __m128& b, float mr, float mg, float mb, float power, float saturation )
+{
+    __m128 luma = _mm_fmadd_ps( r, _mm_set1_ps( 0.2126f ), _mm_fmadd_ps( g, _mm_set1_ps( 0.7152f ), _mm_mul_ps( b, _mm_set1_ps( 0.0722f ) ) ) );
+    __m128 vr = Pow128( _mm_max_ps( _mm_mul_ps( r, _mm_set1_ps( mr ) ), _mm_setzero_ps() ), _mm_set1_ps( power ) );
+    __m128 vg = Pow128( _mm_max_ps( _mm_mul_ps( g, _mm_set1_ps( mg ) ), _mm_setzero_ps() ), _mm_set1_ps( power ) );
+    __m128 vb = Pow128( _mm_max_ps( _mm_mul_ps( b, _mm_set1_ps( mb ) ), _mm_setzero_ps() ), _mm_set1_ps( power ) );
+    r = _mm_fmadd_ps( _mm_sub_ps( vr, luma ), _mm_set1_ps( saturation ), luma );
+    g = _mm_fmadd_ps( _mm_sub_ps( vg, luma ), _mm_set1_ps( saturation ), luma );
+    b = _mm_fmadd_ps( _mm_sub_ps( vb, luma ), _mm_set1_ps( saturation ), luma );
+}
+
+void AgxEotf128( __m128& r, __m128& g, __m128& b )
+{
+    __m128 r0 = _mm_fmadd_ps( r, _mm_set1_ps( agx_mat_inv[0] ), _mm_fmadd_ps( g, _mm_set1_ps( agx_mat_inv[1] ), _mm_mul_ps( b, _mm_set1_ps( agx_mat_inv[2] ) ) ) );
+    __m128 g0 = _mm_fmadd_ps( r, _mm_set1_ps( agx_mat_inv[3] ), _mm_fmadd_ps( g, _mm_set1_ps( agx_mat_inv[4] ), _mm_mul_ps( b, _mm_set1_ps( agx_mat_inv[5] ) ) ) );
+    __m128 b0 = _mm_fmadd_ps( r, _mm_set1_ps( agx_mat_inv[6] ), _mm_fmadd_ps( g, _mm_set1_ps( agx_mat_inv[7] ), _mm_mul_ps( b, _mm_set1_ps( agx_mat_inv[8] ) ) ) );
+
+    r = Pow128( _mm_max_ps( r0, _mm_setzero_ps() ), _mm_set1_ps( 2.2f ) );
+    g = Pow128( _mm_max_ps( g0, _mm_setzero_ps() ), _mm_set1_ps( 2.2f ) );
+    b = Pow128( _mm_max_ps( b0, _mm_setzero_ps() ), _mm_set1_ps( 2.2f ) );
+}
+
+template<Look look>
+void Agx128( uint32_t* dst, const float* src )
+{
+    __m128 r = _mm_loadu_ps( src );
+    __m128 g = _mm_loadu_ps( src + 4 );
+    __m128 b = _mm_loadu_ps( src + 8 );
+    __m128 a = _mm_loadu_ps( src + 12 );
+    _MM_TRANSPOSE4_PS( r, g, b, a );
+
+    AgxTransform128( r, g, b );
+    if constexpr( look == Look::Golden ) AgxLook128( r, g, b, 1.f, 0.9f, 0.5f, 0.8f, 0.8f );
+    if constexpr( look == Look::Punchy ) AgxLook128( r, g, b, 1.f, 1.f, 1.f, 1.35f, 1.4f );
+    AgxEotf128( r, g, b );
+
+    __m128i ri = LinearToSrgb128( r );
+    __m128i gi = LinearToSrgb128( g );
+    __m128i bi = LinearToSrgb128( b );
+    __m128i ai = Quantize128( a );
+
+    __m128i v0 = _mm_or_si128( ri, _mm_slli_epi32( gi, 8 ) );
+    __m128i v1 = _mm_or_si128( _mm_slli_epi32( bi, 16 ), _mm_slli_epi32( ai, 24 ) );
+    _mm_storeu_si128( (__m128i*)dst, _mm_or_si128( v0, v1 ) );
+}
+#endif
+
+#if defined __AVX2__
+__m256 Pow256( __m256 x, __m256 y )
 {
-    do
+    return _mm256_exp_ps( _mm256_max_ps( _mm256_mul_ps( y, _mm256_log_ps( x ) ), _mm256_set1_ps( -126.f ) ) );
+}
+
+__m256i Quantize256( __m256 x )
+{
+    __m256 v0 = _mm256_min_ps( _mm256_max_ps( x, _mm256_setzero_ps() ), _mm256_set1_ps( 1.0f ) );
+    return _mm256_cvtps_epi32( _mm256_mul_ps( v0, _mm256_set1_ps( 255.0f ) ) );
+}
+
+void AgxCurve256( __m256& x )
+{
+    __m256 mask = _mm256_cmp_ps( x, _mm256_set1_ps( threshold ), _CMP_GE_OQ );
+    __m256 a = _mm256_blendv_ps( _mm256_set1_ps( a_up ), _mm256_set1_ps( a_down ), mask );
+    __m256 b = _mm256_blendv_ps( _mm256_set1_ps( b_up ), _mm256_set1_ps( b_down ), mask );
+    __m256 c = _mm256_blendv_ps( _mm256_set1_ps( c_up ), _mm256_set1_ps( c_down ), mask );
+
+    __m256 t0 = _mm256_andnot_ps( _mm256_set1_ps( -0.f ), _mm256_sub_ps( x, _mm256_set1_ps( threshold ) ) );
+    __m256 t1 = Pow256( t0, b );
+    __m256 t2 = _mm256_fmadd_ps( a, t1, _mm256_set1_ps( 1.f ) );
+    __m256 t3 = Pow256( t2, c );
+    __m256 t4 = _mm256_fmsub_ps( x, _mm256_set1_ps( 2.f ), _mm256_set1_ps( 2.f * threshold ) );
+    x = _mm256_fmadd_ps( t4, t3, _mm256_set1_ps( 0.5f ) );
+}
+
+void AgxLog256( __m256& x )
+{
+    __m256 t0 = _mm256_max_ps( x, _mm256_set1_ps( FLT_MIN ) );
+    __m256 t1 = _mm256_log_ps( t0 );
+    __m256 t2 = _mm256_fmadd_ps( t1, _mm256_set1_ps( invrange ), _mm256_set1_ps( -min_ev * invrange ) );
+    x = _mm256_min_ps( _mm256_max_ps( t2, _mm256_setzero_ps() ), _mm256_set1_ps( 1.f ) );
+}
+
+void AgxTransform256( __m256& r, __m256& g, __m256& b )
+{
+    __m256 r0 = _mm256_fmadd_ps( r, _mm256_set1_ps( agx_mat[0] ), _mm256_fmadd_ps( g, _mm256_set1_ps( agx_mat[1] ), _mm256_mul_ps( b, _mm256_set1_ps( agx_mat[2] ) ) ) );
+    __m256 g0 = _mm256_fmadd_ps( r, _mm256_set1_ps( agx_mat[3] ), _mm256_fmadd_ps( g, _mm256_set1_ps( agx_mat[4] ), _mm256_mul_ps( b, _mm256_set1_ps( agx_mat[5] ) ) ) );
+    __m256 b0 = _mm256_fmadd_ps( r, _mm256_set1_ps( agx_mat[6] ), _mm256_fmadd_ps( g, _mm256_set1_ps( agx_mat[7] ), _mm256_mul_ps( b, _mm256_set1_ps( agx_mat[8] ) ) ) );
+
+    AgxLog256( r0 );
+    AgxLog256( g0 );
+    AgxLog256( b0 );
+
+    AgxCurve256( r0 );
+    AgxCurve256( g0 );
+    AgxCurve256( b0 );
+
+    r = r0;
+    g = g0;
+    b = b0;
+}
+
+void AgxLook256( __m256& r, __m256& g, __m256& b, float mr, float mg, float mb, float power, float saturation )
+{
+    __m256 luma = _mm256_fmadd_ps( r, _mm256_set1_ps( 0.2126f ), _mm256_fmadd_ps( g, _mm256_set1_ps( 0.7152f ), _mm256_mul_ps( b, _mm256_set1_ps( 0.0722f ) ) ) );
+    __m256 vr = Pow256( _mm256_max_ps( _mm256_mul_ps( r, _mm256_set1_ps( mr ) ), _mm256_setzero_ps() ), _mm256_set1_ps( power ) );
+    __m256 vg = Pow256( _mm256_max_ps( _mm256_mul_ps( g, _mm256_set1_ps( mg ) ), _mm256_setzero_ps() ), _mm256_set1_ps( power ) );
+    __m256 vb = Pow256( _mm256_max_ps( _mm256_mul_ps( b, _mm256_set1_ps( mb ) ), _mm256_setzero_ps() ), _mm256_set1_ps( power ) );
+    r = _mm256_fmadd_ps( _mm256_sub_ps( vr, luma ), _mm256_set1_ps( saturation ), luma );
+    g = _mm256_fmadd_ps( _mm256_sub_ps( vg, luma ), _mm256_set1_ps( saturation ), luma );
+    b = _mm256_fmadd_ps( _mm256_sub_ps( vb, luma ), _mm256_set1_ps( saturation ), luma );
+}
+
+void AgxEotf256( __m256& r, __m256& g, __m256& b )
+{
+    __m256 r0 = _mm256_fmadd_ps( r, _mm256_set1_ps( agx_mat_inv[0] ), _mm256_fmadd_ps( g, _mm256_set1_ps( agx_mat_inv[1] ), _mm256_mul_ps( b, _mm256_set1_ps( agx_mat_inv[2] ) ) ) );
+    __m256 g0 = _mm256_fmadd_ps( r, _mm256_set1_ps( agx_mat_inv[3] ), _mm256_fmadd_ps( g, _mm256_set1_ps( agx_mat_inv[4] ), _mm256_mul_ps( b, _mm256_set1_ps( agx_mat_inv[5] ) ) ) );
+    __m256 b0 = _mm256_fmadd_ps( r, _mm256_set1_ps( agx_mat_inv[6] ), _mm256_fmadd_ps( g, _mm256_set1_ps( agx_mat_inv[7] ), _mm256_mul_ps( b, _mm256_set1_ps( agx_mat_inv[8] ) ) ) );
+
+    r = Pow256( _mm256_max_ps( r0, _mm256_setzero_ps() ), _mm256_set1_ps( 2.2f ) );
+    g = Pow256( _mm256_max_ps( g0, _mm256_setzero_ps() ), _mm256_set1_ps( 2.2f ) );
+    b = Pow256( _mm256_max_ps( b0, _mm256_setzero_ps() ), _mm256_set1_ps( 2.2f ) );
+}
+
+template<Look look>
+void Agx256( uint32_t* dst, const float* src )
+{
+    __m256 s0 = _mm256_loadu_ps( src );
+    __m256 s1 = _mm256_loadu_ps( src + 8 );
+    __m256 s2 = _mm256_loadu_ps( src + 16 );
+    __m256 s3 = _mm256_loadu_ps( src + 24 );
+
+    // Transpose within 128-bit lanes, pixel order is restored on store
+    __m256 t0 = _mm256_unpacklo_ps( s0, s1 );
+    __m256 t1 = _mm256_unpackhi_ps( s0, s1 );
+    __m256 t2 = _mm256_unpacklo_ps( s2, s3 );
+    __m256 t3 = _mm256_unpackhi_ps( s2, s3 );
+    __m256 r = _mm256_shuffle_ps( t0, t2, _MM_SHUFFLE( 1, 0, 1, 0 ) );
+    __m256 g = _mm256_shuffle_ps( t0, t2, _MM_SHUFFLE( 3, 2, 3, 2 ) );
+    __m256 b = _mm256_shuffle_ps( t1, t3, _MM_SHUFFLE( 1, 0, 1, 0 ) );
+    __m256 a = _mm256_shuffle_ps( t1, t3, _MM_SHUFFLE( 3, 2, 3, 2 ) );
+
+    AgxTransform256( r, g, b );
+    if constexpr( look == Look::Golden ) AgxLook256( r, g, b, 1.f, 0.9f, 0.5f, 0.8f, 0.8f );
+    if constexpr( look == Look::Punchy ) AgxLook256( r, g, b, 1.f, 1.f, 1.f, 1.35f, 1.4f );
+    AgxEotf256( r, g, b );
+
+    __m256i ri = LinearToSrgb256( r );
+    __m256i gi = LinearToSrgb256( g );
+    __m256i bi = LinearToSrgb256( b );
+    __m256i ai = Quantize256( a );
+
+    __m256i v0 = _mm256_or_si256( ri, _mm256_slli_epi32( gi, 8 ) );
+    __m256i v1 = _mm256_or_si256( _mm256_slli_epi32( bi, 16 ), _mm256_slli_epi32( ai, 24 ) );
+    __m256i v2 = _mm256_permutevar8x32_epi32( _mm256_or_si256( v0, v1 ), _mm256_setr_epi32( 0, 4, 1, 5, 2, 6, 3, 7 ) );
+    _mm256_storeu_si256( (__m256i*)dst, v2 );
+}
+#endif
+
+#if defined __AVX512F__
+__m512 Pow512( __m512 x, __m512 y )
+{
+    return _mm512_exp_ps( _mm512_max_ps( _mm512_mul_ps( y, _mm512_log_ps( x ) ), _mm512_set1_ps( -126.f ) ) );
+}
+
+__m512i Quantize512( __m512 x )
+{
+    __m512 v0 = _mm512_min_ps( _mm512_max_ps( x, _mm512_setzero_ps() ), _mm512_set1_ps( 1.0f ) );
+    return _mm512_cvtps_epi32( _mm512_mul_ps( v0, _mm512_set1_ps( 255.0f ) ) );
+}
+
+void AgxCurve512( __m512& x )
+{
+    __mmask16 mask = _mm512_cmp_ps_mask( x, _mm512_set1_ps( threshold ), _CMP_GE_OQ );
+    __m512 a = _mm512_mask_blend_ps( mask, _mm512_set1_ps( a_up ), _mm512_set1_ps( a_down ) );
+    __m512 b = _mm512_mask_blend_ps( mask, _mm512_set1_ps( b_up ), _mm512_set1_ps( b_down ) );
+    __m512 c = _mm512_mask_blend_ps( mask, _mm512_set1_ps( c_up ), _mm512_set1_ps( c_down ) );
+
+    __m512 t0 = _mm512_abs_ps( _mm512_sub_ps( x, _mm512_set1_ps( threshold ) ) );
+    __m512 t1 = Pow512( t0, b );
+    __m512 t2 = _mm512_fmadd_ps( a, t1, _mm512_set1_ps( 1.f ) );
+    __m512 t3 = Pow512( t2, c );
+    __m512 t4 = _mm512_fmsub_ps( x, _mm512_set1_ps( 2.f ), _mm512_set1_ps( 2.f * threshold ) );
+    x = _mm512_fmadd_ps( t4, t3, _mm512_set1_ps( 0.5f ) );
+}
+
+void AgxLog512( __m512& x )
+{
+    __m512 t0 = _mm512_max_ps( x, _mm512_set1_ps( FLT_MIN ) );
+    __m512 t1 = _mm512_log_ps( t0 );
+    __m512 t2 = _mm512_fmadd_ps( t1, _mm512_set1_ps( invrange ), _mm512_set1_ps( -min_ev * invrange ) );
+    x = _mm512_min_ps( _mm512_max_ps( t2, _mm512_setzero_ps() ), _mm512_set1_ps( 1.f ) );
+}
+
+void AgxTransform512( __m512& r, __m512& g, __m512& b )
+{
+    __m512 r0 = _mm512_fmadd_ps( r, _mm512_set1_ps( agx_mat[0] ), _mm512_fmadd_ps( g, _mm512_set1_ps( agx_mat[1] ), _mm512_mul_ps( b, _mm512_set1_ps( agx_mat[2] ) ) ) );
+    __m512 g0 = _mm512_fmadd_ps( r, _mm512_set1_ps( agx_mat[3] ), _mm512_fmadd_ps( g, _mm512_set1_ps( agx_mat[4] ), _mm512_mul_ps( b, _mm512_set1_ps( agx_mat[5] ) ) ) );
+    __m512 b0 = _mm512_fmadd_ps( r, _mm512_set1_ps( agx_mat[6] ), _mm512_fmadd_ps( g, _mm512_set1_ps( agx_mat[7] ), _mm512_mul_ps( b, _mm512_set1_ps( agx_mat[8] ) ) ) );
+
+    AgxLog512( r0 );
+    AgxLog512( g0 );
+    AgxLog512( b0 );
+
+    AgxCurve512( r0 );
+    AgxCurve512( g0 );
+    AgxCurve512( b0 );
+
+    r = r0;
+    g = g0;
+    b = b0;
+}
+
+void AgxLook512( __m512& r, __m512& g, __m512& b, float mr, float mg, float mb, float power, float saturation )
+{
+    __m512 luma = _mm512_fmadd_ps( r, _mm512_set1_ps( 0.2126f ), _mm512_fmadd_ps( g, _mm512_set1_ps( 0.7152f ), _mm512_mul_ps( b, _mm512_set1_ps( 0.0722f ) ) ) );
+    __m512 vr = Pow512( _mm512_max_ps( _mm512_mul_ps( r, _mm512_set1_ps( mr ) ), _mm512_setzero_ps() ), _mm512_set1_ps( power ) );
+    __m512 vg = Pow512( _mm512_max_ps( _mm512_mul_ps( g, _mm512_set1_ps( mg ) ), _mm512_setzero_ps() ), _mm512_set1_ps( power ) );
+    __m512 vb = Pow512( _mm512_max_ps( _mm512_mul_ps( b, _mm512_set1_ps( mb ) ), _mm512_setzero_ps() ), _mm512_set1_ps( power ) );
+    r = _mm512_fmadd_ps( _mm512_sub_ps( vr, luma ), _mm512_set1_ps( saturation ), luma );
+    g = _mm512_fmadd_ps( _mm512_sub_ps( vg, luma ), _mm512_set1_ps( saturation ), luma );
+    b = _mm512_fmadd_ps( _mm512_sub_ps( vb, luma ), _mm512_set1_ps( saturation ), luma );
+}
+
+void AgxEotf512( __m512& r, __m512& g, __m512& b )
+{
+    __m512 r0 = _mm512_fmadd_ps( r, _mm512_set1_ps( agx_mat_inv[0] ), _mm512_fmadd_ps( g, _mm512_set1_ps( agx_mat_inv[1] ), _mm512_mul_ps( b, _mm512_set1_ps( agx_mat_inv[2] ) ) ) );
+    __m512 g0 = _mm512_fmadd_ps( r, _mm512_set1_ps( agx_mat_inv[3] ), _mm512_fmadd_ps( g, _mm512_set1_ps( agx_mat_inv[4] ), _mm512_mul_ps( b, _mm512_set1_ps( agx_mat_inv[5] ) ) ) );
+    __m512 b0 = _mm512_fmadd_ps( r, _mm512_set1_ps( agx_mat_inv[6] ), _mm512_fmadd_ps( g, _mm512_set1_ps( agx_mat_inv[7] ), _mm512_mul_ps( b, _mm512_set1_ps( agx_mat_inv[8] ) ) ) );
+
+    r = Pow512( _mm512_max_ps( r0, _mm512_setzero_ps() ), _mm512_set1_ps( 2.2f ) );
+    g = Pow512( _mm512_max_ps( g0, _mm512_setzero_ps() ), _mm512_set1_ps( 2.2f ) );
+    b = Pow512( _mm512_max_ps( b0, _mm512_setzero_ps() ), _mm512_set1_ps( 2.2f ) );
+}
+
+template<Look look>
+void Agx512( uint32_t* dst, const float* src )
+{
+    __m512 s0 = _mm512_loadu_ps( src );
+    __m512 s1 = _mm512_loadu_ps( src + 16 );
+    __m512 s2 = _mm512_loadu_ps( src + 32 );
+    __m512 s3 = _mm512_loadu_ps( src + 48 );
+
+    __m512 t0 = _mm512_unpacklo_ps( s0, s1 );
+    __m512 t1 = _mm512_unpackhi_ps( s0, s1 );
+    __m512 t2 = _mm512_unpacklo_ps( s2, s3 );
+    __m512 t3 = _mm512_unpackhi_ps( s2, s3 );
+    __m512 r = _mm512_shuffle_ps( t0, t2, _MM_SHUFFLE( 1, 0, 1, 0 ) );
+    __m512 g = _mm512_shuffle_ps( t0, t2, _MM_SHUFFLE( 3, 2, 3, 2 ) );
+    __m512 b = _mm512_shuffle_ps( t1, t3, _MM_SHUFFLE( 1, 0, 1, 0 ) );
+    __m512 a = _mm512_shuffle_ps( t1, t3, _MM_SHUFFLE( 3, 2, 3, 2 ) );
+
+    AgxTransform512( r, g, b );
+    if constexpr( look == Look::Golden ) AgxLook512( r, g, b, 1.f, 0.9f, 0.5f, 0.8f, 0.8f );
+    if constexpr( look == Look::Punchy ) AgxLook512( r, g, b, 1.f, 1.f, 1.f, 1.35f, 1.4f );
+    AgxEotf512( r, g, b );
+
+    __m512i ri = LinearToSrgb512( r );
+    __m512i gi = LinearToSrgb512( g );
+    __m512i bi = LinearToSrgb512( b );
+    __m512i ai = Quantize512( a );
+
+    __m512i v0 = _mm512_or_si512( ri, _mm512_slli_epi32( gi, 8 ) );
+    __m512i v1 = _mm512_or_si512( _mm512_slli_epi32( bi, 16 ), _mm512_slli_epi32( ai, 24 ) );
+    __m512i v2 = _mm512_permutexvar_epi32( _mm512_setr_epi32( 0, 4, 8, 12, 1, 5, 9, 13, 2, 6, 10, 14, 3, 7, 11, 15 ), _mm512_or_si512( v0, v1 ) );
+    _mm512_storeu_si512( dst, v2 );
+}
+#endif
+
+template<Look look>
+void AgxProcess( uint32_t* dst, float* src, size_t sz )
+{
+#if defined __SSE4_1__ && defined __FMA__
+#  if defined __AVX512F__
+    while( sz > 15 )
+    {
+        Agx512<look>( dst, src );
+        dst += 16;
+        src += 64;
+        sz -= 16;
+    }
+#  endif
+#  if defined __AVX2__
+    while( sz > 7 )
+    {
+        Agx256<look>( dst, src );
+        dst += 8;
+        src += 32;
+        sz -= 8;
+    }
+#  endif
+    while( sz > 3 )
+    {
+        Agx128<look>( dst, src );
+        dst += 4;
+        src += 16;
+        sz -= 4;
+    }
+#endif
+    while( sz > 0 )
     {
         auto color = AgxTransform( { src[0], src[1], src[2] } );
-        color = AgxLookPunchy( color );
+        if constexpr( look == Look::Golden ) color = AgxLookGolden( color );
+        if constexpr( look == Look::Punchy ) color = AgxLookPunchy( color );
         color = AgxEotf( color );
 
-        const auto r = LinearToSrgb( color.r );
-        const auto g = LinearToSrgb( color.g );
-        const auto b = LinearToSrgb( color.b );
         const auto a = src[3];
 
         *dst++ = (uint32_t( std::clamp( a, 0.0f, 1.0f ) * 255.0f ) << 24) |
-                 (uint32_t( std::clamp( b, 0.0f, 1.0f ) * 255.0f ) << 16) |
-                 (uint32_t( std::clamp( g, 0.0f, 1.0f ) * 255.0f ) << 8) |
-                  uint32_t( std::clamp( r, 0.0f, 1.0f ) * 255.0f );
+                 (uint32_t( LinearToSrgb8( color.b ) ) << 16) |
+                 (uint32_t( LinearToSrgb8( color.g ) ) << 8) |
+                  uint32_t( LinearToSrgb8( color.r ) );
 
         src += 4;
+        sz--;
     }
-    while( --sz );
+}
+
+void AgX( uint32_t* dst, float* src, size_t sz )
+{
+    AgxProcess<Look::None>( dst, src, sz );
+}
+
+void AgXGolden( uint32_t* dst, float* src, size_t sz )
+{
+    AgxProcess<Look::Golden>( dst, src, sz );
+}
+
+void AgXPunchy( uint32_t* dst, float* src, size_t sz )
+{
+    AgxProcess<Look::Punchy>( dst, src, sz );
 }
 
 }
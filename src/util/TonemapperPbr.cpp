@@ -2,8 +2,8 @@
 #include <cfloat>
 #include <cmath>
 
-#include "Simd.hpp"
 #include "Tonemapper.hpp"
+#include "TonemapperSrgb.hpp"
 
 namespace ToneMap
 {
@@ -45,8 +45,8 @@ HdrColor PbrNeutral( const HdrColor& hdr )
 __m128 PbrNeutral128( __m128 hdr )
 {
     __m128 vx0 = _mm_blend_ps( hdr, _mm_set1_ps( FLT_MAX ), 0x8 );
-    __m128 vx1 = _mm_shuffle_ps( hdr, hdr, _MM_SHUFFLE( 0, 1, 3, 2 ) );
-    __m128 vx2 = _mm_min_ps( hdr, vx1 );
+    __m128 vx1 = _mm_shuffle_ps( vx0, vx0, _MM_SHUFFLE( 0, 1, 3, 2 ) );
+    __m128 vx2 = _mm_min_ps( vx0, vx1 );
     __m128 vx3 = _mm_shuffle_ps( vx2, vx2, _MM_SHUFFLE( 2, 3, 0, 1 ) );
     __m128 vx = _mm_min_ps( vx2, vx3 );
 
@@ -89,8 +89,8 @@ __m128 PbrNeutral128( __m128 hdr )
 __m256 PbrNeutral256( __m256 hdr )
 {
     __m256 vx0 = _mm256_blend_ps( hdr, _mm256_set1_ps( FLT_MAX ), 0x88 );
-    __m256 vx1 = _mm256_shuffle_ps( hdr, hdr, _MM_SHUFFLE( 0, 1, 3, 2 ) );
-    __m256 vx2 = _mm256_min_ps( hdr, vx1 );
+    __m256 vx1 = _mm256_shuffle_ps( vx0, vx0, _MM_SHUFFLE( 0, 1, 3, 2 ) );
+    __m256 vx2 = _mm256_min_ps( vx0, vx1 );
     __m256 vx3 = _mm256_shuffle_ps( vx2, vx2, _MM_SHUFFLE( 2, 3, 0, 1 ) );
     __m256 vx = _mm256_min_ps( vx2, vx3 );
 
@@ -133,8 +133,8 @@ __m256 PbrNeutral256( __m256 hdr )
 __m512 PbrNeutral512( __m512 hdr )
 {
     __m512 vx0 = _mm512_mask_blend_ps( 0x8888, hdr, _mm512_set1_ps( FLT_MAX ) );
-    __m512 vx1 = _mm512_shuffle_ps( hdr, hdr, _MM_SHUFFLE( 0, 1, 3, 2 ) );
-    __m512 vx2 = _mm512_min_ps( hdr, vx1 );
+    __m512 vx1 = _mm512_shuffle_ps( vx0, vx0, _MM_SHUFFLE( 0, 1, 3, 2 ) );
+    __m512 vx2 = _mm512_min_ps( vx0, vx1 );
     __m512 vx3 = _mm512_shuffle_ps( vx2, vx2, _MM_SHUFFLE( 2, 3, 0, 1 ) );
     __m512 vx = _mm512_min_ps( vx2, vx3 );
 
@@ -181,17 +181,11 @@ void PbrNeutral( uint32_t* dst, float* src, size_t sz )
     {
         __m512 s0 = _mm512_loadu_ps( src );
         __m512 v0 = PbrNeutral512( s0 );
-        __mmask16 v1 = _mm512_cmp_ps_mask( v0, _mm512_set1_ps( 0.0031308f ), _CMP_LE_OQ );
-        __m512 v2 = _mm512_mul_ps( v0, _mm512_set1_ps( 12.92f ) );
-        __m512 v3 = _mm512_pow_ps( v0, _mm512_set1_ps( 1.0f / 2.4f ) );
-        __m512 v4 = _mm512_mul_ps( v3, _mm512_set1_ps( 1.055f ) );
-        __m512 v5 = _mm512_sub_ps( v4, _mm512_set1_ps( 0.055f ) );
-        __m512 v6 = _mm512_mask_blend_ps( v1, v5, v2 );
-        __m512 v7 = _mm512_mask_blend_ps( 0x8888, v6, s0 );
-        __m512 v8 = _mm512_min_ps( v7, _mm512_set1_ps( 1.0f ) );
-        __m512 v9 = _mm512_max_ps( v8, _mm512_setzero_ps() );
-        __m512 v10 = _mm512_mul_ps( v9, _mm512_set1_ps( 255.0f ) );
-        __m512i v11 = _mm512_cvtps_epi32( v10 );
+        __m512i v1 = LinearToSrgb512( v0 );
+        __m512 v2 = _mm512_min_ps( s0, _mm512_set1_ps( 1.0f ) );
+        __m512 v3 = _mm512_max_ps( v2, _mm512_setzero_ps() );
+        __m512i v4 = _mm512_cvtps_epi32( _mm512_mul_ps( v3, _mm512_set1_ps( 255.0f ) ) );
+        __m512i v11 = _mm512_mask_blend_epi32( 0x8888, v1, v4 );
         __m512i v12 = _mm512_packus_epi32( v11, v11 );
         __m512i v13 = _mm512_packus_epi16( v12, v12 );
         *dst++ = _mm_cvtsi128_si32( _mm512_castsi512_si128( v13 ) );
@@ -209,17 +203,11 @@ void PbrNeutral( uint32_t* dst, float* src, size_t sz )
     {
         __m256 s0 = _mm256_loadu_ps( src );
         __m256 v0 = PbrNeutral256( s0 );
-        __m256 v1 = _mm256_cmp_ps( v0, _mm256_set1_ps( 0.0031308f ), _CMP_LE_OQ );
-        __m256 v2 = _mm256_mul_ps( v0, _mm256_set1_ps( 12.92f ) );
-        __m256 v3 = _mm256_pow_ps( v0, _mm256_set1_ps( 1.0f / 2.4f ) );
-        __m256 v4 = _mm256_mul_ps( v3, _mm256_set1_ps( 1.055f ) );
-        __m256 v5 = _mm256_sub_ps( v4, _mm256_set1_ps( 0.055f ) );
-        __m256 v6 = _mm256_blendv_ps( v5, v2, v1 );
-        __m256 v7 = _mm256_blend_ps( v6, s0, 0x88 );
-        __m256 v8 = _mm256_min_ps( v7, _mm256_set1_ps( 1.0f ) );
-        __m256 v9 = _mm256_max_ps( v8, _mm256_setzero_ps() );
-        __m256 v10 = _mm256_mul_ps( v9, _mm256_set1_ps( 255.0f ) );
-        __m256i v11 = _mm256_cvtps_epi32( v10 );
+        __m256i v1 = LinearToSrgb256( v0 );
+        __m256 v2 = _mm256_min_ps( s0, _mm256_set1_ps( 1.0f ) );
+        __m256 v3 = _mm256_max_ps( v2, _mm256_setzero_ps() );
+        __m256i v4 = _mm256_cvtps_epi32( _mm256_mul_ps( v3, _mm256_set1_ps( 255.0f ) ) );
+        __m256i v11 = _mm256_blend_epi32( v1, v4, 0x88 );
         __m256i v12 = _mm256_packus_epi32( v11, v11 );
         __m256i v13 = _mm256_packus_epi16( v12, v12 );
         *dst++ = _mm_cvtsi128_si32( _mm256_castsi256_si128( v13 ) );
@@ -231,21 +219,13 @@ void PbrNeutral( uint32_t* dst, float* src, size_t sz )
 #endif
     while( sz > 0 )
     {
-        const auto color = PbrNeutral( { src[0], src[1], src[2] } );
-
         __m128 s0 = _mm_loadu_ps( src );
         __m128 v0 = PbrNeutral128( s0 );
-        __m128 v1 = _mm_cmple_ps( v0, _mm_set1_ps( 0.0031308f ) );
-        __m128 v2 = _mm_mul_ps( v0, _mm_set1_ps( 12.92f ) );
-        __m128 v3 = _mm_pow_ps( v0, _mm_set1_ps( 1.0f / 2.4f ) );
-        __m128 v4 = _mm_mul_ps( v3, _mm_set1_ps( 1.055f ) );
-        __m128 v5 = _mm_sub_ps( v4, _mm_set1_ps( 0.055f ) );
-        __m128 v6 = _mm_blendv_ps( v5, v2, v1 );
-        __m128 v7 = _mm_blend_ps( v6, s0, 0x8 );
-        __m128 v8 = _mm_min_ps( v7, _mm_set1_ps( 1.0f ) );
-        __m128 v9 = _mm_max_ps( v8, _mm_setzero_ps() );
-        __m128 v10 = _mm_mul_ps( v9, _mm_set1_ps( 255.0f ) );
-        __m128i v11 = _mm_cvtps_epi32( v10 );
+        __m128i v1 = LinearToSrgb128( v0 );
+        __m128 v2 = _mm_min_ps( s0, _mm_set1_ps( 1.0f ) );
+        __m128 v3 = _mm_max_ps( v2, _mm_setzero_ps() );
+        __m128i v4 = _mm_cvtps_epi32( _mm_mul_ps( v3, _mm_set1_ps( 255.0f ) ) );
+        __m128i v11 = _mm_blend_epi16( v1, v4, 0xC0 );
         __m128i v12 = _mm_packus_epi32( v11, v11 );
         __m128i v13 = _mm_packus_epi16( v12, v12 );
         *dst++ = _mm_cvtsi128_si32( v13 );
@@ -257,16 +237,12 @@ void PbrNeutral( uint32_t* dst, float* src, size_t sz )
     do
     {
         const auto color = PbrNeutral( { src[0], src[1], src[2] } );
-
-        const auto r = LinearToSrgb( color.r );
-        const auto g = LinearToSrgb( color.g );
-        const auto b = LinearToSrgb( color.b );
         const auto a = src[3];
 
         *dst++ = (uint32_t( std::clamp( a, 0.0f, 1.0f ) * 255.0f ) << 24) |
-                 (uint32_t( std::clamp( b, 0.0f, 1.0f ) * 255.0f ) << 16) |
-                 (uint32_t( std::clamp( g, 0.0f, 1.0f ) * 255.0f ) << 8) |
-                  uint32_t( std::clamp( r, 0.0f, 1.0f ) * 255.0f );
+                 (uint32_t( LinearToSrgb8( color.b ) ) << 16) |
+                 (uint32_t( LinearToSrgb8( color.g ) ) << 8) |
+                  uint32_t( LinearToSrgb8( color.r ) );
 
         src += 4;
     }
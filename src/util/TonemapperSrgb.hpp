@@ -0,0 +1,66 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+#include "Simd.hpp"
+
+namespace ToneMap
+{
+
+// Linear to 8-bit sRGB lookup, indexed by exponent and top 8 mantissa bits of
+// the input in [2^-13, 1]. Lower values all quantize to 0. The table is padded
+// so that 32-bit gathers at the last index stay in bounds.
+constexpr float SrgbLutMin = 1.f / 8192;
+constexpr float SrgbLutMax = 1.f;
+constexpr uint32_t SrgbLutBase = ( 127 - 13 ) << 8;
+constexpr uint32_t SrgbLutSize = 13 * 256 + 1;
+
+extern uint8_t SrgbLut[SrgbLutSize + 3];
+
+static inline uint8_t LinearToSrgb8( float x )
+{
+    x = x > SrgbLutMin ? x : SrgbLutMin;
+    x = x < SrgbLutMax ? x : SrgbLutMax;
+    uint32_t bits;
+    memcpy( &bits, &x, sizeof( bits ) );
+    return SrgbLut[( bits >> 15 ) - SrgbLutBase];
+}
+
+#if defined __SSE4_1__ && defined __FMA__
+static inline __m128i LinearToSrgb128( __m128 x )
+{
+    __m128 v0 = _mm_max_ps( x, _mm_set1_ps( SrgbLutMin ) );
+    __m128 v1 = _mm_min_ps( v0, _mm_set1_ps( SrgbLutMax ) );
+    __m128i v2 = _mm_sub_epi32( _mm_srli_epi32( _mm_castps_si128( v1 ), 15 ), _mm_set1_epi32( SrgbLutBase ) );
+    return _mm_setr_epi32(
+        SrgbLut[_mm_extract_epi32( v2, 0 )],
+        SrgbLut[_mm_extract_epi32( v2, 1 )],
+        SrgbLut[_mm_extract_epi32( v2, 2 )],
+        SrgbLut[_mm_extract_epi32( v2, 3 )] );
+}
+#endif
+
+#if defined __AVX2__
+static inline __m256i LinearToSrgb256( __m256 x )
+{
+    __m256 v0 = _mm256_max_ps( x, _mm256_set1_ps( SrgbLutMin ) );
+    __m256 v1 = _mm256_min_ps( v0, _mm256_set1_ps( SrgbLutMax ) );
+    __m256i v2 = _mm256_sub_epi32( _mm256_srli_epi32( _mm256_castps_si256( v1 ), 15 ), _mm256_set1_epi32( SrgbLutBase ) );
+    __m256i v3 = _mm256_i32gather_epi32( (const int*)SrgbLut, v2, 1 );
+    return _mm256_and_si256( v3, _mm256_set1_epi32( 0xFF ) );
+}
+#endif
+
+#if defined __AVX512F__
+static inline __m512i LinearToSrgb512( __m512 x )
+{
+    __m512 v0 = _mm512_max_ps( x, _mm512_set1_ps( SrgbLutMin ) );
+    __m512 v1 = _mm512_min_ps( v0, _mm512_set1_ps( SrgbLutMax ) );
+    __m512i v2 = _mm512_sub_epi32( _mm512_srli_epi32( _mm512_castps_si512( v1 ), 15 ), _mm512_set1_epi32( SrgbLutBase ) );
+    __m512i v3 = _mm512_i32gather_epi32( v2, SrgbLut, 1 );
+    return _mm512_and_si512( v3, _mm512_set1_epi32( 0xFF ) );
+}
+#endif
+
+}